@@ -0,0 +1,241 @@
+//Comprobaciones de blur_effect sin imágenes externas: un jpg con marcadores de reinicio codificado por bandas tiene
+//que decodificarse igual con el decodificador serie y con el paralelo, e igual que el mismo jpg sin bandas; y cada
+//motor de libblur tiene que quedar cerca del motor directo, que es la referencia. Devuelve 0 si todo pasa
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_library/stb_image.h"
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_library/stb_image_write.h"
+
+#include "libblur.h"
+
+//Medidas que no son múltiplo del MCU, para que la última banda y la última columna queden incompletas. La imagen
+//del códec es más grande: el decodificador solo reparte un jpg con más de dos tareas de 512 MCUs
+#define CODEC_WIDTH 1003
+#define CODEC_HEIGHT 611
+#define CHECK_WIDTH 203
+#define CHECK_HEIGHT 157
+
+static int failures = 0;
+
+
+static void check(int ok, const char* what){
+
+    printf("%-80s %s\n", what, ok ? "ok" : "FALLA");
+    failures += !ok;
+}
+
+
+//Imagen sintética de width x height con channels canales: gradientes con bordes y un poco de ruido, para que el
+//jpg tenga coeficientes de todas las frecuencias y el filtro algo que suavizar
+static unsigned char* synthetic_image(int width, int height, int channels){
+
+    unsigned char* pixels = (unsigned char*)malloc((size_t)width * height * channels);
+    unsigned int noise = 12345;
+
+    if(pixels == NULL)
+        return NULL;
+
+    for(int y = 0; y < height; ++y)
+        for(int x = 0; x < width; ++x)
+            for(int c = 0; c < channels; ++c) {
+                noise = noise * 1103515245u + 12345u;
+                int value = (x * (c + 1) * 3 + y * 2) % 256;
+                if(((x / 16) + (y / 16)) % 2)
+                    value = 255 - value;
+                if(c == 3)
+                    value = 64 + (x + y) % 192;
+                pixels[((size_t)y * width + x) * channels + c] = (unsigned char)(value ^ (noise >> 28));
+            }
+
+    return pixels;
+}
+
+
+//Buffer en memoria donde escribe stbi_write_jpg
+struct memory_file {
+    unsigned char* data;
+    size_t size;
+    size_t capacity;
+};
+
+static void memory_write(void* context, void* data, int size){
+
+    struct memory_file* f = (struct memory_file*)context;
+
+    if(f->size + size > f->capacity) {
+        size_t capacity = f->capacity ? f->capacity : 65536;
+        while(capacity < f->size + size)
+            capacity *= 2;
+        unsigned char* grown = (unsigned char*)realloc(f->data, capacity);
+        if(grown == NULL)
+            return;
+        f->data = grown;
+        f->capacity = capacity;
+    }
+
+    memcpy(f->data + f->size, data, size);
+    f->size += size;
+}
+
+
+//"Paralelo" que ejecuta las tareas en orden inverso en el hilo que llama: una banda que dependiera de la anterior
+//daría otro resultado. Cuenta en *context las tareas, para saber que el códec tomó la ruta por bandas
+static void reverse_for(void* context, int count, void (*task)(void* task_arg, int index), void* task_arg){
+
+    *(int*)context += count;
+
+    for(int i = count - 1; i >= 0; --i)
+        task(task_arg, i);
+}
+
+
+//Cuenta los marcadores RSTn del flujo
+static int count_restart_markers(const struct memory_file* f){
+
+    int markers = 0;
+
+    for(size_t i = 0; i + 1 < f->size; ++i)
+        markers += f->data[i] == 0xFF && f->data[i + 1] >= 0xD0 && f->data[i + 1] <= 0xD7;
+
+    return markers;
+}
+
+
+//Codifica la imagen con bands bandas y sin ellas, y decodifica la versión por bandas con los dos decodificadores
+static void check_restart_roundtrip(int channels, int quality, int bands){
+
+    char what[128];
+    unsigned char* pixels = synthetic_image(CODEC_WIDTH, CODEC_HEIGHT, channels);
+    struct memory_file plain = { NULL, 0, 0 };
+    struct memory_file banded = { NULL, 0, 0 };
+    int encode_tasks = 0;
+    int decode_tasks = 0;
+
+    int written = pixels &&
+                  stbi_write_jpg_to_func(memory_write, &plain, CODEC_WIDTH, CODEC_HEIGHT, channels, pixels, quality) &&
+                  stbi_write_jpg_parallel_to_func(memory_write, &banded, CODEC_WIDTH, CODEC_HEIGHT, channels, pixels, quality,
+                                                  bands, reverse_for, &encode_tasks);
+
+    snprintf(what, sizeof(what), "jpg %d canales, calidad %d, %d bandas: codificado", channels, quality, bands);
+    check(written && encode_tasks > 1 && count_restart_markers(&banded) == encode_tasks - 1, what);
+
+    int w[3], h[3], n[3];
+    unsigned char* reference = written ? stbi_load_from_memory(plain.data, (int)plain.size, &w[0], &h[0], &n[0], channels) : NULL;
+    unsigned char* serial = written ? stbi_load_from_memory(banded.data, (int)banded.size, &w[1], &h[1], &n[1], channels) : NULL;
+    unsigned char* parallel = written ? stbi_load_from_memory_parallel(banded.data, (int)banded.size, &w[2], &h[2], &n[2], channels,
+                                                                       reverse_for, &decode_tasks) : NULL;
+    size_t bytes = (size_t)CODEC_WIDTH * CODEC_HEIGHT * channels;
+
+    //Los marcadores de reinicio solo cambian la codificación entrópica: los coeficientes cuantizados son los mismos
+    snprintf(what, sizeof(what), "jpg %d canales, calidad %d, %d bandas: serie igual que sin bandas", channels, quality, bands);
+    check(reference && serial && w[1] == CODEC_WIDTH && h[1] == CODEC_HEIGHT && memcmp(reference, serial, bytes) == 0, what);
+
+    snprintf(what, sizeof(what), "jpg %d canales, calidad %d, %d bandas: paralelo igual que serie", channels, quality, bands);
+    check(serial && parallel && decode_tasks > 1 && w[2] == CODEC_WIDTH && h[2] == CODEC_HEIGHT && memcmp(serial, parallel, bytes) == 0, what);
+
+    stbi_image_free(reference);
+    stbi_image_free(serial);
+    stbi_image_free(parallel);
+    free(plain.data);
+    free(banded.data);
+    free(pixels);
+}
+
+
+//Mayor diferencia absoluta y diferencia media entre dos imágenes de bytes bytes
+static int compare_images(const unsigned char* a, const unsigned char* b, size_t bytes, double* mean){
+
+    int worst = 0;
+    double total = 0.0;
+
+    for(size_t i = 0; i < bytes; ++i) {
+        int d = abs((int)a[i] - (int)b[i]);
+        total += d;
+        if(d > worst)
+            worst = d;
+    }
+
+    *mean = total / bytes;
+    return worst;
+}
+
+
+//Difumina la imagen con cada motor y la compara con el directo, con la mayor diferencia y la diferencia media que
+//acepta cada uno. El separable y el FFT calculan la misma convolución en otro orden y el de punto fijo redondea los
+//pesos. La caja y el recursivo solo aproximan la gaussiana, y con bordes clamp o constant se alejan más junto al
+//borde, porque cada pasada extiende la imagen ya filtrada por la anterior: en ellos vale sobre todo la media
+static void check_engines(struct blur_context* ctx, int channels, size_t kernel_size, enum edge_mode edge, enum simd_level simd){
+
+    static const enum blur_engine engines[] = { ENGINE_SEPARABLE, ENGINE_BOX, ENGINE_IIR, ENGINE_FFT, ENGINE_FIXED };
+    static const int max_tolerance[] = { 1, 64, 96, 1, 2 };
+    static const double mean_tolerance[] = { 0.5, 2.0, 4.0, 0.5, 1.0 };
+
+    char what[128];
+    size_t bytes = (size_t)CHECK_WIDTH * CHECK_HEIGHT * channels;
+    unsigned char* pixels = synthetic_image(CHECK_WIDTH, CHECK_HEIGHT, channels);
+    unsigned char* reference = (unsigned char*)malloc(bytes);
+    unsigned char* output = (unsigned char*)malloc(bytes);
+
+    struct blur_params params = { kernel_size, kernel_size / 6.0, ENGINE_DIRECT, simd, 0, 0, edge, 128.0f, 0, NULL };
+    struct blur_frame in = { pixels, CHECK_WIDTH, CHECK_HEIGHT, channels };
+    struct blur_frame ref = { reference, 0, 0, 0 };
+    struct blur_frame out = { output, 0, 0, 0 };
+
+    int ok = pixels && reference && output && blur_image(ctx, &in, &ref, &params);
+
+    for(size_t e = 0; e < sizeof(engines)/sizeof(engines[0]); ++e) {
+
+        params.engine = engines[e];
+        int blurred = ok && blur_image(ctx, &in, &out, &params);
+        double mean = -1.0;
+        int difference = blurred ? compare_images(reference, output, bytes, &mean) : -1;
+
+        snprintf(what, sizeof(what), "%-9s contra direct: %d canales, kernel %zu, %s, %s: dif. %d, media %.2f",
+                 blur_engine_names[engines[e]], channels, kernel_size, blur_edge_names[edge], blur_simd_names[simd], difference, mean);
+        check(blurred && difference <= max_tolerance[e] && mean <= mean_tolerance[e], what);
+    }
+
+    free(pixels);
+    free(reference);
+    free(output);
+}
+
+
+int main(void) {
+
+    for(int channels = 1; channels <= 3; channels += 2) {
+        check_restart_roundtrip(channels, 90, 7);
+        check_restart_roundtrip(channels, 75, 7);
+    }
+
+    struct blur_params defaults = { 9, DEFAULT_SIGMA, ENGINE_DIRECT, blur_detect_simd_level(), 0, 0, EDGE_CLAMP, 0.0f, 0, NULL };
+    struct blur_context* ctx = blur_context_create(4, &defaults);
+
+    if(ctx == NULL) {
+        perror("Error creando los hilos!\n");
+        return EXIT_FAILURE;
+    }
+
+    enum simd_level simd = blur_detect_simd_level();
+
+    for(int channels = 1; channels <= 4; ++channels)
+        check_engines(ctx, channels, 9, EDGE_CLAMP, simd);
+
+    check_engines(ctx, 3, 31, EDGE_CLAMP, simd);
+
+    for(int edge = EDGE_MIRROR; edge <= EDGE_CONSTANT; ++edge)
+        check_engines(ctx, 3, 15, (enum edge_mode)edge, simd);
+
+    //Los mismos motores con los kernels escalares, que no pasan por las versiones vectorizadas
+    if(simd != SIMD_SCALAR)
+        check_engines(ctx, 3, 9, EDGE_CLAMP, SIMD_SCALAR);
+
+    blur_context_destroy(ctx);
+
+    printf("\n%d comprobaciones fallidas\n", failures);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,315 @@
+//Cliente de los modos --serve y --shm de blur_effect: envía pedidos por el socket Unix, o cuadros por la memoria
+//compartida, y mide la latencia de cada uno
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+//Solo el modo --shm decodifica y codifica: el cuadro viaja ya decodificado
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_library/stb_image.h"
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_library/stb_image_write.h"
+
+#include "blur_shm.h"
+
+
+//Reloj de pared en segundos
+static double wall_time(void)
+{
+    struct timeval t;
+    gettimeofday(&t, NULL);
+    return t.tv_sec + t.tv_usec / 1e6;
+}
+
+
+//Envía size bytes completos por el socket. Devuelve 0 si la conexión se cerró
+static int send_all(int fd, const void* data, size_t size){
+
+    const char* p = (const char*)data;
+
+    while(size > 0) {
+        ssize_t sent = write(fd, p, size);
+        if(sent <= 0)
+            return 0;
+        p += sent;
+        size -= sent;
+    }
+
+    return 1;
+}
+
+
+//Lee el archivo completo en memoria para enviarlo en línea. Devuelve NULL si no se pudo leer
+static unsigned char* read_file(const char* path, size_t* size){
+
+    FILE* f = fopen(path, "rb");
+    unsigned char* data = NULL;
+    long length;
+
+    if(!f)
+        return NULL;
+
+    if(fseek(f, 0, SEEK_END) == 0 && (length = ftell(f)) > 0 && fseek(f, 0, SEEK_SET) == 0) {
+        data = (unsigned char*)malloc(length);
+        if(data && fread(data, 1, length, f) != (size_t)length) {
+            free(data);
+            data = NULL;
+        }
+        *size = length;
+    }
+
+    fclose(f);
+    return data;
+}
+
+
+//Modo --shm: decodifica la imagen una vez, la envía --repeat veces por el anillo y escribe la última salida
+static int shm_client(int argc, char* argv[]){
+
+    struct blur_shm shm;
+
+    if(!blur_shm_open(&shm, argv[1])) {
+        fprintf(stderr, "No hay un servidor --shm en %s\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    if(strcmp(argv[2], "--shutdown") == 0) {
+        blur_shm_shutdown(&shm);
+        blur_shm_close(&shm);
+        return EXIT_SUCCESS;
+    }
+
+    double sigma = 0.0;
+    const char* engine = NULL;
+    int repeat = 1;
+
+    for(int i = 5; i < argc; ++i) {
+
+        if(strncmp(argv[i], "--sigma=", 8) == 0)
+            sigma = atof(argv[i] + 8);
+        else if(strncmp(argv[i], "--engine=", 9) == 0)
+            engine = argv[i] + 9;
+        else if(strncmp(argv[i], "--repeat=", 9) == 0)
+            repeat = atoi(argv[i] + 9);
+        else {
+            fprintf(stderr, "Opcion desconocida: %s\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if(repeat < 1)
+        repeat = 1;
+
+    int width, height, channels;
+    unsigned char* pixels = stbi_load(argv[2], &width, &height, &channels, 0);
+
+    if(!pixels) {
+        perror("Error cargando la imagen!\n");
+        return EXIT_FAILURE;
+    }
+
+    size_t frame_size = (size_t)width * height * channels;
+
+    if(frame_size > shm.slot_bytes) {
+        fprintf(stderr, "La imagen ocupa %zu bytes y las ranuras %llu\n", frame_size, (unsigned long long)shm.slot_bytes);
+        return EXIT_FAILURE;
+    }
+
+    unsigned char* blurred = (unsigned char*)malloc(frame_size);
+    double min_latency = 0.0, max_latency = 0.0, sum_latency = 0.0;
+    int answered = 0;
+    int status = EXIT_SUCCESS;
+
+    for(int r = 0; r < repeat; ++r) {
+
+        uint32_t slot;
+        double blur_seconds;
+
+        if(!blur_shm_acquire(&shm, &slot)) {
+            fprintf(stderr, "El servidor se detuvo\n");
+            status = EXIT_FAILURE;
+            break;
+        }
+
+        //El cuadro se escribe una vez en la ranura; en un llamador real ya estaría ahí
+        memcpy(blur_shm_input(&shm, slot), pixels, frame_size);
+
+        double start = wall_time();
+        blur_shm_submit(&shm, slot, width, height, channels, atoi(argv[4]), sigma, engine);
+        int done = blur_shm_wait(&shm, slot, &blur_seconds);
+        double latency = wall_time() - start;
+
+        if(done)
+            memcpy(blurred, blur_shm_output(&shm, slot), frame_size);
+
+        blur_shm_release(&shm, slot);
+
+        if(!done) {
+            fprintf(stderr, "Cuadro %d: el servidor no pudo difuminarlo\n", r + 1);
+            status = EXIT_FAILURE;
+            continue;
+        }
+
+        printf("Cuadro %d: latencia %f s (convolucion %f s)\n", r + 1, latency, blur_seconds);
+
+        if(answered == 0 || latency < min_latency)
+            min_latency = latency;
+        if(latency > max_latency)
+            max_latency = latency;
+        sum_latency += latency;
+        ++answered;
+    }
+
+    if(answered > 1)
+        printf("\nLatencia de %d cuadros: minima %f s, media %f s, maxima %f s\n", answered, min_latency, sum_latency / answered, max_latency);
+
+    const char* extension = strrchr(argv[3], '.');
+
+    if(answered && !(extension && strcmp(extension, ".png") == 0 ?
+                     stbi_write_png(argv[3], width, height, channels, blurred, width * channels) :
+                     stbi_write_jpg(argv[3], width, height, channels, blurred, 100))) {
+        perror("Error escribiendo la imagen!\n");
+        status = EXIT_FAILURE;
+    }
+
+    stbi_image_free(pixels);
+    free(blurred);
+    blur_shm_close(&shm);
+
+    return status;
+}
+
+
+int main(int argc, char* argv[]) {
+
+    if(argc >= 4 && strcmp(argv[1], "--shm") == 0 && (argc >= 6 || strcmp(argv[3], "--shutdown") == 0))
+        return shm_client(argc - 1, argv + 1);
+
+    if(argc < 3 || (argc < 5 && strcmp(argv[2], "--shutdown") != 0)) {
+        fprintf(stderr, "Uso: %s <socket> <imagen> <imagen_salida> <tamaño_kernel> [--sigma=<valor>] [--engine=<motor>]\n"
+                        "                  [--threads=<n>] [--inline] [--repeat=<n>]\n"
+                        "     %s <socket> --shutdown\n"
+                        "     %s --shm <nombre> <imagen> <imagen_salida> <tamaño_kernel> [--sigma=<valor>] [--engine=<motor>]\n"
+                        "                  [--repeat=<n>]\n"
+                        "     %s --shm <nombre> --shutdown\n", argv[0], argv[0], argv[0], argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+
+    if(strlen(argv[1]) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Ruta de socket demasiado larga: %s\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    strcpy(addr.sun_path, argv[1]);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if(fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        perror("Error conectando con el servidor!\n");
+        return EXIT_FAILURE;
+    }
+
+    FILE* in = fdopen(fd, "r");
+    char line[512];
+
+    if(strcmp(argv[2], "--shutdown") == 0) {
+
+        const char request[] = "shutdown=1\n\n";
+        int ok = send_all(fd, request, sizeof(request) - 1) && fgets(line, sizeof(line), in) && strncmp(line, "OK", 2) == 0;
+        fclose(in);
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    //Campos opcionales del pedido
+    char options[1024] = "";
+    int send_inline = 0;
+    int repeat = 1;
+
+    for(int i = 5; i < argc; ++i) {
+
+        size_t used = strlen(options);
+
+        if(strncmp(argv[i], "--sigma=", 8) == 0)
+            snprintf(options + used, sizeof(options) - used, "sigma=%s\n", argv[i] + 8);
+        else if(strncmp(argv[i], "--engine=", 9) == 0)
+            snprintf(options + used, sizeof(options) - used, "engine=%s\n", argv[i] + 9);
+        else if(strncmp(argv[i], "--threads=", 10) == 0)
+            snprintf(options + used, sizeof(options) - used, "threads=%s\n", argv[i] + 10);
+        else if(strcmp(argv[i], "--inline") == 0)
+            send_inline = 1;
+        else if(strncmp(argv[i], "--repeat=", 9) == 0)
+            repeat = atoi(argv[i] + 9);
+        else {
+            fprintf(stderr, "Opcion desconocida: %s\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if(repeat < 1)
+        repeat = 1;
+
+    //Con --inline se envían los bytes de la imagen en lugar de su ruta
+    unsigned char* data = NULL;
+    size_t size = 0;
+
+    if(send_inline && !(data = read_file(argv[2], &size))) {
+        perror("Error leyendo la imagen!\n");
+        return EXIT_FAILURE;
+    }
+
+    double min_latency = 0.0, max_latency = 0.0, sum_latency = 0.0;
+    int answered = 0;
+    int status = EXIT_SUCCESS;
+
+    for(int r = 0; r < repeat; ++r) {
+
+        char header[8192];
+
+        if(send_inline)
+            snprintf(header, sizeof(header), "size=%zu\noutput=%s\nkernel=%s\n%s\n", size, argv[3], argv[4], options);
+        else
+            snprintf(header, sizeof(header), "input=%s\noutput=%s\nkernel=%s\n%s\n", argv[2], argv[3], argv[4], options);
+
+        double start = wall_time();
+
+        if(!send_all(fd, header, strlen(header)) || (send_inline && !send_all(fd, data, size)) || !fgets(line, sizeof(line), in)) {
+            fprintf(stderr, "El servidor cerro la conexion\n");
+            status = EXIT_FAILURE;
+            break;
+        }
+
+        double latency = wall_time() - start;
+        double blur_seconds, server_seconds;
+
+        if(sscanf(line, "OK %lf %lf", &blur_seconds, &server_seconds) != 2) {
+            fprintf(stderr, "Pedido %d: %s", r + 1, line);
+            status = EXIT_FAILURE;
+            continue;
+        }
+
+        printf("Pedido %d: latencia %f s (servidor %f s, convolucion %f s)\n", r + 1, latency, server_seconds, blur_seconds);
+
+        if(answered == 0 || latency < min_latency)
+            min_latency = latency;
+        if(latency > max_latency)
+            max_latency = latency;
+        sum_latency += latency;
+        ++answered;
+    }
+
+    if(answered > 1)
+        printf("\nLatencia de %d pedidos: minima %f s, media %f s, maxima %f s\n", answered, min_latency, sum_latency / answered, max_latency);
+
+    free(data);
+    fclose(in);
+
+    return status;
+}
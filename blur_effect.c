@@ -1,10 +1,24 @@
 //Librerias estándar de C
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
-#include <math.h>
+#include <limits.h>
 #include <pthread.h>
 #include <sys/time.h>
 #include <string.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <malloc.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <signal.h>
+#include <errno.h>
+#include <stdint.h>
+#include <dirent.h>
+#include <math.h>
 
 //Librerias de terceros usadas para manipulación de imágenes png, jpg, etc.
 #define STB_IMAGE_IMPLEMENTATION
@@ -12,271 +26,2208 @@
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_library/stb_image_write.h"
 
-//Struct de parámetros pasados a los hilos para ejecutar la convolución 
-struct convolution_args {
-
-    size_t sourcePixel;
-    size_t endPixel;
-    double** kernel;
-    unsigned char* img;
-    unsigned char* blurred_img;
-    size_t channels;
-    size_t blur_channels;
-    size_t kernel_size;
-    size_t width;
-    size_t height;
-    int thread_id;
-    int n_threads;
+//Filtro, pool de hilos y perfil del equipo
+#include "libblur_internal.h"
+
+//Anillo de ranuras en memoria compartida del modo --shm
+#include "blur_shm.h"
+
+//Imagen que recorre las etapas de decodificación, filtro y codificación
+struct batch_image {
+    const char* input;
+    const char* output;
+    unsigned char* pixels;      //Entrelazada: la decodificada y, tras el filtro, la difuminada; NULL si no se pudo cargar
+    int width;
+    int height;
+    int channels;
+    size_t reserved;            //Bytes apartados en el límite de memoria del lote
+    double seconds;             //Tiempo de la convolución
+    uint64_t content_hash;      //Hash de los bytes de la entrada y clave en la caché de resultados, si keyed
+    uint64_t cache_key;
+    int keyed;
+    int cached;                 //La salida se copió de la caché de resultados, sin decodificar
+    int borrowed;               //Los pixeles decodificados son de la caché de imágenes decodificadas: no se liberan
 };
 
 
-//Función que realiza la convolución dados los parametros del rango de pixeles
-void executeConvolution(struct convolution_args args){
+//Tareas del codificador y el decodificador jpg que reparten los hilos del pool: cada hilo toma la siguiente libre
+struct parallel_job {
+    int count;
+    void (*task)(void* task_arg, int index);
+    void* task_arg;
+    _Atomic int next;
+};
 
-    //Construcción de tamaño de imágen que se quiere producir
-    size_t img_size = args.width * args.height;
-    size_t blur_channels = args.blur_channels;
-    size_t blurred_image_size = img_size * blur_channels;
 
-    unsigned char* blurred_img = args.blurred_img;
-    unsigned char* img = args.img;
+static void parallel_job(void* arg, int thread_id, int n_threads){
 
-    //Rango de pixeles entre los que se va a trabajar
-    size_t sourcePixel = args.sourcePixel;
-    size_t endPixel = args.endPixel;
+    (void)thread_id;
+    (void)n_threads;
+    struct parallel_job* job = (struct parallel_job*)arg;
+    int index;
 
-    unsigned char* p = img + (sourcePixel*args.channels);
-    unsigned char* b_p = blurred_img + (sourcePixel*blur_channels);
+    while((index = atomic_fetch_add(&job->next, 1)) < job->count)
+        job->task(job->task_arg, index);
+}
 
-    size_t channels = args.channels;
 
-    double valueRed;
-    double valueGreen;
-    double valueBlue;
+//Ejecuta task(task_arg, i) para i en [0, count) con los hilos del pool; es el stbi_parallel_func y el
+//stbi_write_parallel_func del pool
+static void pool_parallel_for(void* context, int count, void (*task)(void* task_arg, int index), void* task_arg){
 
-    int current_pixel = sourcePixel;
-    int target_pixel;
-    int pixel_valueBlue;
-    int pixel_valueGreen;
-    int pixel_valueRed;
+    struct parallel_job job = { count, task, task_arg, 0 };
+    blur_pool_run((struct thread_pool*)context, parallel_job, &job);
+}
 
-    int mid_size = args.kernel_size/2;
 
-    size_t width = args.width;
-    size_t height = args.height;
+//Archivo de entrada proyectado en memoria de solo lectura
+struct mapped_file {
+    unsigned char* data;
+    size_t size;
+};
 
-    double** kernel = args.kernel;
 
-    //Loop que itera sobre el rango de pixeles dado como argumentos
-    for(; p != img+((endPixel+1)*channels); p += channels, b_p += blur_channels, ++current_pixel) {
-        
-        valueRed = 0;
-        valueGreen = 0;
-        valueBlue = 0;
+//Proyecta el archivo en memoria y avisa al kernel de que se leerá de corrido, para que lea por adelantado en
+//bloques grandes. Devuelve 0 si no se pudo (archivo vacío, que no es regular o mayor de lo que acepta stb)
+static int map_file(const char* path, struct mapped_file* file){
 
-            //Recorrido por cada uno de los valores de la matriz del kernel
-            for(int i = -mid_size; i <= mid_size; ++i){
-                for(int j = -mid_size; j <= mid_size; ++j){
-                    //Calculo de pixel de imágen original sobre el que queremos aplicar convolución
-                    target_pixel = current_pixel + (i*width) + j;
+    struct stat st;
+    int fd = open(path, O_RDONLY);
 
-                    //Extracción de cada uno de los tres canales del pixel identificado
-                    pixel_valueRed = target_pixel < 0 || target_pixel > width*height-1 ? 1 : *(img+(target_pixel*channels)+0);
-                    pixel_valueGreen = target_pixel < 0 || target_pixel > width*height-1 ? 1 : *(img+(target_pixel*channels)+1);
-                    pixel_valueBlue = target_pixel < 0 || target_pixel > width*height-1 ? 1 : *(img+(target_pixel*channels)+2);
+    file->data = NULL;
+    file->size = 0;
 
-                    //Suma de valores multiplicados
-                    valueRed += kernel[i+mid_size][j+mid_size] * pixel_valueRed;
-                    valueGreen += kernel[i+mid_size][j+mid_size] * pixel_valueGreen;
-                    valueBlue += kernel[i+mid_size][j+mid_size] * pixel_valueBlue;
-                }
-            } 
+    if(fd < 0)
+        return 0;
 
-        //Asignación de canales modificados a la imágen con filtro
-        *b_p =  (uint8_t)(valueRed);
-        *(b_p + 1)=  (uint8_t)(valueGreen);
-        *(b_p + 2)=  (uint8_t)(valueBlue);  
+    if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 && st.st_size <= INT_MAX) {
+        void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(data != MAP_FAILED) {
+            madvise(data, st.st_size, MADV_SEQUENTIAL);
+            file->data = (unsigned char*)data;
+            file->size = st.st_size;
+        }
     }
+
+    //La proyección sigue siendo válida sin el descriptor
+    close(fd);
+    return file->data != NULL;
 }
-  
 
-//Función para generar el kernel gaussiano
-void generate_kernel(int size, double** kernel) 
-{   
-    //Desviación estándar 
-    double sigma = 15.0; 
-    
-    //Suma para normalizar el kernel después 
-    double sum = 0.0; 
-    
-    int mid = size/2;
 
-    //Generar kernel de tamaño size x size usando funcion de densidad de probabilidad de Gauss
-    for (int x = -mid; x <= mid; x++) { 
-        for (int y = -mid; y <= mid; y++) { 
-            kernel[x + mid][y + mid] = exp(-(x * x + y * y) / (2 * sigma * sigma)) / (2 * M_PI * sigma * sigma); 
-            sum += kernel[x + mid][y + mid]; 
-        } 
-    } 
-  
-    //Normalización del kernel para un efecto mas limpio en el blurring
-    for (int i = 0; i < size; ++i) 
-        for (int j = 0; j < size; ++j) 
-            kernel[i][j] /= sum; 
-} 
+static void unmap_file(struct mapped_file* file){
+
+    munmap(file->data, file->size);
+    file->data = NULL;
+}
+
+
+//Pide al kernel que empiece a leer el archivo en segundo plano, para que ya esté en la caché de páginas cuando se
+//decodifique. En el lote se llama con la imagen siguiente mientras se difumina la actual
+static void prefetch_file(const char* path){
+
+    int fd = open(path, O_RDONLY);
 
+    if(fd < 0)
+        return;
 
-//Función que asigna trabajo a cada uno de los hilos
-void *assignWork(void *args) 
-{ 
-    struct convolution_args * my_args = (struct convolution_args *)args;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    close(fd);
+}
+
+
+//Hash de 64 bits del contenido de las imágenes: XXH64, que procesa cuatro acumuladores de 8 bytes por vuelta y
+//hashea varios GB/s, mucho más rápido que leer o decodificar el archivo
+#define HASH_PRIME_1 0x9E3779B185EBCA87ULL
+#define HASH_PRIME_2 0xC2B2AE3D27D4EB4FULL
+#define HASH_PRIME_3 0x165667B19E3779F9ULL
+#define HASH_PRIME_4 0x85EBCA77C2B2AE63ULL
+#define HASH_PRIME_5 0x27D4EB2F165667C5ULL
+
+static inline uint64_t rotl64(uint64_t x, int r){
 
-    size_t img_size = my_args->width * my_args->height;
+    return (x << r) | (x >> (64 - r));
+}
 
-    //Repartición de trabajo según blockwise
-    size_t load_work = img_size/(my_args->n_threads);
 
-    //Calculamos rango de pixeles a trabajar segun el id del pixel
-    my_args->sourcePixel = my_args->thread_id * load_work;
-    my_args->endPixel = (my_args->thread_id+1)* load_work - 1;
+static inline uint64_t hash_round(uint64_t acc, const unsigned char* p){
 
-    printf("\nThread number %d executing from pixel %ld to %ld\n", my_args->thread_id, my_args->sourcePixel, my_args->endPixel);
-    executeConvolution(*my_args);
+    uint64_t input;
+    memcpy(&input, p, sizeof(input));
 
-    return NULL; 
+    acc += input * HASH_PRIME_2;
+    return rotl64(acc, 31) * HASH_PRIME_1;
 }
 
 
-int main(int argc, char* argv[]) {
+static inline uint64_t hash_merge(uint64_t h, uint64_t acc){
 
-    int width, height, channels;
+    h ^= rotl64(acc * HASH_PRIME_2, 31) * HASH_PRIME_1;
+    return h * HASH_PRIME_1 + HASH_PRIME_4;
+}
 
-    //Verificación de cantidad de argumentos correcta
-    if(argc != 5) {
-        perror("Cantidad de argumentos no es valida!");
-        return EXIT_FAILURE;
+
+uint64_t hash64(const void* data, size_t size, uint64_t seed){
+
+    const unsigned char* p = (const unsigned char*)data;
+    const unsigned char* end = p + size;
+    uint64_t h;
+
+    if(size >= 32) {
+
+        uint64_t v1 = seed + HASH_PRIME_1 + HASH_PRIME_2;
+        uint64_t v2 = seed + HASH_PRIME_2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - HASH_PRIME_1;
+
+        for(; p + 32 <= end; p += 32) {
+            v1 = hash_round(v1, p);
+            v2 = hash_round(v2, p + 8);
+            v3 = hash_round(v3, p + 16);
+            v4 = hash_round(v4, p + 24);
+        }
+
+        h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        h = hash_merge(h, v1);
+        h = hash_merge(h, v2);
+        h = hash_merge(h, v3);
+        h = hash_merge(h, v4);
     }
+    else
+        h = seed + HASH_PRIME_5;
 
-    //Cargamos la imagen obteniendo sus datos
-    unsigned char* img = stbi_load(argv[1], &width, &height, &channels, 0);
+    h += size;
 
-    //Verificación de imágen válida
-    if(img == NULL) {
-        perror("Error cargando la imagen!\n");
-        return EXIT_FAILURE;
+    for(; p + 8 <= end; p += 8) {
+        h ^= hash_round(0, p);
+        h = rotl64(h, 27) * HASH_PRIME_1 + HASH_PRIME_4;
+    }
+
+    if(p + 4 <= end) {
+        uint32_t input;
+        memcpy(&input, p, sizeof(input));
+        h ^= input * HASH_PRIME_1;
+        h = rotl64(h, 23) * HASH_PRIME_2 + HASH_PRIME_3;
+        p += 4;
     }
 
-    printf("\nancho: %dpx, alto: %dpx, canales: %d\n", width, height, channels);
+    for(; p < end; ++p) {
+        h ^= *p * HASH_PRIME_5;
+        h = rotl64(h, 11) * HASH_PRIME_1;
+    }
 
-    int kernel_size;
+    h ^= h >> 33;
+    h *= HASH_PRIME_2;
+    h ^= h >> 29;
+    h *= HASH_PRIME_3;
+    h ^= h >> 32;
 
-    //Extracción de tamaño del kernel 
-    kernel_size = atoi(argv[3]);
+    return h;
+}
 
-    //Tamaño de kernel debe ser impar
-    if(kernel_size % 2 == 0){
 
-        perror("Tamaño de kernel debe ser impar!\n");
-        return EXIT_FAILURE;
+//Salida png si output termina en ".png"; jpg en otro caso, igual que encode_image
+static int output_is_png(const char* output){
+
+    const char* extension = strrchr(output, '.');
+    return extension && strcmp(extension, ".png") == 0;
+}
+
+
+//Clave de la caché de resultados: el hash de los bytes de la imagen de entrada combinado con los parámetros que
+//cambian la salida y su formato
+uint64_t result_key(uint64_t content_hash, const struct blur_params* params, const char* output){
+
+    struct {
+        uint64_t kernel_size;
+        double sigma;
+        int32_t engine;
+        int32_t edge;
+        float edge_value;
+        int32_t png;
+    } key;
+
+    memset(&key, 0, sizeof(key));
+    key.kernel_size = params->kernel_size;
+    key.sigma = params->sigma;
+    key.engine = params->engine;
+    key.edge = params->edge;
+    key.edge_value = params->edge_value;
+    key.png = output_is_png(output);
+
+    return hash64(&key, sizeof(key), content_hash);
+}
+
+
+//Caché en disco de imágenes ya difuminadas: cada salida se guarda en <dir>/<clave>.jpg o .png. El índice se lee del
+//directorio al abrirla; el uso de cada entrada se guarda en la fecha de modificación del archivo, así que el orden
+//LRU se conserva entre ejecuciones. Al pasar de limit bytes se borran las usadas hace más tiempo
+struct cache_entry {
+    uint64_t key;
+    int png;
+    size_t size;
+    double last_use;
+    int pins;                   //Copias en curso fuera del lock; mientras no sea 0 no se descarta
+};
+
+struct result_cache {
+    char dir[4096];
+    size_t limit;
+    size_t used;
+    struct cache_entry* entries;
+    size_t n_entries;
+    size_t capacity;
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+    pthread_mutex_t lock;       //En el modo --pipeline la consultan el decodificador y el codificador a la vez
+};
+
+
+static void cache_entry_path(const struct result_cache* c, const struct cache_entry* e, char* path, size_t size){
+
+    snprintf(path, size, "%s/%016llx%s", c->dir, (unsigned long long)e->key, e->png ? ".png" : ".jpg");
+}
+
+
+static void cache_add_entry(struct result_cache* c, uint64_t key, int png, size_t size, double last_use){
+
+    if(c->n_entries == c->capacity) {
+        c->capacity = c->capacity ? 2*c->capacity : 64;
+        c->entries = (struct cache_entry*)realloc(c->entries, sizeof(struct cache_entry) * c->capacity);
     }
 
-    size_t mid_size = kernel_size / 2 ;
+    struct cache_entry* e = &c->entries[c->n_entries++];
+    e->key = key;
+    e->png = png;
+    e->size = size;
+    e->last_use = last_use;
+    e->pins = 0;
+    c->used += size;
+}
 
-    //Asignación dinámica de espacio para generar una matriz 
-    double** kernel = (double**)malloc(sizeof(double*) * kernel_size);
-    for(size_t i = 0; i < kernel_size; ++i) 
-        kernel[i] = (double*)malloc(sizeof(double)*kernel_size);
-    
-    generate_kernel(kernel_size, kernel);
 
-    printf("\nKernel gaussiano usado para el filtro: \n\n");
-    for(size_t i = 0; i < kernel_size; ++i) {
+static void cache_remove_entry(struct result_cache* c, struct cache_entry* e){
 
-        for(size_t j = 0; j < kernel_size; ++j) 
-            printf("%f ", kernel[i][j]);
-        
-        printf("\n");
+    c->used -= e->size;
+    *e = c->entries[--c->n_entries];
+}
+
+
+static struct cache_entry* cache_find(struct result_cache* c, uint64_t key){
+
+    for(size_t i = 0; i < c->n_entries; ++i)
+        if(c->entries[i].key == key)
+            return &c->entries[i];
+
+    return NULL;
+}
+
+
+//Borra las entradas usadas hace más tiempo hasta que la caché quepa en su límite; las que se están copiando
+//quedan aunque lo pasen
+static void cache_evict(struct result_cache* c){
+
+    while(c->used > c->limit) {
+
+        struct cache_entry* oldest = NULL;
+        for(size_t i = 0; i < c->n_entries; ++i)
+            if(c->entries[i].pins == 0 && (oldest == NULL || c->entries[i].last_use < oldest->last_use))
+                oldest = &c->entries[i];
+
+        if(oldest == NULL)
+            break;
+
+        char path[4096 + 32];
+        cache_entry_path(c, oldest, path, sizeof(path));
+        unlink(path);
+
+        cache_remove_entry(c, oldest);
+        c->evictions++;
     }
+}
 
-    size_t blurred_image_size = width * height * 3;
 
-    //Asignación de espacio para imágen con filtro aplicado
-    unsigned char* blurred_img = (unsigned char*)malloc(sizeof(unsigned char) * blurred_image_size);
+//Abre la caché del directorio dir, creándolo si no existe, con un límite de limit bytes. Devuelve 0 si no se pudo
+int result_cache_open(struct result_cache* c, const char* dir, size_t limit){
+
+    memset(c, 0, sizeof(*c));
+    snprintf(c->dir, sizeof(c->dir), "%s", dir);
+    c->limit = limit;
 
-    int n_threads = atoi(argv[4]);
+    mkdir(dir, 0755);
+    DIR* d = opendir(dir);
 
-    struct convolution_args args[n_threads];
+    if(d == NULL)
+        return 0;
 
-    pthread_t tid[n_threads];
+    struct dirent* ent;
 
-    struct timeval start, end;
+    while((ent = readdir(d)) != NULL) {
 
-    //Calculo de tiempo antes de iniciar operaciones de convolución
-	gettimeofday(&start, NULL);
+        unsigned long long key;
+        char extension[8];
+        struct stat st;
+        char path[4096 + 256];
 
-    for (int i = 0; i < n_threads; i++) {
+        if(strlen(ent->d_name) != 20 || sscanf(ent->d_name, "%16llx%7s", &key, extension) != 2 ||
+           (strcmp(extension, ".png") != 0 && strcmp(extension, ".jpg") != 0))
+            continue;
 
-        args[i].img = img;
-        args[i].blurred_img = blurred_img;
-        args[i].width = width;
-        args[i].height = height;
-        args[i].channels = channels;
-        args[i].blur_channels = 3;
-        args[i].kernel = kernel;
-        args[i].kernel_size = kernel_size;
-        args[i].n_threads = n_threads;
-        args[i].thread_id = i;
+        snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
 
-        //Lanzamiento de cada uno de los threads
-        pthread_create(&tid[i], NULL, assignWork, (void *)&args[i]);
-    } 
+        if(stat(path, &st) == 0 && S_ISREG(st.st_mode))
+            cache_add_entry(c, key, strcmp(extension, ".png") == 0, st.st_size, st.st_mtim.tv_sec + st.st_mtim.tv_nsec / 1e9);
+    }
 
-    for (int i = 0; i < n_threads; i++) 
-        pthread_join(tid[i], NULL);
+    closedir(d);
+    pthread_mutex_init(&c->lock, NULL);
 
-    //Calculo de tiempo después de aplicar convolución a todos los pixeles de la imágen
-    gettimeofday(&end, NULL);
-    
-    //Escribimos la imágen en formato jpg con el filtro aplicado
-    stbi_write_jpg(argv[2], width, height, 3, blurred_img, 100);
+    //El límite pudo haber bajado desde la última ejecución
+    cache_evict(c);
+
+    return 1;
+}
+
+
+void result_cache_close(struct result_cache* c){
+
+    pthread_mutex_destroy(&c->lock);
+    free(c->entries);
+}
+
+
+//Copia el archivo from en to. Devuelve 0 si no se pudo
+static int copy_file(const char* from, const char* to){
+
+    struct mapped_file file;
+
+    if(!map_file(from, &file))
+        return 0;
+
+    int fd = open(to, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    int ok = fd >= 0;
+
+    for(size_t done = 0; ok && done < file.size; ) {
+        ssize_t written = write(fd, file.data + done, file.size - done);
+        ok = written > 0;
+        done += ok ? written : 0;
+    }
+
+    if(fd >= 0 && close(fd) != 0)
+        ok = 0;
+
+    unmap_file(&file);
+    return ok;
+}
+
+
+//Si la caché tiene la salida de key la copia en output, la marca como recién usada y devuelve 1. Cuenta el acierto
+//o el fallo. La entrada se fija bajo el lock y se copia sin él, para no frenar a los demás hilos con el disco
+int result_cache_fetch(struct result_cache* c, uint64_t key, const char* output){
+
+    pthread_mutex_lock(&c->lock);
+
+    struct cache_entry* e = cache_find(c, key);
+    char path[4096 + 32];
+
+    if(e) {
+        cache_entry_path(c, e, path, sizeof(path));
+        e->pins++;
+    }
+    else
+        c->misses++;
+
+    pthread_mutex_unlock(&c->lock);
+
+    if(!e)
+        return 0;
+
+    int hit = copy_file(path, output);
+
+    if(hit)
+        utimensat(AT_FDCWD, path, NULL, 0);
+
+    //El arreglo de entradas pudo haberse movido mientras tanto
+    pthread_mutex_lock(&c->lock);
+
+    e = cache_find(c, key);
+    e->pins--;
+
+    //Otro proceso pudo haberla borrado
+    if(hit)
+        e->last_use = blur_wall_time();
+    else if(e->pins == 0)
+        cache_remove_entry(c, e);
+
+    if(hit)
+        c->hits++;
+    else
+        c->misses++;
+
+    pthread_mutex_unlock(&c->lock);
+    return hit;
+}
+
+
+//Guarda en la caché el archivo output recién escrito como resultado de key
+void result_cache_store(struct result_cache* c, uint64_t key, const char* output){
+
+    struct cache_entry entry = { key, output_is_png(output), 0, 0.0 };
+    char path[4096 + 32];
+    char tmp[4096 + 64];
+    struct stat st;
+
+    cache_entry_path(c, &entry, path, sizeof(path));
+    snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int)getpid());
+
+    //Se escribe aparte y se renombra, para que otro proceso nunca lea una entrada a medias
+    if(stat(output, &st) != 0 || (size_t)st.st_size > c->limit || !copy_file(output, tmp) || rename(tmp, path) != 0) {
+        unlink(tmp);
+        return;
+    }
+
+    pthread_mutex_lock(&c->lock);
+
+    //Una entrada con la misma clave se actualiza en el lugar, sin perder las copias que la tienen fijada
+    struct cache_entry* old = cache_find(c, key);
+
+    if(old) {
+        c->used = c->used - old->size + st.st_size;
+        old->size = st.st_size;
+        old->last_use = blur_wall_time();
+    }
+    else
+        cache_add_entry(c, key, entry.png, st.st_size, blur_wall_time());
+
+    cache_evict(c);
+
+    pthread_mutex_unlock(&c->lock);
+}
+
+
+void result_cache_report(const struct result_cache* c){
+
+    printf("\nCache de resultados: %zu aciertos, %zu fallos, %zu descartadas; %zu entradas, %.1f MB de %.1f MB\n",
+           c->hits, c->misses, c->evictions, c->n_entries, c->used / 1e6, c->limit / 1e6);
+}
 
-    //Liberación de espacio usado por el kernel
-    for(size_t i = 0; i < kernel_size; ++i) 
-        free(kernel[i]);
-    
-    free(kernel);
+
+//Decodifica la imagen codificada en data. Con pool, los jpg con marcadores de reinicio se decodifican en paralelo
+//por intervalos; el resto igual que sin él. Devuelve 0 si no se pudo cargar
+int decode_image_memory(struct batch_image* image, const unsigned char* data, size_t size, struct thread_pool* pool)
+{
+    int parallel = pool && blur_pool_active(pool) > 1;
+
+    if(size > INT_MAX) {
+        image->pixels = NULL;
+        return 0;
+    }
+
+    image->pixels = stbi_load_from_memory_parallel(data, (int)size, &image->width, &image->height, &image->channels, 0,
+                                                   parallel ? pool_parallel_for : NULL, pool);
+
+    return image->pixels != NULL;
+}
+
+
+//Como decode_image_memory, pero con cache antes busca el resultado por el hash de data: si está, lo copia en
+//image->output sin decodificar y deja image->cached en 1. Si no, deja la clave para guardar la salida al escribirla
+int load_image_memory(struct batch_image* image, const unsigned char* data, size_t size, struct result_cache* cache,
+                      const struct blur_params* params, struct thread_pool* pool)
+{
+    if(cache) {
+        image->content_hash = hash64(data, size, 0);
+        image->cache_key = result_key(image->content_hash, params, image->output);
+        image->keyed = 1;
+
+        if(result_cache_fetch(cache, image->cache_key, image->output)) {
+            image->cached = 1;
+            return 1;
+        }
+    }
+
+    return decode_image_memory(image, data, size, pool);
+}
+
+
+//Decodifica image->input directamente desde su proyección en memoria, sin copias intermedias, o con cache copia el
+//resultado ya guardado (ver load_image_memory). Si el archivo no se puede proyectar se lee con stbi_load, sin pasar
+//por la caché. Devuelve 0 si no se pudo cargar
+int decode_image(struct batch_image* image, struct result_cache* cache, const struct blur_params* params, struct thread_pool* pool)
+{
+    struct mapped_file file;
+
+    if(map_file(image->input, &file)) {
+        int decoded = load_image_memory(image, file.data, file.size, cache, params, pool);
+        unmap_file(&file);
+        return decoded;
+    }
+
+    image->pixels = stbi_load(image->input, &image->width, &image->height, &image->channels, 0);
+
+    return image->pixels != NULL;
+}
+
+
+//Escribe image->pixels en image->output y libera los pixeles. El jpg no guarda el alfa; para conservarlo la
+//salida debe ser png. Con pool, el jpg se codifica en paralelo por bandas de filas separadas por marcadores de
+//reinicio, unas cuatro por hilo
+int encode_image(struct batch_image* image, struct thread_pool* pool) 
+{
+    const char* extension = strrchr(image->output, '.');
+    int written;
+
+    if(extension && strcmp(extension, ".png") == 0)
+        written = stbi_write_png(image->output, image->width, image->height, image->channels, image->pixels, image->width * image->channels);
+    else if(pool && blur_pool_active(pool) > 1)
+        written = stbi_write_jpg_parallel(image->output, image->width, image->height, image->channels, image->pixels, 100,
+                                          4 * blur_pool_active(pool), pool_parallel_for, pool);
+    else
+        written = stbi_write_jpg(image->output, image->width, image->height, image->channels, image->pixels, 100);
+
+    free(image->pixels);
+    image->pixels = NULL;
+
+    return written != 0;
+}
+
+
+//Difumina image->pixels con el contexto y los reemplaza por la imagen difuminada, dejando en image->seconds el
+//tiempo de la convolución; los decodificados se liberan salvo que sean prestados. Si falla devuelve 0 y deja los
+//pixeles decodificados
+int blur_batch_image(struct blur_context* ctx, struct batch_image* image, const struct blur_params* params)
+{
+    printf("\n%s: ancho: %dpx, alto: %dpx, canales: %d\n", image->input, image->width, image->height, image->channels);
+
+    struct blur_frame in = { image->pixels, image->width, image->height, image->channels };
+    struct blur_frame out = { NULL, 0, 0, 0 };
+
+    //Asignación de espacio para imágen con filtro aplicado
+    out.pixels = (unsigned char*)malloc((size_t)image->width * image->height * image->channels);
+
+    if(out.pixels == NULL || !blur_image(ctx, &in, &out, params)) {
+        free(out.pixels);
+        return 0;
+    }
 
     //Liberación de espacio usado para codificación de la imágen
-    stbi_image_free(img);
+    if(!image->borrowed)
+        stbi_image_free(image->pixels);
+
+    image->pixels = out.pixels;
+    image->borrowed = 0;
+    image->seconds = blur_context_seconds(ctx);
 
-    //Liberación de espacio usado para codificación de imágen con filtro
-    free(blurred_img);
+    return 1;
+}
 
-    //Tiempo total(Elapsed Wall time)
-    long seconds = (end.tv_sec - start.tv_sec);
-    long micros = ((seconds * 1000000) + end.tv_usec) - (start.tv_usec);
 
-    double seconds_d = (double)micros / pow(10,6);  
+//Caché en memoria de imágenes decodificadas para las ejecuciones con varios pedidos (--jobs y --serve): los pedidos
+//que repiten una imagen con otro kernel, sigma o motor no la vuelven a decodificar. La identidad de cada imagen es
+//su ruta con el dispositivo, el inodo, el tamaño y la fecha de modificación, así que un archivo reescrito se vuelve
+//a decodificar. Al pasar de limit bytes se liberan las usadas hace más tiempo
+struct decoded_entry {
+    char* path;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    uint64_t content_hash;      //Hash de los bytes del archivo para la caché de resultados, si hashed
+    int hashed;
+    unsigned char* pixels;
+    int width;
+    int height;
+    int channels;
+    size_t bytes;
+    unsigned long last_use;
+};
 
-    //Devolver tiempo de ejecución del programa
-    printf("\nTiempo de ejecucion: %f segundos\n", seconds_d);
+struct decoded_cache {
+    struct decoded_entry* entries;
+    size_t n_entries;
+    size_t capacity;
+    size_t limit;
+    size_t used;
+    unsigned long clock;
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+};
 
-    FILE * fp;
-    int i;  
-    size_t file_length = strlen(argv[1]) + strlen(argv[3]) + 6;
-    char * fileName = (char *)malloc(sizeof(char)*file_length);
-    fileName[0] = '\0';
-    strcat(fileName, argv[1]);
-    strcat(fileName, "_");
-    strcat(fileName, argv[3]);
-    strcat(fileName, ".txt");
 
-    //Abrir archivo para registrar el tiempo medido
-    fp = fopen (fileName,"a");
-    
-    fprintf (fp, "%f ", seconds_d);
-   
-    fclose (fp);
-   
-    return EXIT_SUCCESS;
-}
\ No newline at end of file
+void decoded_cache_init(struct decoded_cache* c, size_t limit){
+
+    memset(c, 0, sizeof(*c));
+    c->limit = limit;
+}
+
+
+static void decoded_cache_remove(struct decoded_cache* c, struct decoded_entry* e){
+
+    c->used -= e->bytes;
+    free(e->path);
+    stbi_image_free(e->pixels);
+    *e = c->entries[--c->n_entries];
+}
+
+
+void decoded_cache_destroy(struct decoded_cache* c){
+
+    while(c->n_entries > 0)
+        decoded_cache_remove(c, &c->entries[0]);
+
+    free(c->entries);
+}
+
+
+//Libera las imágenes usadas hace más tiempo hasta que queden bytes libres en el límite
+static void decoded_cache_evict(struct decoded_cache* c, size_t bytes){
+
+    while(c->n_entries > 0 && c->used + bytes > c->limit) {
+
+        struct decoded_entry* oldest = &c->entries[0];
+        for(size_t i = 1; i < c->n_entries; ++i)
+            if(c->entries[i].last_use < oldest->last_use)
+                oldest = &c->entries[i];
+
+        decoded_cache_remove(c, oldest);
+        c->evictions++;
+    }
+}
+
+
+//Carga image->input como decode_image, pero primero la busca entre las ya decodificadas. Los pixeles de un
+//acierto, o los de un fallo que se guarda, siguen siendo de la caché: image->borrowed queda en 1 y no se liberan
+int decode_image_cached(struct decoded_cache* c, struct batch_image* image, struct result_cache* cache,
+                        const struct blur_params* params, struct thread_pool* pool)
+{
+    struct stat st;
+
+    if(stat(image->input, &st) != 0 || !S_ISREG(st.st_mode))
+        return decode_image(image, cache, params, pool);
+
+    for(size_t i = 0; i < c->n_entries; ++i) {
+
+        struct decoded_entry* e = &c->entries[i];
+
+        if(strcmp(e->path, image->input) != 0)
+            continue;
+
+        //El archivo cambió desde que se decodificó
+        if(e->dev != st.st_dev || e->ino != st.st_ino || e->size != st.st_size ||
+           e->mtime.tv_sec != st.st_mtim.tv_sec || e->mtime.tv_nsec != st.st_mtim.tv_nsec) {
+            decoded_cache_remove(c, e);
+            break;
+        }
+
+        if(cache && e->hashed) {
+            image->content_hash = e->content_hash;
+            image->cache_key = result_key(e->content_hash, params, image->output);
+            image->keyed = 1;
+
+            if(result_cache_fetch(cache, image->cache_key, image->output)) {
+                image->cached = 1;
+                return 1;
+            }
+        }
+
+        e->last_use = ++c->clock;
+        c->hits++;
+
+        image->pixels = e->pixels;
+        image->width = e->width;
+        image->height = e->height;
+        image->channels = e->channels;
+        image->borrowed = 1;
+
+        return 1;
+    }
+
+    if(!decode_image(image, cache, params, pool))
+        return 0;
+
+    if(image->cached)
+        return 1;
+
+    c->misses++;
+
+    size_t bytes = (size_t)image->width * image->height * image->channels;
+
+    //Una imagen mayor que el límite se usa y se libera sin guardarla
+    if(bytes > c->limit)
+        return 1;
+
+    decoded_cache_evict(c, bytes);
+
+    if(c->n_entries == c->capacity) {
+        c->capacity = c->capacity ? 2*c->capacity : 16;
+        c->entries = (struct decoded_entry*)realloc(c->entries, sizeof(struct decoded_entry) * c->capacity);
+    }
+
+    struct decoded_entry* e = &c->entries[c->n_entries++];
+    e->path = strdup(image->input);
+    e->dev = st.st_dev;
+    e->ino = st.st_ino;
+    e->size = st.st_size;
+    e->mtime = st.st_mtim;
+    e->content_hash = image->content_hash;
+    e->hashed = image->keyed;
+    e->pixels = image->pixels;
+    e->width = image->width;
+    e->height = image->height;
+    e->channels = image->channels;
+    e->bytes = bytes;
+    e->last_use = ++c->clock;
+    c->used += bytes;
+
+    image->borrowed = 1;
+
+    return 1;
+}
+
+
+void decoded_cache_report(const struct decoded_cache* c){
+
+    printf("\nCache de imagenes decodificadas: %zu aciertos, %zu fallos, %zu descartadas; %zu imagenes, %.1f MB de %.1f MB\n",
+           c->hits, c->misses, c->evictions, c->n_entries, c->used / 1e6, c->limit / 1e6);
+}
+
+
+//Difumina la imagen input y la escribe en output usando los hilos del pool, una etapa tras otra. Con decoded la
+//imagen se busca antes entre las ya decodificadas. Devuelve 1 si tuvo éxito y deja en seconds el tiempo de la
+//convolución, 2 si copió el resultado de la caché y 0 si falló
+int blur_file(struct blur_context* ctx, const char* input, const char* output, const struct blur_params* params,
+              struct result_cache* cache, struct decoded_cache* decoded, double* seconds)
+{
+    struct thread_pool* pool = blur_context_pool(ctx);
+    struct batch_image image;
+    memset(&image, 0, sizeof(image));
+    image.input = input;
+    image.output = output;
+
+    double decode_start = blur_wall_time();
+
+    //Cargamos la imagen obteniendo sus datos
+    if(!(decoded ? decode_image_cached(decoded, &image, cache, params, pool) : decode_image(&image, cache, params, pool))) {
+        perror("Error cargando la imagen!\n");
+        return 0;
+    }
+
+    if(image.cached) {
+        printf("\n%s: acierto en la cache de resultados, copiada en %f s\n", input, blur_wall_time() - decode_start);
+        return 2;
+    }
+
+    if(cache)
+        printf("\n%s: fallo en la cache de resultados\n", input);
+
+    printf("\nDecodificacion: %f s\n", blur_wall_time() - decode_start);
+
+    if(!blur_batch_image(ctx, &image, params)) {
+        if(!image.borrowed)
+            stbi_image_free(image.pixels);
+        return 0;
+    }
+
+    *seconds = image.seconds;
+
+    double encode_start = blur_wall_time();
+
+    if(!encode_image(&image, pool)) {
+        perror("Error escribiendo la imagen!\n");
+        return 0;
+    }
+
+    printf("\nCodificacion: %f s\n", blur_wall_time() - encode_start);
+
+    if(image.keyed)
+        result_cache_store(cache, image.cache_key, output);
+
+    return 1;
+}
+
+
+//Cola acotada de imágenes entre dos etapas del lote. Un NULL marca el fin del lote
+struct image_queue {
+    struct batch_image** items;
+    size_t capacity;
+    size_t head;
+    size_t count;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+};
+
+
+void image_queue_init(struct image_queue* q, size_t capacity){
+
+    q->items = (struct batch_image**)malloc(sizeof(struct batch_image*) * capacity);
+    q->capacity = capacity;
+    q->head = 0;
+    q->count = 0;
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->not_empty, NULL);
+    pthread_cond_init(&q->not_full, NULL);
+}
+
+
+void image_queue_destroy(struct image_queue* q){
+
+    pthread_cond_destroy(&q->not_full);
+    pthread_cond_destroy(&q->not_empty);
+    pthread_mutex_destroy(&q->lock);
+    free(q->items);
+}
+
+
+//Agrega una imagen al final; espera si la cola está llena
+void image_queue_push(struct image_queue* q, struct batch_image* image){
+
+    pthread_mutex_lock(&q->lock);
+
+    while(q->count == q->capacity)
+        pthread_cond_wait(&q->not_full, &q->lock);
+
+    q->items[(q->head + q->count) % q->capacity] = image;
+    q->count++;
+
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+}
+
+
+//Saca la primera imagen; espera si la cola está vacía
+struct batch_image* image_queue_pop(struct image_queue* q){
+
+    pthread_mutex_lock(&q->lock);
+
+    while(q->count == 0)
+        pthread_cond_wait(&q->not_empty, &q->lock);
+
+    struct batch_image* image = q->items[q->head];
+    q->head = (q->head + 1) % q->capacity;
+    q->count--;
+
+    pthread_cond_signal(&q->not_full);
+    pthread_mutex_unlock(&q->lock);
+
+    return image;
+}
+
+
+//Límite de bytes de las imágenes en vuelo. Solo espera la etapa de decodificación, que aparta de una vez lo que
+//ocupará la imagen decodificada y la difuminada; así las etapas siguientes siempre pueden avanzar y liberar.
+//Una imagen mayor que el límite pasa sola, cuando no queda ninguna otra en vuelo
+struct memory_budget {
+    size_t limit;               //0 sin límite
+    size_t used;
+    size_t peak;
+    pthread_mutex_t lock;
+    pthread_cond_t released;
+};
+
+
+void memory_budget_acquire(struct memory_budget* b, size_t bytes){
+
+    pthread_mutex_lock(&b->lock);
+
+    while(b->limit && b->used > 0 && b->used + bytes > b->limit)
+        pthread_cond_wait(&b->released, &b->lock);
+
+    b->used += bytes;
+    if(b->used > b->peak)
+        b->peak = b->used;
+
+    pthread_mutex_unlock(&b->lock);
+}
+
+
+void memory_budget_release(struct memory_budget* b, size_t bytes){
+
+    pthread_mutex_lock(&b->lock);
+    b->used -= bytes;
+    pthread_cond_broadcast(&b->released);
+    pthread_mutex_unlock(&b->lock);
+}
+
+
+//Estado compartido por las tres etapas del lote
+struct batch_pipeline {
+    struct batch_image* images;
+    size_t n_images;
+    struct image_queue decoded;
+    struct image_queue blurred;
+    struct memory_budget budget;
+    const struct blur_params* params;
+    struct result_cache* cache;     //NULL sin caché de resultados
+    double decode_busy;         //Segundos de trabajo de cada hilo de etapa
+    double encode_busy;
+    int encode_failures;
+};
+
+
+//Etapa de decodificación: lee la cabecera para apartar memoria y decodifica las imágenes en orden
+static void* decode_stage(void* arg){
+
+    struct batch_pipeline* p = (struct batch_pipeline*)arg;
+
+    for(size_t i = 0; i < p->n_images; ++i) {
+
+        struct batch_image* image = &p->images[i];
+        int width, height, channels;
+
+        if(i + 1 < p->n_images)
+            prefetch_file(p->images[i + 1].input);
+
+        if(stbi_info(image->input, &width, &height, &channels))
+            image->reserved = 2 * (size_t)width * height * channels;
+
+        memory_budget_acquire(&p->budget, image->reserved);
+
+        double start = blur_wall_time();
+        //El pool está ocupado con el filtro, así que el decodificador trabaja solo
+        decode_image(image, p->cache, p->params, NULL);
+        p->decode_busy += blur_wall_time() - start;
+
+        image_queue_push(&p->decoded, image);
+    }
+
+    image_queue_push(&p->decoded, NULL);
+    return NULL;
+}
+
+
+//Etapa de codificación: escribe las imágenes difuminadas en el orden en que llegan y libera su memoria
+static void* encode_stage(void* arg){
+
+    struct batch_pipeline* p = (struct batch_pipeline*)arg;
+    struct batch_image* image;
+
+    while((image = image_queue_pop(&p->blurred)) != NULL) {
+
+        double start = blur_wall_time();
+
+        if(!encode_image(image, NULL)) {
+            fprintf(stderr, "Error escribiendo %s\n", image->output);
+            p->encode_failures++;
+        }
+        else if(image->keyed)
+            result_cache_store(p->cache, image->cache_key, image->output);
+
+        p->encode_busy += blur_wall_time() - start;
+        memory_budget_release(&p->budget, image->reserved - image->reserved / 2);
+    }
+
+    return NULL;
+}
+
+
+//Procesa el lote en tres etapas que se solapan: mientras el pool difumina la imagen N, un hilo decodifica la N+1
+//y otro codifica la N-1. Las colas entre etapas admiten queue_decoded y queue_blurred imágenes y las imágenes en
+//vuelo no pasan de max_bytes (0 sin límite). log se llama con cada imagen difuminada, en orden; las que se copian
+//de la caché de resultados (cache, o NULL) no pasan por el filtro ni por log. Devuelve la cantidad de imágenes que
+//fallaron
+size_t run_batch_pipeline(struct blur_context* ctx, const char* const* inputs, const char* const* outputs, size_t n_images,
+                          const struct blur_params* params, struct result_cache* cache, size_t queue_decoded,
+                          size_t queue_blurred, size_t max_bytes,
+                          void (*log)(const struct batch_image* image, void* ctx), void* log_ctx){
+
+    struct batch_pipeline p;
+    size_t failures = 0;
+    double blur_busy = 0.0;
+    double start = blur_wall_time();
+
+    p.images = (struct batch_image*)calloc(n_images, sizeof(struct batch_image));
+    p.n_images = n_images;
+    p.params = params;
+    p.cache = cache;
+    p.decode_busy = 0.0;
+    p.encode_busy = 0.0;
+    p.encode_failures = 0;
+    p.budget.limit = max_bytes;
+    p.budget.used = 0;
+    p.budget.peak = 0;
+    pthread_mutex_init(&p.budget.lock, NULL);
+    pthread_cond_init(&p.budget.released, NULL);
+    image_queue_init(&p.decoded, queue_decoded);
+    image_queue_init(&p.blurred, queue_blurred);
+
+    for(size_t i = 0; i < n_images; ++i) {
+        p.images[i].input = inputs[i];
+        p.images[i].output = outputs[i];
+    }
+
+    pthread_t decoder, encoder;
+    pthread_create(&decoder, NULL, decode_stage, &p);
+    pthread_create(&encoder, NULL, encode_stage, &p);
+
+    //Etapa del filtro, en este hilo con el pool
+    struct batch_image* image;
+
+    while((image = image_queue_pop(&p.decoded)) != NULL) {
+
+        if(image->cached) {
+            printf("\n%s: acierto en la cache de resultados\n", image->input);
+            memory_budget_release(&p.budget, image->reserved);
+            continue;
+        }
+
+        if(image->pixels == NULL) {
+            fprintf(stderr, "Error cargando %s\n", image->input);
+            memory_budget_release(&p.budget, image->reserved);
+            failures++;
+            continue;
+        }
+
+        double blur_start = blur_wall_time();
+        int ok = blur_batch_image(ctx, image, params);
+        blur_busy += blur_wall_time() - blur_start;
+
+        if(!ok) {
+            stbi_image_free(image->pixels);
+            image->pixels = NULL;
+            memory_budget_release(&p.budget, image->reserved);
+            failures++;
+            continue;
+        }
+
+        //La imagen decodificada ya se liberó; queda apartada solo la difuminada
+        memory_budget_release(&p.budget, image->reserved / 2);
+
+        log(image, log_ctx);
+        image_queue_push(&p.blurred, image);
+    }
+
+    image_queue_push(&p.blurred, NULL);
+
+    pthread_join(decoder, NULL);
+    pthread_join(encoder, NULL);
+
+    double elapsed = blur_wall_time() - start;
+
+    printf("\nLote de %ld imagenes en %f s: decodificacion %f s, filtro %f s, codificacion %f s\n",
+           n_images, elapsed, p.decode_busy, blur_busy, p.encode_busy);
+    printf("Colas de %ld y %ld imagenes, memoria maxima en vuelo: %.1f MB", queue_decoded, queue_blurred, p.budget.peak / 1e6);
+    if(max_bytes)
+        printf(" de %.1f MB", max_bytes / 1e6);
+    printf("\n");
+
+    image_queue_destroy(&p.decoded);
+    image_queue_destroy(&p.blurred);
+    pthread_cond_destroy(&p.budget.released);
+    pthread_mutex_destroy(&p.budget.lock);
+    free(p.images);
+
+    return failures + p.encode_failures;
+}
+
+
+//Agrega a inputs y outputs los pares "entrada salida" de cada línea del archivo path; ignora las líneas vacías
+int read_batch_list(const char* path, char*** inputs, char*** outputs, size_t* n_images) 
+{
+    FILE* fp = fopen(path, "r");
+
+    if(fp == NULL)
+        return 0;
+
+    char line[2*4096];
+    char input[4096];
+    char output[4096];
+
+    while(fgets(line, sizeof(line), fp)) {
+
+        int fields = sscanf(line, "%4095s %4095s", input, output);
+
+        if(fields <= 0)
+            continue;
+
+        if(fields != 2) {
+            fprintf(stderr, "Linea invalida en %s: %s", path, line);
+            fclose(fp);
+            return 0;
+        }
+
+        *inputs = (char**)realloc(*inputs, sizeof(char*) * (*n_images + 1));
+        *outputs = (char**)realloc(*outputs, sizeof(char*) * (*n_images + 1));
+        (*inputs)[*n_images] = strdup(input);
+        (*outputs)[*n_images] = strdup(output);
+        (*n_images)++;
+    }
+
+    fclose(fp);
+    return 1;
+}
+
+
+//Muestra el tiempo de la convolución y lo agrega a <entrada>_<tamaño_kernel>.txt
+void log_blur_time(const char* input, const char* kernel_arg, double seconds_d) 
+{
+    //Devolver tiempo de ejecución del programa
+    printf("\nTiempo de ejecucion: %f segundos\n", seconds_d);
+
+    FILE * fp;
+    size_t file_length = strlen(input) + strlen(kernel_arg) + 6;
+    char * fileName = (char *)malloc(sizeof(char)*file_length);
+    fileName[0] = '\0';
+    strcat(fileName, input);
+    strcat(fileName, "_");
+    strcat(fileName, kernel_arg);
+    strcat(fileName, ".txt");
+
+    //Abrir archivo para registrar el tiempo medido
+    fp = fopen (fileName,"a");
+    
+    fprintf (fp, "%f ", seconds_d);
+   
+    fclose (fp);
+    free(fileName);
+}
+
+
+static void log_pipeline_image(const struct batch_image* image, void* kernel_arg){
+
+    log_blur_time(image->input, (const char*)kernel_arg, image->seconds);
+}
+
+
+//Modo servidor: atiende pedidos por un socket Unix con el pool de hilos y la caché de kernels ya calientes, sin
+//pagar el arranque del proceso en cada imagen
+static volatile sig_atomic_t server_stop = 0;
+
+static void server_signal(int sig){
+
+    (void)sig;
+    server_stop = 1;
+}
+
+
+//SIGINT y SIGTERM detienen el servidor. Sin SA_RESTART, para que la señal interrumpa la espera en curso
+static void install_server_signals(void){
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = server_signal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+}
+
+
+//Pedido al servidor. En el socket son líneas "clave=valor" terminadas por una línea vacía: input (ruta) o size
+//(bytes de la imagen, que siguen a la línea vacía), output, y opcionalmente kernel, sigma, engine y threads. Un
+//pedido con "shutdown=1" detiene el servidor
+struct server_request {
+    char input[4096];
+    char output[4096];
+    size_t inline_size;
+    struct blur_params params;
+    int threads;
+    int shutdown;
+    const char* error;          //Motivo por el que el pedido no es válido, o NULL
+};
+
+
+//Valida un tamaño de kernel que llega de un pedido o de la línea de comandos: impar y entre 1 y MAX_KERNEL_SIZE.
+//Devuelve el motivo si no es válido, o NULL
+static const char* check_kernel_size(long kernel_size){
+
+    if(kernel_size < 1 || kernel_size > MAX_KERNEL_SIZE)
+        return "tamaño de kernel fuera de rango";
+    if(kernel_size % 2 == 0)
+        return "el tamaño de kernel debe ser impar";
+
+    return NULL;
+}
+
+
+//Lee un tamaño de kernel decimal y lo valida con check_kernel_size. Devuelve el motivo si no es válido, o NULL
+static const char* parse_kernel_size(const char* text, size_t* kernel_size){
+
+    char* end;
+    errno = 0;
+    long value = strtol(text, &end, 10);
+
+    if(end == text || *end != '\0' || errno != 0)
+        return "tamaño de kernel no numerico";
+
+    const char* error = check_kernel_size(value);
+    if(error == NULL)
+        *kernel_size = value;
+
+    return error;
+}
+
+
+//Aplica un campo kernel, sigma, engine o threads de un pedido. Devuelve el motivo si no es válido, o NULL
+static const char* parse_request_param(const char* key, const char* value, struct blur_params* params, int* threads){
+
+    if(strcmp(key, "kernel") == 0)
+        return parse_kernel_size(value, &params->kernel_size);
+    else if(strcmp(key, "sigma") == 0) {
+        params->sigma = atof(value);
+        //También rechaza NaN
+        if(!(isfinite(params->sigma) && params->sigma > 0.0))
+            return "sigma debe ser un numero positivo";
+    }
+    else if(strcmp(key, "engine") == 0) {
+        int found = 0;
+        for(size_t e = 0; e < sizeof(blur_engine_names)/sizeof(blur_engine_names[0]); ++e)
+            if(strcmp(value, blur_engine_names[e]) == 0) {
+                params->engine = (enum blur_engine)e;
+                found = 1;
+            }
+        if(!found)
+            return "motor desconocido";
+    }
+    else if(strcmp(key, "threads") == 0)
+        *threads = atoi(value);
+    else
+        return "campo desconocido";
+
+    return NULL;
+}
+
+
+//Lee la cabecera de un pedido completando los campos que faltan con los de defaults. Devuelve 0 si la conexión se
+//cerró antes de un pedido completo
+static int read_request(FILE* in, struct server_request* req, const struct blur_params* defaults){
+
+    char line[8192];
+    int fields = 0;
+
+    memset(req, 0, sizeof(*req));
+    req->params = *defaults;
+
+    while(fgets(line, sizeof(line), in)) {
+
+        line[strcspn(line, "\r\n")] = '\0';
+
+        if(line[0] == '\0') {
+            if(fields == 0)
+                continue;
+            if(req->input[0] == '\0' && req->inline_size == 0 && !req->shutdown && !req->error)
+                req->error = "falta input o size";
+            if(req->output[0] == '\0' && !req->shutdown && !req->error)
+                req->error = "falta output";
+            return 1;
+        }
+
+        ++fields;
+        char* value = strchr(line, '=');
+
+        if(!value) {
+            req->error = "linea sin '='";
+            continue;
+        }
+
+        *value++ = '\0';
+
+        if(strcmp(line, "input") == 0)
+            snprintf(req->input, sizeof(req->input), "%s", value);
+        else if(strcmp(line, "output") == 0)
+            snprintf(req->output, sizeof(req->output), "%s", value);
+        else if(strcmp(line, "size") == 0)
+            req->inline_size = strtoul(value, NULL, 10);
+        else if(strcmp(line, "shutdown") == 0)
+            req->shutdown = 1;
+        else {
+            const char* error = parse_request_param(line, value, &req->params, &req->threads);
+            if(error)
+                req->error = error;
+        }
+    }
+
+    return 0;
+}
+
+
+//Atiende un pedido ya leído y responde "OK <convolucion_s> <total_s>" o "ERROR <motivo>". Devuelve 0 si la conexión
+//se cortó a mitad de los bytes de la imagen o si estos superan max_inline, y entonces hay que cerrarla
+static int serve_request(struct blur_context* ctx, struct result_cache* cache, struct decoded_cache* decoded, FILE* in, int fd,
+                         struct server_request* req, size_t max_inline){
+
+    struct thread_pool* pool = blur_context_pool(ctx);
+
+    double start = blur_wall_time();
+    unsigned char* data = NULL;
+
+    //Se rechaza antes de reservar; como los bytes de la imagen siguen en el flujo, la conexión ya no sirve
+    if(req->inline_size > max_inline) {
+        dprintf(fd, "ERROR size supera el maximo de %zu bytes\n", max_inline);
+        return 0;
+    }
+
+    if(req->inline_size) {
+        data = (unsigned char*)malloc(req->inline_size);
+        if(!data || fread(data, 1, req->inline_size, in) != req->inline_size) {
+            free(data);
+            return 0;
+        }
+    }
+
+    if(req->error) {
+        free(data);
+        dprintf(fd, "ERROR %s\n", req->error);
+        return 1;
+    }
+
+    //Sin perfil, cada pedido elige cuántos hilos del pool usa; por defecto todos
+    if(!req->params.profile)
+        blur_pool_set_active(pool, req->threads > 0 && req->threads < blur_pool_threads(pool) ? req->threads : blur_pool_threads(pool));
+
+    struct batch_image image;
+    memset(&image, 0, sizeof(image));
+    image.input = data ? "(en linea)" : req->input;
+    image.output = req->output;
+
+    int loaded = data ? load_image_memory(&image, data, req->inline_size, cache, &req->params, pool) :
+                 decoded ? decode_image_cached(decoded, &image, cache, &req->params, pool) :
+                 decode_image(&image, cache, &req->params, pool);
+    free(data);
+
+    if(!loaded) {
+        dprintf(fd, "ERROR no se pudo cargar la imagen\n");
+        return 1;
+    }
+
+    if(image.cached) {
+        printf("\n%s: acierto en la cache de resultados\n", image.input);
+        dprintf(fd, "OK %f %f\n", 0.0, blur_wall_time() - start);
+        return 1;
+    }
+
+    if(!blur_batch_image(ctx, &image, &req->params)) {
+        if(!image.borrowed)
+            stbi_image_free(image.pixels);
+        dprintf(fd, "ERROR no se pudo difuminar la imagen\n");
+        return 1;
+    }
+
+    if(!encode_image(&image, pool)) {
+        dprintf(fd, "ERROR no se pudo escribir la imagen\n");
+        return 1;
+    }
+
+    if(image.keyed)
+        result_cache_store(cache, image.cache_key, image.output);
+
+    //Las imágenes con ruta registran su tiempo igual que sin servidor
+    if(!req->inline_size) {
+        char kernel_arg[32];
+        snprintf(kernel_arg, sizeof(kernel_arg), "%zu", req->params.kernel_size);
+        log_blur_time(req->input, kernel_arg, image.seconds);
+    }
+
+    dprintf(fd, "OK %f %f\n", image.seconds, blur_wall_time() - start);
+    return 1;
+}
+
+
+//Escucha en socket_path y atiende los pedidos de a una conexión por vez hasta recibir SIGINT, SIGTERM o un pedido
+//de shutdown. Con cache, los pedidos ya atendidos se responden copiando el resultado, y con decoded las imágenes
+//con ruta se decodifican una vez. Una conexión que pasa timeout segundos sin enviar nada se cierra, y una imagen en
+//línea de más de max_inline bytes se rechaza. Devuelve 0 si no pudo abrir el socket
+int run_server(struct blur_context* ctx, const char* socket_path, const struct blur_params* defaults, struct result_cache* cache,
+               struct decoded_cache* decoded, size_t max_inline, int timeout){
+
+    struct thread_pool* pool = blur_context_pool(ctx);
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+
+    if(strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Ruta de socket demasiado larga: %s\n", socket_path);
+        return 0;
+    }
+
+    strcpy(addr.sun_path, socket_path);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    //Un socket que quedó de una ejecución anterior impediría el bind
+    unlink(socket_path);
+
+    if(listener < 0 || bind(listener, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(listener, 16) != 0) {
+        perror("Error abriendo el socket del servidor!\n");
+        if(listener >= 0)
+            close(listener);
+        return 0;
+    }
+
+    install_server_signals();
+
+    printf("\nServidor escuchando en %s con %d hilos\n", socket_path, blur_pool_threads(pool));
+    fflush(stdout);
+
+    size_t served = 0;
+    struct server_request req;
+
+    while(!server_stop) {
+
+        int fd = accept(listener, NULL, NULL);
+
+        if(fd < 0) {
+            if(errno == EINTR)
+                continue;
+            perror("Error aceptando una conexion!\n");
+            break;
+        }
+
+        //Sin plazo, un cliente que deja de enviar a mitad de un pedido retendría al servidor para siempre
+        struct timeval limit = { timeout, 0 };
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &limit, sizeof(limit));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &limit, sizeof(limit));
+
+        FILE* in = fdopen(fd, "r");
+
+        if(in == NULL) {
+            close(fd);
+            continue;
+        }
+
+        while(!server_stop && read_request(in, &req, defaults)) {
+
+            if(req.shutdown) {
+                dprintf(fd, "OK\n");
+                server_stop = 1;
+                break;
+            }
+
+            if(!serve_request(ctx, cache, decoded, in, fd, &req, max_inline))
+                break;
+
+            ++served;
+            fflush(stdout);
+        }
+
+        fclose(in);
+    }
+
+    close(listener);
+    unlink(socket_path);
+
+    printf("\nServidor detenido tras %zu pedidos\n", served);
+    return 1;
+}
+
+
+
+//Modo --jobs: atiende una lista de trabajos "entrada salida [kernel=K] [sigma=S] [engine=E] [threads=N]", uno por
+//línea, leyéndolos de list a medida que llegan (así sirve también con un flujo por la entrada estándar). Los campos
+//que faltan toman los valores de defaults. Las imágenes se decodifican una vez mientras quepan en decoded y los
+//tiempos se registran en el log como en el modo normal. Devuelve la cantidad de trabajos que fallaron
+size_t run_jobs(struct blur_context* ctx, FILE* list, const struct blur_params* defaults, struct result_cache* cache,
+                struct decoded_cache* decoded){
+
+    struct thread_pool* pool = blur_context_pool(ctx);
+    char line[3*4096];
+    size_t failures = 0;
+    size_t jobs = 0;
+
+    while(fgets(line, sizeof(line), list)) {
+
+        const char* input = strtok(line, " \t\r\n");
+        const char* output = strtok(NULL, " \t\r\n");
+        const char* error = NULL;
+        struct blur_params params = *defaults;
+        int threads = 0;
+        char* field;
+
+        if(input == NULL)
+            continue;
+
+        if(output == NULL)
+            error = "falta la imagen de salida";
+
+        while(!error && (field = strtok(NULL, " \t\r\n")) != NULL) {
+
+            char* value = strchr(field, '=');
+
+            if(!value) {
+                error = "campo sin '='";
+                break;
+            }
+
+            *value++ = '\0';
+            error = parse_request_param(field, value, &params, &threads);
+        }
+
+        ++jobs;
+
+        if(error) {
+            fprintf(stderr, "Trabajo %zu (%s): %s\n", jobs, input, error);
+            failures++;
+            continue;
+        }
+
+        //Sin perfil, cada trabajo elige cuántos hilos del pool usa; por defecto todos
+        if(!params.profile)
+            blur_pool_set_active(pool, threads > 0 && threads < blur_pool_threads(pool) ? threads : blur_pool_threads(pool));
+
+        double seconds_d;
+        int done = blur_file(ctx, input, output, &params, cache, decoded, &seconds_d);
+
+        if(!done)
+            failures++;
+        else if(done == 1) {
+            char kernel_arg[32];
+            snprintf(kernel_arg, sizeof(kernel_arg), "%zu", params.kernel_size);
+            log_blur_time(input, kernel_arg, seconds_d);
+        }
+
+        fflush(stdout);
+    }
+
+    printf("\n%zu trabajos, %zu fallidos\n", jobs, failures);
+    return failures;
+}
+
+
+//Devuelve al anillo las ranuras tomadas por llamadores que terminaron sin liberarlas: si no, la ranura quedaría
+//ocupada para siempre. El dueño viaja en la misma palabra que el estado, así que no hay ranuras tomadas sin dueño
+static size_t reclaim_shm_slots(struct blur_shm_header* header, uint32_t n_slots){
+
+    size_t reclaimed = 0;
+
+    for(uint32_t i = 0; i < n_slots; ++i) {
+
+        struct blur_shm_slot* slot = &header->slots[i];
+        uint32_t word = atomic_load(&slot->state);
+        uint32_t state = BLUR_SLOT_STATE(word);
+        int32_t owner = BLUR_SLOT_OWNER(word);
+
+        if(owner <= 0 || (state != BLUR_SLOT_FILLING && state != BLUR_SLOT_DONE && state != BLUR_SLOT_FAILED))
+            continue;
+
+        if(kill(owner, 0) == 0 || errno != ESRCH)
+            continue;
+
+        //Solo si nadie la cambió entretanto: una ranura que no está libre no la puede tomar otro llamador
+        if(atomic_compare_exchange_strong(&slot->state, &word, BLUR_SLOT_FREE)) {
+            blur_shm_futex_wake(&slot->state);
+            atomic_fetch_add(&header->released, 1);
+            blur_shm_futex_wake(&header->released);
+            ++reclaimed;
+        }
+    }
+
+    return reclaimed;
+}
+
+
+//Modo --shm: los cuadros llegan ya decodificados por un anillo de ranuras en memoria compartida (ver blur_shm.h). El
+//filtro lee la entrada de cada ranura en el lugar y escribe la salida en la misma ranura, sin códec ni copias.
+//Atiende las ranuras listas recorriendo el anillo desde la última atendida, de modo que una ranura que su llamador
+//no termina de llenar no demora a las demás, hasta recibir SIGINT, SIGTERM o un blur_shm_shutdown. Cualquier proceso
+//puede escribir en el segmento, así que los buffers se ubican con el tamaño de ranura propio del servidor y los
+//campos del pedido se copian una vez antes de validarlos. Devuelve 0 si no pudo crear el segmento
+int run_shm_server(struct blur_context* ctx, const char* name, uint32_t n_slots, uint64_t slot_bytes, const struct blur_params* defaults){
+
+    struct thread_pool* pool = blur_context_pool(ctx);
+
+    size_t size = blur_shm_size(n_slots, slot_bytes);
+
+    //Un segmento que quedó de una ejecución anterior tendría llamadores esperando en ranuras viejas
+    shm_unlink(name);
+
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    void* data = MAP_FAILED;
+
+    if(fd >= 0 && ftruncate(fd, size) == 0)
+        data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if(fd >= 0)
+        close(fd);
+
+    if(data == MAP_FAILED) {
+        perror("Error creando la memoria compartida!\n");
+        shm_unlink(name);
+        return 0;
+    }
+
+    struct blur_shm_header* header = (struct blur_shm_header*)data;
+    blur_shm_init(header, n_slots, slot_bytes);
+
+    install_server_signals();
+
+    printf("\nMemoria compartida %s: %u ranuras de %.1f MB con %d hilos\n", name, n_slots, slot_bytes / 1e6, blur_pool_threads(pool));
+    fflush(stdout);
+
+    size_t served = 0;
+    size_t failed = 0;
+    size_t reclaimed = 0;
+
+    for(uint32_t next = 0; !server_stop && !atomic_load(&header->shutdown); ) {
+
+        //Se lee antes de recorrer el anillo: un envío posterior cambia el contador y la espera no se duerme
+        uint32_t submitted = atomic_load(&header->submitted);
+        uint32_t found = n_slots;
+
+        for(uint32_t i = 0; i < n_slots && found == n_slots; ++i)
+            if(BLUR_SLOT_STATE(atomic_load(&header->slots[(next + i) % n_slots].state)) == BLUR_SLOT_READY)
+                found = (next + i) % n_slots;
+
+        if(found == n_slots) {
+            reclaimed += reclaim_shm_slots(header, n_slots);
+            blur_shm_futex_wait(&header->submitted, submitted, BLUR_SHM_POLL_MS);
+            continue;
+        }
+
+        next = found;
+        struct blur_shm_slot* slot = &header->slots[next];
+
+        blur_shm_set_state(slot, BLUR_SLOT_BUSY);
+
+        //Copia del pedido: el llamador no puede cambiarlo entre la validación y el filtro
+        struct blur_shm_slot request;
+        memcpy(&request, (const void*)slot, sizeof(request));
+        request.engine[sizeof(request.engine) - 1] = '\0';
+
+        struct blur_params params = *defaults;
+        int valid = request.channels >= 1 && request.channels <= MAX_PLANES && request.width > 0 && request.height > 0 &&
+                    request.width <= INT_MAX && request.height <= INT_MAX &&
+                    (uint64_t)request.width * request.height * request.channels <= slot_bytes;
+
+        if(request.kernel_size)
+            valid = valid && check_kernel_size(request.kernel_size) == NULL;
+        if(valid && request.kernel_size)
+            params.kernel_size = request.kernel_size;
+        //0 pide la sigma del servidor; cualquier otro valor tiene que ser finito y positivo
+        if(request.sigma != 0.0)
+            valid = valid && isfinite(request.sigma) && request.sigma > 0.0;
+        if(valid && request.sigma != 0.0)
+            params.sigma = request.sigma;
+
+        if(request.engine[0]) {
+            int found = 0;
+            for(size_t e = 0; e < sizeof(blur_engine_names)/sizeof(blur_engine_names[0]); ++e)
+                if(strcmp(request.engine, blur_engine_names[e]) == 0) {
+                    params.engine = (enum blur_engine)e;
+                    found = 1;
+                }
+            valid = valid && found;
+        }
+
+        //La entrada se lee en el lugar y la salida se escribe directamente en la ranura
+        size_t input_offset = blur_shm_input_offset(n_slots, slot_bytes, next);
+        struct blur_frame in = { (unsigned char*)data + input_offset, (int)request.width, (int)request.height, (int)request.channels };
+        struct blur_frame out = { (unsigned char*)data + input_offset + blur_shm_round(slot_bytes), 0, 0, 0 };
+
+        if(!params.profile)
+            blur_pool_set_active(pool, blur_pool_threads(pool));
+
+        if(valid)
+            printf("\n%s: ancho: %dpx, alto: %dpx, canales: %d\n", name, in.width, in.height, in.channels);
+
+        if(valid && blur_image(ctx, &in, &out, &params)) {
+            slot->seconds = blur_context_seconds(ctx);
+            blur_shm_set_state(slot, BLUR_SLOT_DONE);
+            ++served;
+        }
+        else {
+            blur_shm_set_state(slot, BLUR_SLOT_FAILED);
+            ++failed;
+        }
+
+        fflush(stdout);
+        next = (next + 1) % n_slots;
+    }
+
+    //Los llamadores que esperan una ranura o un resultado ven el shutdown y se van
+    atomic_store(&header->shutdown, 1);
+    for(uint32_t i = 0; i < n_slots; ++i)
+        blur_shm_futex_wake(&header->slots[i].state);
+    blur_shm_futex_wake(&header->released);
+
+    munmap(data, size);
+    shm_unlink(name);
+
+    printf("\nMemoria compartida detenida tras %zu cuadros (%zu fallidos, %zu ranuras recuperadas)\n", served, failed, reclaimed);
+    return 1;
+}
+
+
+int main(int argc, char* argv[]) {
+
+    //Comparación de los kernels especializados con la ruta genérica
+    if(argc >= 2 && strcmp(argv[1], "--bench-kernels") == 0) {
+        blur_benchmark_kernels(blur_detect_simd_level());
+        return EXIT_SUCCESS;
+    }
+
+    //Verificación de cantidad de argumentos correcta
+    if(argc < 5) {
+        perror("Cantidad de argumentos no es valida!");
+        return EXIT_FAILURE;
+    }
+
+    //En modo servidor el segundo argumento es el socket, o el nombre de la memoria compartida, y con --jobs la lista
+    //de trabajos ("-" para la entrada estándar); el tamaño de kernel es el de los pedidos que no lo indiquen
+    const char* serve_path = NULL;
+    const char* shm_name = NULL;
+    const char* jobs_path = NULL;
+
+    if(strcmp(argv[1], "--serve") == 0)
+        serve_path = argv[2];
+    else if(strcmp(argv[1], "--shm") == 0)
+        shm_name = argv[2];
+    else if(strcmp(argv[1], "--jobs") == 0)
+        jobs_path = argv[2];
+
+    //Opciones adicionales después de los argumentos posicionales
+    enum blur_engine engine = ENGINE_AUTO;
+    double sigma = DEFAULT_SIGMA;
+    enum simd_level simd = blur_detect_simd_level();
+    enum simd_level simd_max = simd;
+    size_t tile_w = 0;
+    size_t tile_h = 0;
+    enum edge_mode edge = EDGE_CLAMP;
+    float edge_value = 0.0f;
+    const char* batch_list = NULL;
+    int numa = 0;
+    enum affinity_policy affinity = AFFINITY_NONE;
+    const char* affinity_list = NULL;
+    const char* profile_path = NULL;
+    int calibrate = 0;
+    int pipeline = 0;
+    size_t queue_decoded = 2;
+    size_t queue_blurred = 2;
+    size_t max_memory_mb = 0;
+    uint32_t shm_slots = 4;
+    size_t shm_slot_mb = 64;
+    const char* cache_dir = NULL;
+    size_t cache_mb = 256;
+    long decoded_mb = -1;
+    size_t serve_max_mb = 64;
+    int serve_timeout = 10;
+
+    for(int i = 5; i < argc; ++i) {
+
+        if(strncmp(argv[i], "--engine=", 9) == 0) {
+
+            const char* name = argv[i] + 9;
+            int found = 0;
+
+            for(size_t e = 0; e < sizeof(blur_engine_names)/sizeof(blur_engine_names[0]); ++e)
+                if(strcmp(name, blur_engine_names[e]) == 0) {
+                    engine = (enum blur_engine)e;
+                    found = 1;
+                }
+
+            if(!found) {
+                fprintf(stderr, "Motor desconocido: %s\n", name);
+                return EXIT_FAILURE;
+            }
+        }
+        else if(strncmp(argv[i], "--simd=", 7) == 0) {
+
+            const char* name = argv[i] + 7;
+            int found = 0;
+
+            for(size_t l = 0; l < sizeof(blur_simd_names)/sizeof(blur_simd_names[0]); ++l)
+                if(strcmp(name, blur_simd_names[l]) == 0) {
+                    simd = (enum simd_level)l;
+                    found = 1;
+                }
+
+            if(!found) {
+                fprintf(stderr, "Conjunto de instrucciones desconocido: %s\n", name);
+                return EXIT_FAILURE;
+            }
+
+            if(simd > simd_max) {
+                fprintf(stderr, "La CPU no soporta %s\n", name);
+                return EXIT_FAILURE;
+            }
+        }
+        else if(strncmp(argv[i], "--tile=", 7) == 0) {
+
+            //Mosaico del motor separable: "auto" o ANCHOxALTO en pixeles
+            if(strcmp(argv[i] + 7, "auto") != 0 && (sscanf(argv[i] + 7, "%zux%zu", &tile_w, &tile_h) != 2 || tile_w == 0 || tile_h == 0)) {
+                fprintf(stderr, "Mosaico invalido, se espera ANCHOxALTO o auto: %s\n", argv[i] + 7);
+                return EXIT_FAILURE;
+            }
+        }
+        else if(strncmp(argv[i], "--edge=", 7) == 0) {
+
+            //Modo de borde; el constante admite un valor opcional: constant:VALOR
+            const char* name = argv[i] + 7;
+            int found = 0;
+
+            for(size_t m = 0; m < sizeof(blur_edge_names)/sizeof(blur_edge_names[0]); ++m) {
+                size_t len = strlen(blur_edge_names[m]);
+                if(strncmp(name, blur_edge_names[m], len) == 0 && (name[len] == '\0' || (m == EDGE_CONSTANT && name[len] == ':'))) {
+                    edge = (enum edge_mode)m;
+                    found = 1;
+                    if(name[len] == ':')
+                        edge_value = (float)atof(name + len + 1);
+                }
+            }
+
+            if(!found) {
+                fprintf(stderr, "Modo de borde desconocido: %s\n", name);
+                return EXIT_FAILURE;
+            }
+
+            if(edge_value < 0.0f || edge_value > 255.0f) {
+                fprintf(stderr, "El valor del borde constante debe estar entre 0 y 255: %s\n", name);
+                return EXIT_FAILURE;
+            }
+        }
+        else if(strcmp(argv[i], "--numa") == 0) {
+
+            numa = 1;
+        }
+        else if(strncmp(argv[i], "--affinity=", 11) == 0) {
+
+            //Política de fijación: compact, scatter, none o una lista explícita de CPUs
+            const char* name = argv[i] + 11;
+            affinity = AFFINITY_LIST;
+            affinity_list = name;
+
+            for(size_t p = 0; p < sizeof(blur_affinity_names)/sizeof(blur_affinity_names[0]); ++p)
+                if(p != AFFINITY_LIST && strcmp(name, blur_affinity_names[p]) == 0)
+                    affinity = (enum affinity_policy)p;
+        }
+        else if(strncmp(argv[i], "--profile=", 10) == 0) {
+
+            profile_path = argv[i] + 10;
+        }
+        else if(strcmp(argv[i], "--calibrate") == 0) {
+
+            calibrate = 1;
+        }
+        else if(strcmp(argv[i], "--pipeline") == 0) {
+
+            pipeline = 1;
+        }
+        else if(strncmp(argv[i], "--queue=", 8) == 0) {
+
+            //Profundidad de las colas: una para ambas o "decodificadas,difuminadas"
+            int fields = sscanf(argv[i] + 8, "%zu,%zu", &queue_decoded, &queue_blurred);
+
+            if(fields == 1)
+                queue_blurred = queue_decoded;
+
+            if(fields < 1 || queue_decoded == 0 || queue_blurred == 0) {
+                fprintf(stderr, "Profundidad de cola invalida: %s\n", argv[i] + 8);
+                return EXIT_FAILURE;
+            }
+        }
+        else if(strncmp(argv[i], "--slots=", 8) == 0) {
+
+            //Ranuras del anillo y tamaño en MB de cada buffer del modo --shm
+            shm_slots = (uint32_t)strtoul(argv[i] + 8, NULL, 10);
+
+            if(shm_slots == 0) {
+                fprintf(stderr, "Cantidad de ranuras invalida: %s\n", argv[i] + 8);
+                return EXIT_FAILURE;
+            }
+        }
+        else if(strncmp(argv[i], "--slot-size=", 12) == 0) {
+
+            shm_slot_mb = strtoul(argv[i] + 12, NULL, 10);
+
+            if(shm_slot_mb == 0) {
+                fprintf(stderr, "Tamaño de ranura invalido: %s\n", argv[i] + 12);
+                return EXIT_FAILURE;
+            }
+        }
+        else if(strncmp(argv[i], "--max-size=", 11) == 0) {
+
+            //Mayor imagen en línea que acepta --serve, en MB
+            serve_max_mb = strtoul(argv[i] + 11, NULL, 10);
+
+            if(serve_max_mb == 0) {
+                fprintf(stderr, "Tamaño maximo invalido: %s\n", argv[i] + 11);
+                return EXIT_FAILURE;
+            }
+        }
+        else if(strncmp(argv[i], "--timeout=", 10) == 0) {
+
+            //Segundos que --serve espera los bytes de un pedido antes de cerrar la conexión
+            serve_timeout = atoi(argv[i] + 10);
+
+            if(serve_timeout <= 0) {
+                fprintf(stderr, "Plazo invalido: %s\n", argv[i] + 10);
+                return EXIT_FAILURE;
+            }
+        }
+        else if(strncmp(argv[i], "--max-memory=", 13) == 0) {
+
+            //Límite en MB de las imágenes en vuelo del lote
+            max_memory_mb = strtoul(argv[i] + 13, NULL, 10);
+        }
+        else if(strncmp(argv[i], "--batch=", 8) == 0) {
+
+            //Lista de pares "entrada salida" que se procesan después de la imagen de los argumentos
+            batch_list = argv[i] + 8;
+        }
+        else if(strncmp(argv[i], "--cache=", 8) == 0) {
+
+            //Directorio de la caché de resultados
+            cache_dir = argv[i] + 8;
+        }
+        else if(strncmp(argv[i], "--cache-size=", 13) == 0) {
+
+            cache_mb = strtoul(argv[i] + 13, NULL, 10);
+
+            if(cache_mb == 0) {
+                fprintf(stderr, "Tamaño de cache invalido: %s\n", argv[i] + 13);
+                return EXIT_FAILURE;
+            }
+        }
+        else if(strncmp(argv[i], "--decoded-cache=", 16) == 0) {
+
+            //Límite en MB de las imágenes decodificadas que se conservan; 0 las libera siempre
+            decoded_mb = strtol(argv[i] + 16, NULL, 10);
+
+            if(decoded_mb < 0) {
+                fprintf(stderr, "Tamaño de cache invalido: %s\n", argv[i] + 16);
+                return EXIT_FAILURE;
+            }
+        }
+        else if(strncmp(argv[i], "--sigma=", 8) == 0) {
+
+            sigma = atof(argv[i] + 8);
+
+            if(!(isfinite(sigma) && sigma > 0.0)) {
+                fprintf(stderr, "Sigma debe ser un numero positivo: %s\n", argv[i] + 8);
+                return EXIT_FAILURE;
+            }
+        }
+        else {
+            fprintf(stderr, "Opcion desconocida: %s\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    struct blur_params params = { 0, sigma, engine, simd, tile_w, tile_h, edge, edge_value, numa, NULL };
+
+    //Extracción de tamaño del kernel: impar y entre 1 y MAX_KERNEL_SIZE
+    const char* kernel_error = parse_kernel_size(argv[3], &params.kernel_size);
+
+    if(kernel_error){
+
+        fprintf(stderr, "Tamaño de kernel no valido (%s): %s\n", argv[3], kernel_error);
+        return EXIT_FAILURE;
+    }
+
+    //Con "auto" el pool tiene un hilo por CPU utilizable y cada imagen usa los que estima el perfil del equipo
+    struct host_profile profile;
+    char default_path[4096];
+    int n_threads;
+
+    if(strcmp(argv[4], "auto") == 0) {
+
+        if(profile_path == NULL) {
+            blur_default_profile_path(default_path, sizeof(default_path));
+            profile_path = default_path;
+        }
+
+        blur_detect_host(&profile, simd);
+
+        if(calibrate || !blur_load_host_profile(profile_path, &profile)) {
+
+            printf("\nCalibrando el equipo...\n");
+            blur_calibrate_host(&profile);
+
+            if(!blur_save_host_profile(profile_path, &profile))
+                fprintf(stderr, "No se pudo guardar el perfil en %s\n", profile_path);
+        }
+
+        printf("\nPerfil %s: %d CPUs, %d nucleos fisicos, memcpy %.1f GB/s con un hilo y %.1f GB/s con todos, tap %.3f ns\n",
+               profile_path, profile.logical_cpus, profile.physical_cores, profile.bandwidth_1, profile.bandwidth_all, profile.tap_ns);
+
+        params.profile = &profile;
+        n_threads = blur_host_usable_threads(&profile);
+    }
+    else {
+
+        n_threads = atoi(argv[4]);
+
+        if(n_threads < 1) {
+            perror("Cantidad de hilos no es valida!\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    //Pares de imágenes a procesar: el de los argumentos y, en modo por lotes, los de la lista
+    size_t n_images = 1;
+    char** inputs = (char**)malloc(sizeof(char*));
+    char** outputs = (char**)malloc(sizeof(char*));
+    inputs[0] = argv[1];
+    outputs[0] = argv[2];
+
+    if(batch_list && !read_batch_list(batch_list, &inputs, &outputs, &n_images)) {
+        perror("Error leyendo la lista de imagenes!\n");
+        return EXIT_FAILURE;
+    }
+
+    //Los hilos, los kernels y los buffers de trabajo se crean una sola vez y atienden todas las imágenes
+    struct blur_context* ctx = blur_context_create(n_threads, &params);
+
+    if(ctx == NULL) {
+        perror("Error creando los hilos!\n");
+        return EXIT_FAILURE;
+    }
+
+    blur_context_set_verbose(ctx, 1);
+
+    //En modo NUMA los hilos se fijan siempre; por defecto llenando un nodo antes de pasar al siguiente, para que
+    //bloques de filas vecinos queden en el mismo nodo
+    if(numa && affinity == AFFINITY_NONE)
+        affinity = AFFINITY_COMPACT;
+
+    if(affinity != AFFINITY_NONE) {
+
+        struct numa_topology topology;
+        blur_read_numa_topology(&topology);
+
+        int* worker_cpu = (int*)malloc(sizeof(int) * n_threads);
+        int* worker_node = (int*)malloc(sizeof(int) * n_threads);
+
+        if(worker_cpu == NULL || worker_node == NULL) {
+            perror("Error reservando memoria para fijar los hilos!\n");
+            return EXIT_FAILURE;
+        }
+
+        if(!blur_assign_worker_cpus(&topology, affinity, affinity_list, n_threads, worker_cpu)) {
+            fprintf(stderr, "Lista de CPUs invalida: %s\n", affinity_list);
+            return EXIT_FAILURE;
+        }
+
+        for(int i = 0; i < n_threads; ++i)
+            worker_node[i] = topology.cpu_node[worker_cpu[i]];
+
+        if(!blur_context_pin(ctx, worker_cpu, worker_node)) {
+            perror("Error reservando memoria para fijar los hilos!\n");
+            return EXIT_FAILURE;
+        }
+
+        printf("\nTopologia: %d nodos, %d CPUs. Hilos fijados (%s):", topology.n_nodes, topology.n_cpus, blur_affinity_names[affinity]);
+        for(int i = 0; i < n_threads; ++i)
+            printf(" %d->%d", i, worker_cpu[i]);
+        printf("\n");
+
+        free(worker_cpu);
+        free(worker_node);
+        blur_free_numa_topology(&topology);
+    }
+
+    //En modo NUMA libblur libera los planos de cada imagen; sin umbral dinámico de mmap los de la siguiente son
+    //páginas nuevas, y el primer acceso decide su nodo
+    if(numa)
+        mallopt(M_MMAP_THRESHOLD, 128*1024);
+
+    //Salidas ya calculadas, por el hash de la entrada y los parámetros; el modo --shm no la usa
+    struct result_cache results;
+    struct result_cache* cache = NULL;
+
+    if(cache_dir) {
+
+        if(!result_cache_open(&results, cache_dir, cache_mb * 1000000)) {
+            fprintf(stderr, "No se pudo abrir la cache de resultados en %s\n", cache_dir);
+            return EXIT_FAILURE;
+        }
+
+        cache = &results;
+    }
+
+    //Imágenes ya decodificadas; por defecto solo con varios pedidos que pueden repetir la imagen (--jobs y --serve).
+    //El modo --pipeline no la usa
+    struct decoded_cache decoded_images;
+    struct decoded_cache* decoded = NULL;
+
+    if(decoded_mb < 0)
+        decoded_mb = jobs_path || serve_path ? 512 : 0;
+
+    if(decoded_mb > 0 && !pipeline) {
+        decoded_cache_init(&decoded_images, (size_t)decoded_mb * 1000000);
+        decoded = &decoded_images;
+    }
+
+    int status = EXIT_SUCCESS;
+
+    if(serve_path) {
+
+        if(!run_server(ctx, serve_path, &params, cache, decoded, serve_max_mb * 1000000, serve_timeout))
+            status = EXIT_FAILURE;
+    }
+    else if(jobs_path) {
+
+        FILE* list = strcmp(jobs_path, "-") == 0 ? stdin : fopen(jobs_path, "r");
+
+        if(list == NULL) {
+            perror("Error leyendo la lista de trabajos!\n");
+            status = EXIT_FAILURE;
+        }
+        else {
+            if(run_jobs(ctx, list, &params, cache, decoded))
+                status = EXIT_FAILURE;
+            if(list != stdin)
+                fclose(list);
+        }
+    }
+    else if(shm_name) {
+
+        if(!run_shm_server(ctx, shm_name, shm_slots, (uint64_t)shm_slot_mb * 1000000, &params))
+            status = EXIT_FAILURE;
+    }
+    else if(pipeline) {
+
+        size_t failures = run_batch_pipeline(ctx, (const char* const*)inputs, (const char* const*)outputs, n_images, &params,
+                                             cache, queue_decoded, queue_blurred, max_memory_mb * 1000000, log_pipeline_image, argv[3]);
+        if(failures)
+            status = EXIT_FAILURE;
+    }
+    else {
+
+        for(size_t image = 0; image < n_images; ++image) {
+
+            double seconds_d;
+
+            if(image + 1 < n_images)
+                prefetch_file(inputs[image + 1]);
+
+            int done = blur_file(ctx, inputs[image], outputs[image], &params, cache, decoded, &seconds_d);
+
+            if(!done) {
+                status = EXIT_FAILURE;
+                continue;
+            }
+
+            //Un acierto de la caché no pasó por el filtro: no hay tiempo que registrar
+            if(done == 1)
+                log_blur_time(inputs[image], argv[3], seconds_d);
+        }
+    }
+
+    if(decoded) {
+        decoded_cache_report(decoded);
+        decoded_cache_destroy(decoded);
+    }
+
+    if(cache) {
+        result_cache_report(cache);
+        result_cache_close(cache);
+    }
+
+    blur_context_destroy(ctx);
+
+    //Cruces con el FFT medidos durante esta ejecución
+    if(params.profile && profile.dirty)
+        blur_save_host_profile(profile_path, &profile);
+
+    for(size_t image = 1; image < n_images; ++image) {
+        free(inputs[image]);
+        free(outputs[image]);
+    }
+
+    free(inputs);
+    free(outputs);
+   
+    return status;
+}
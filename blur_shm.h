@@ -0,0 +1,314 @@
+//Interfaz de memoria compartida con el modo --shm de blur_effect
+//
+//El servidor crea con shm_open un segmento con un anillo de ranuras. Cada ranura tiene un buffer de entrada y uno de
+//salida de slot_bytes bytes: el llamador escribe los pixeles entrelazados (gris, gris con alfa, RGB o RGBA) en el
+//de entrada, el servidor los difumina leyéndolos en el lugar y escribe el resultado en el de salida, sin codificar
+//ni copiar la imagen. El estado de cada ranura, junto con el pid del llamador que la tomó, es a la vez la palabra
+//del futex con que se avisan ambos lados.
+//
+//Uso desde el proceso llamador:
+//
+//    struct blur_shm shm;
+//    uint32_t slot;
+//    blur_shm_open(&shm, "/blur");
+//    blur_shm_acquire(&shm, &slot);                            //Toma cualquier ranura libre, o espera una
+//    ...escribir el cuadro en blur_shm_input(&shm, slot)...
+//    blur_shm_submit(&shm, slot, ancho, alto, canales, 9, 0.0, NULL);
+//    if(blur_shm_wait(&shm, slot, &segundos))
+//        ...leer el resultado en blur_shm_output(&shm, slot)...
+//    blur_shm_release(&shm, slot);
+//    blur_shm_close(&shm);
+#ifndef BLUR_SHM_H
+#define BLUR_SHM_H
+
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#define BLUR_SHM_MAGIC 0x52554c42u     //"BLUR"
+#define BLUR_SHM_VERSION 4
+#define BLUR_SHM_ALIGN 4096             //Cabecera y buffers empiezan en páginas distintas
+#define BLUR_SHM_POLL_MS 100            //Las esperas despiertan cada tanto para ver si el servidor terminó
+
+//Estados de una ranura
+enum blur_slot_state {
+    BLUR_SLOT_FREE = 0,                 //Disponible para blur_shm_acquire
+    BLUR_SLOT_FILLING,                  //El llamador está escribiendo la entrada
+    BLUR_SLOT_READY,                    //Enviada; el servidor toma las listas recorriendo el anillo
+    BLUR_SLOT_BUSY,                     //El servidor la está difuminando
+    BLUR_SLOT_DONE,                     //La salida está lista
+    BLUR_SLOT_FAILED                    //Parámetros inválidos o imagen mayor que la ranura
+};
+
+//La palabra de estado lleva el estado en los bits bajos y el pid del dueño en el resto (los pid de Linux caben en
+//22 bits), así que el llamador se publica como dueño en el mismo CAS con que toma la ranura. Libre es 0
+#define BLUR_SLOT_STATE_BITS 4
+#define BLUR_SLOT_STATE(word) ((word) & ((1u << BLUR_SLOT_STATE_BITS) - 1))
+#define BLUR_SLOT_OWNER(word) ((int32_t)((word) >> BLUR_SLOT_STATE_BITS))
+#define BLUR_SLOT_WORD(owner, state) (((uint32_t)(owner) << BLUR_SLOT_STATE_BITS) | (state))
+
+struct blur_shm_slot {
+    _Atomic uint32_t state;             //BLUR_SLOT_WORD(dueño, estado)
+    uint32_t width;
+    uint32_t height;
+    uint32_t channels;
+    uint32_t kernel_size;               //0: el del servidor
+    double sigma;                       //0: la del servidor
+    char engine[16];                    //Cadena vacía: el motor del servidor
+    double seconds;                     //Tiempo de la convolución, al quedar DONE
+};
+
+struct blur_shm_header {
+    _Atomic uint32_t magic;             //Se escribe al final, cuando el segmento está listo
+    uint32_t version;
+    uint32_t n_slots;
+    uint64_t slot_bytes;
+    _Atomic uint32_t head;              //Ranura desde la que empieza a buscar el próximo llamador, módulo n_slots
+    _Atomic uint32_t released;          //Ranuras devueltas al anillo; los llamadores sin ranura esperan sobre este futex
+    _Atomic uint32_t shutdown;          //Pedido de detener el servidor
+    _Atomic uint32_t submitted;         //Cuadros enviados; el servidor espera sobre este futex
+    struct blur_shm_slot slots[];
+};
+
+//Segmento proyectado en el proceso
+struct blur_shm {
+    struct blur_shm_header* header;
+    size_t size;
+    uint32_t n_slots;                   //Copias de la cabecera validadas al abrir el segmento
+    uint64_t slot_bytes;
+};
+
+
+static inline size_t blur_shm_round(size_t bytes){
+
+    return (bytes + BLUR_SHM_ALIGN - 1) / BLUR_SHM_ALIGN * BLUR_SHM_ALIGN;
+}
+
+
+//Bytes del segmento con n_slots ranuras de slot_bytes por buffer
+static inline size_t blur_shm_size(uint32_t n_slots, uint64_t slot_bytes){
+
+    size_t header = blur_shm_round(sizeof(struct blur_shm_header) + n_slots * sizeof(struct blur_shm_slot));
+    return header + 2 * (size_t)n_slots * blur_shm_round(slot_bytes);
+}
+
+
+//Desplazamiento desde el inicio del segmento del buffer de entrada de la ranura index; el de salida le sigue a
+//blur_shm_round(slot_bytes). Se calcula en cada lado en lugar de guardarlo en la ranura, donde cualquier proceso
+//podría cambiarlo
+static inline size_t blur_shm_input_offset(uint32_t n_slots, uint64_t slot_bytes, uint32_t index){
+
+    size_t header = blur_shm_round(sizeof(struct blur_shm_header) + n_slots * sizeof(struct blur_shm_slot));
+    return header + 2 * (size_t)index * blur_shm_round(slot_bytes);
+}
+
+
+//Completa la cabecera de un segmento recién creado de blur_shm_size(n_slots, slot_bytes) bytes
+static inline void blur_shm_init(struct blur_shm_header* header, uint32_t n_slots, uint64_t slot_bytes){
+
+    header->version = BLUR_SHM_VERSION;
+    header->n_slots = n_slots;
+    header->slot_bytes = slot_bytes;
+    atomic_init(&header->head, 0);
+    atomic_init(&header->released, 0);
+    atomic_init(&header->shutdown, 0);
+    atomic_init(&header->submitted, 0);
+
+    for(uint32_t i = 0; i < n_slots; ++i) {
+        struct blur_shm_slot* slot = &header->slots[i];
+        memset(slot, 0, sizeof(*slot));
+        atomic_init(&slot->state, BLUR_SLOT_FREE);
+    }
+
+    atomic_store(&header->magic, BLUR_SHM_MAGIC);
+}
+
+
+//Espera a que *word deje de valer expected, a lo sumo timeout_ms. Es un futex compartido entre procesos
+static inline void blur_shm_futex_wait(_Atomic uint32_t* word, uint32_t expected, long timeout_ms){
+
+    struct timespec timeout = { timeout_ms / 1000, (timeout_ms % 1000) * 1000000 };
+    syscall(SYS_futex, (uint32_t*)word, FUTEX_WAIT, expected, &timeout, NULL, 0);
+}
+
+
+static inline void blur_shm_futex_wake(_Atomic uint32_t* word){
+
+    syscall(SYS_futex, (uint32_t*)word, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+}
+
+
+//Cambia el estado de la ranura conservando su dueño; solo lo llama el lado que la tiene en su estado actual
+static inline void blur_shm_set_state(struct blur_shm_slot* slot, uint32_t state){
+
+    uint32_t word = atomic_load(&slot->state);
+    atomic_store(&slot->state, BLUR_SLOT_WORD(BLUR_SLOT_OWNER(word), state));
+    blur_shm_futex_wake(&slot->state);
+}
+
+
+//Deja la ranura libre y despierta a los llamadores que esperan una
+static inline void blur_shm_free_slot(struct blur_shm_header* header, struct blur_shm_slot* slot){
+
+    atomic_store(&slot->state, BLUR_SLOT_FREE);
+    blur_shm_futex_wake(&slot->state);
+    atomic_fetch_add(&header->released, 1);
+    blur_shm_futex_wake(&header->released);
+}
+
+
+//Proyecta el segmento name creado por el servidor. Devuelve 0 si no existe o no es de esta versión
+static inline int blur_shm_open(struct blur_shm* shm, const char* name){
+
+    struct stat st;
+    int fd = shm_open(name, O_RDWR, 0);
+
+    shm->header = NULL;
+    shm->size = 0;
+
+    if(fd < 0)
+        return 0;
+
+    if(fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(struct blur_shm_header)) {
+        void* data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if(data != MAP_FAILED) {
+            shm->header = (struct blur_shm_header*)data;
+            shm->size = st.st_size;
+        }
+    }
+
+    close(fd);
+
+    if(shm->header) {
+        shm->n_slots = shm->header->n_slots;
+        shm->slot_bytes = shm->header->slot_bytes;
+    }
+
+    if(shm->header && (atomic_load(&shm->header->magic) != BLUR_SHM_MAGIC || shm->header->version != BLUR_SHM_VERSION ||
+                       shm->n_slots == 0 || blur_shm_size(shm->n_slots, shm->slot_bytes) > shm->size)) {
+        munmap(shm->header, shm->size);
+        shm->header = NULL;
+    }
+
+    return shm->header != NULL;
+}
+
+
+static inline void blur_shm_close(struct blur_shm* shm){
+
+    munmap(shm->header, shm->size);
+    shm->header = NULL;
+}
+
+
+static inline unsigned char* blur_shm_input(const struct blur_shm* shm, uint32_t slot){
+
+    return (unsigned char*)shm->header + blur_shm_input_offset(shm->n_slots, shm->slot_bytes, slot);
+}
+
+
+static inline const unsigned char* blur_shm_output(const struct blur_shm* shm, uint32_t slot){
+
+    return blur_shm_input(shm, slot) + blur_shm_round(shm->slot_bytes);
+}
+
+
+//Toma cualquier ranura libre, recorriendo el anillo desde head para que los llamadores se repartan, y si no hay
+//ninguna espera a que se libere alguna. Un llamador lento no retiene a los que llegan después que él. Devuelve 0 si
+//el servidor se detuvo mientras tanto
+static inline int blur_shm_acquire(struct blur_shm* shm, uint32_t* slot){
+
+    struct blur_shm_header* header = shm->header;
+    uint32_t start = atomic_fetch_add(&header->head, 1);
+    uint32_t taken = BLUR_SLOT_WORD(getpid(), BLUR_SLOT_FILLING);
+
+    for(;;) {
+        //Se lee antes de recorrer el anillo: una ranura liberada después cambia el contador y la espera no se duerme
+        uint32_t released = atomic_load(&header->released);
+
+        for(uint32_t i = 0; i < shm->n_slots; ++i) {
+            uint32_t index = (start + i) % shm->n_slots;
+            uint32_t state = BLUR_SLOT_FREE;
+
+            if(atomic_compare_exchange_strong(&header->slots[index].state, &state, taken)) {
+                *slot = index;
+                return 1;
+            }
+        }
+
+        if(atomic_load(&header->shutdown))
+            return 0;
+
+        blur_shm_futex_wait(&header->released, released, BLUR_SHM_POLL_MS);
+    }
+}
+
+
+//Envía la ranura con un cuadro de width x height y channels canales ya escrito en su entrada. kernel_size, sigma y
+//engine en 0, 0.0 y NULL usan los valores con que se lanzó el servidor
+static inline void blur_shm_submit(struct blur_shm* shm, uint32_t slot, uint32_t width, uint32_t height, uint32_t channels,
+                                   uint32_t kernel_size, double sigma, const char* engine){
+
+    struct blur_shm_slot* s = &shm->header->slots[slot];
+
+    s->width = width;
+    s->height = height;
+    s->channels = channels;
+    s->kernel_size = kernel_size;
+    s->sigma = sigma;
+    s->engine[0] = '\0';
+    if(engine)
+        strncat(s->engine, engine, sizeof(s->engine) - 1);
+
+    blur_shm_set_state(s, BLUR_SLOT_READY);
+
+    atomic_fetch_add(&shm->header->submitted, 1);
+    blur_shm_futex_wake(&shm->header->submitted);
+}
+
+
+//Espera el resultado de la ranura. Devuelve 1 si la salida está lista, con el tiempo de la convolución en seconds,
+//y 0 si falló o el servidor se detuvo
+static inline int blur_shm_wait(struct blur_shm* shm, uint32_t slot, double* seconds){
+
+    struct blur_shm_slot* s = &shm->header->slots[slot];
+
+    for(;;) {
+        uint32_t word = atomic_load(&s->state);
+        uint32_t state = BLUR_SLOT_STATE(word);
+
+        if(state == BLUR_SLOT_DONE) {
+            if(seconds)
+                *seconds = s->seconds;
+            return 1;
+        }
+
+        if(state == BLUR_SLOT_FAILED || atomic_load(&shm->header->shutdown))
+            return 0;
+
+        blur_shm_futex_wait(&s->state, word, BLUR_SHM_POLL_MS);
+    }
+}
+
+
+//Devuelve la ranura al anillo una vez leída la salida
+static inline void blur_shm_release(struct blur_shm* shm, uint32_t slot){
+
+    blur_shm_free_slot(shm->header, &shm->header->slots[slot]);
+}
+
+
+//Pide al servidor que termine; las esperas de los demás llamadores devuelven 0
+static inline void blur_shm_shutdown(struct blur_shm* shm){
+
+    atomic_store(&shm->header->shutdown, 1);
+}
+
+#endif
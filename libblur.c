@@ -0,0 +1,4516 @@
+//libblur: filtro gaussiano multihilo con sus motores de convolución, el pool de hilos y el perfil del equipo.
+//La interfaz pública está en libblur.h
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <math.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <sys/stat.h>
+
+//Kernels vectorizados con selección en tiempo de ejecución (x86 con GCC o Clang)
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BLUR_X86_SIMD
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#include "libblur_internal.h"
+
+//Nombres de los conjuntos de instrucciones, modos de borde y motores en la línea de comandos
+const char* blur_simd_names[] = { "scalar", "sse4", "avx2", "avx512" };
+const char* blur_edge_names[] = { "clamp", "mirror", "wrap", "constant" };
+const char* blur_engine_names[] = { "auto", "direct", "separable", "box", "iir", "fft", "fixed" };
+
+//Bits fraccionarios de los pesos (Q0.15) y del resultado intermedio entre pasadas del motor de punto fijo.
+//Con 7 bits el intermedio (hasta 255*128) cabe en un int16 y la pasada vertical no desborda 32 bits
+#define FIXED_WEIGHT_BITS 15
+#define FIXED_INTER_BITS 7
+
+//Número de filtros de caja en cascada que aproximan la gaussiana
+#define BOX_PASSES 3
+
+//Columnas que procesa a la vez la pasada vertical del filtro recursivo (una línea de caché de floats)
+#define IIR_STRIP_WIDTH 16
+
+//Coeficientes del filtro recursivo de tercer orden de Young-van Vliet
+struct iir_coefficients {
+    double B;
+    double b1;
+    double b2;
+    double b3;
+    size_t margin;      //Muestras de arranque fuera de la línea para aplicar el modo de borde
+};
+
+//Tamaño mínimo de kernel separable a partir del cual se mide el cruce con el motor FFT
+#define FFT_MIN_KERNEL 31
+
+//Número complejo en precisión simple para el motor FFT
+typedef struct {
+    float re;
+    float im;
+} fft_complex;
+
+//Plan de una FFT de tamaño n: pares (radix, longitud restante) y twiddles directos e inversos
+#define FFT_MAX_FACTORS 32
+
+struct fft_plan {
+    size_t n;
+    int factors[2*FFT_MAX_FACTORS];
+    fft_complex* twiddles[2];
+};
+
+//Datos compartidos por los hilos del motor FFT
+struct fft_context {
+    struct fft_plan plan_x;
+    struct fft_plan plan_y;
+    size_t tile_w;              //Pixeles de entrada por mosaico
+    size_t tile_h;
+    size_t n_planes;            //Planos complejos: dos canales empacados como parte real e imaginaria
+    fft_complex* spectrum;      //FFT del kernel ya dividida por nx*ny
+    fft_complex* tile;          //Planos del mosaico actual, cada uno de ny*nx
+    float* acc;                 //Acumulador overlap-add de la imagen de salida
+};
+
+//Contadores por hilo del recorrido por mosaicos, para estimar el tráfico a memoria
+struct tile_counters {
+    size_t tiles;
+    size_t halo_rows;           //Filas de halo recalculadas en la pasada horizontal
+    size_t input_bytes;         //Bytes leídos de la imagen de entrada, incluido el halo
+    size_t output_bytes;
+    size_t scratch_bytes;       //Bytes escritos y leídos en el buffer del mosaico
+};
+
+//Alineación en bytes del inicio de cada plano y de cada fila (una línea de caché)
+#define PLANE_ALIGN 64
+
+//Planos que puede recibir un motor: con alfa, cada canal de color premultiplicado ocupa dos
+#define ENGINE_PLANES (2*MAX_PLANES - 1)
+
+//Imagen en formato planar: un plano de 8 bits por canal, con filas de stride bytes alineadas a PLANE_ALIGN.
+//Los motores trabajan sobre los planos; la conversión desde y hacia el formato entrelazado de stb se hace al
+//cargar y al escribir. Con alfa no opaco, los planos a partir de n_planes guardan la parte baja del color
+//premultiplicado (ver premultiply_alpha)
+struct planar_image {
+    unsigned char* planes[ENGINE_PLANES];
+    size_t width;
+    size_t height;
+    size_t stride;
+    size_t n_planes;
+};
+
+//Región de la imagen con el modo de borde ya aplicado; (x, y) son las coordenadas de su esquina en la imagen
+struct halo_strip {
+    unsigned char* data;
+    long x;
+    long y;
+    size_t width;
+    size_t height;
+};
+
+//Franjas de halo que usa el motor directo para los pixeles a menos de K/2 del borde
+struct halo_buffers {
+    struct halo_strip top;
+    struct halo_strip bottom;
+    struct halo_strip left;
+    struct halo_strip right;
+};
+
+//Buffer de trabajo que se conserva entre imágenes y solo crece, alineado a PLANE_ALIGN
+struct scratch_buffer {
+    void* data;
+    size_t size;
+};
+
+//Buffers propios de cada hilo para los motores: filas con relleno, buffer del mosaico, líneas de la FFT...
+#define WORKER_SCRATCH_BUFFERS 4
+
+struct worker_scratch {
+    struct scratch_buffer buffers[WORKER_SCRATCH_BUFFERS];
+};
+
+//Struct de parámetros pasados a los hilos para ejecutar la convolución
+struct convolution_args {
+
+    double** kernel;
+    unsigned char* img;
+    unsigned char* blurred_img;
+    float* blurred_sum;         //Si no es NULL, recibe también el valor filtrado sin redondear, en filas de width
+    size_t stride;              //Bytes por fila de img y blurred_img
+    size_t channels;
+    size_t blur_channels;
+    size_t kernel_size;
+    size_t width;
+    size_t height;
+    int thread_id;
+    int n_threads;
+    struct worker_scratch* scratch;
+
+    //Planos de entrada y salida; cada motor recibe en img y blurred_img el plano en curso
+    const struct planar_image* src;
+    const struct planar_image* dst;
+    float* const* sums;         //Valores sin redondear de cada plano de dst, o NULL si no se piden
+    size_t n_planes;            //Planos a filtrar, los primeros de src
+    struct tile_scheduler* scheduler;
+
+    //Tratamiento de los bordes
+    enum edge_mode edge;
+    float edge_value;
+    struct halo_buffers* halo;
+
+    //Parámetros del motor separable
+    enum blur_engine engine;
+    float* kernel_1d;
+    size_t tile_w;
+    size_t tile_h;
+    struct tile_counters* counters;
+    void (*convolve)(const float* src, float* dst, size_t n, const float* w, int taps, size_t step);
+    float* tmp;
+    pthread_barrier_t* barrier;
+
+    //Parámetros del motor de cajas
+    int box_radius[BOX_PASSES];
+    float* tmp2;
+
+    //Parámetros del filtro recursivo
+    struct iir_coefficients iir;
+
+    //Parámetros del motor FFT
+    struct fft_context* fft;
+
+    //Parámetros del motor de punto fijo
+    void (*convolve_q15)(const int16_t* src, int16_t* dst, size_t n, const int16_t* w, int taps, size_t step, int shift);
+    int16_t* kernel_q15;
+    int16_t* tmp_fixed;
+};
+
+
+//Cola de mosaicos de un hilo (deque de Chase-Lev). El dueño toma mosaicos por abajo y los demás hilos los roban
+//por arriba con un CAS, sin bloqueos. Todos los mosaicos se reparten antes de lanzar la tarea y no se agregan
+//durante ella, así que el arreglo tiene tamaño fijo
+struct tile_deque {
+    _Alignas(64) _Atomic long top;
+    _Alignas(64) _Atomic long bottom;
+    size_t* tiles;
+    size_t executed;            //Mosaicos procesados por el dueño, propios o robados
+    size_t steals;              //Mosaicos robados a otros hilos
+};
+
+//Reparto del trabajo de los motores directo y separable: cada mosaico es una banda de filas completas de un plano.
+//Los mosaicos se numeran banda por banda, así que el bloque inicial de cada hilo son filas contiguas de todos los planos
+struct tile_scheduler {
+    struct tile_deque* deques;
+    size_t* storage;
+    int* victims;               //Orden en que cada hilo intenta robar: primero los hilos de su mismo nodo
+    int n_workers;
+    size_t n_tiles;
+    size_t n_planes;
+    size_t bands;               //Bandas por plano
+    size_t rows_per_tile;
+    size_t height;
+};
+
+
+//Devuelve al menos bytes del buffer, agrandándolo si hace falta; el contenido anterior no se conserva.
+//Devuelve NULL si no hay memoria
+static void* scratch_reserve(struct scratch_buffer* b, size_t bytes){
+
+    if(bytes <= b->size)
+        return b->data;
+
+    free(b->data);
+    b->size = (bytes + PLANE_ALIGN - 1) / PLANE_ALIGN * PLANE_ALIGN;
+
+    if(posix_memalign(&b->data, PLANE_ALIGN, b->size) != 0) {
+        b->data = NULL;
+        b->size = 0;
+    }
+
+    return b->data;
+}
+
+
+static void scratch_release(struct scratch_buffer* b){
+
+    free(b->data);
+    b->data = NULL;
+    b->size = 0;
+}
+
+
+//Filas por mosaico: unas ocho bandas por hilo para repartir bien la carga, sin bajar de min_rows
+static size_t choose_rows_per_tile(size_t height, size_t n_planes, int n_workers, size_t min_rows){
+
+    size_t target = 8 * (size_t)n_workers;
+    size_t rows = (height * n_planes + target - 1) / target;
+
+    if(rows < min_rows)
+        rows = min_rows;
+
+    return rows < height ? rows : height;
+}
+
+
+//Crea las bandas de los n_planes planos y las reparte en bloques contiguos entre las colas de los hilos.
+//Se apilan en orden inverso para que cada dueño las recorra de arriba hacia abajo. worker_node, si no es NULL,
+//indica el nodo NUMA de cada hilo para que robe primero a los de su nodo. Las colas y los mosaicos se ubican
+//en scratch. Devuelve 0 si no hay memoria
+static int scheduler_init(struct tile_scheduler* s, int n_workers, size_t height, size_t n_planes, size_t rows_per_tile, const int* worker_node,
+                    struct scratch_buffer* scratch){
+
+    s->n_workers = n_workers;
+    s->height = height;
+    s->n_planes = n_planes;
+    s->rows_per_tile = rows_per_tile;
+    s->bands = (height + rows_per_tile - 1) / rows_per_tile;
+    s->n_tiles = s->bands * n_planes;
+
+    //Las colas van primero, alineadas a una línea de caché cada una
+    size_t deques_bytes = (sizeof(struct tile_deque) * n_workers + PLANE_ALIGN - 1) / PLANE_ALIGN * PLANE_ALIGN;
+    size_t victims_bytes = (sizeof(int) * n_workers * n_workers + PLANE_ALIGN - 1) / PLANE_ALIGN * PLANE_ALIGN;
+    char* data = (char*)scratch_reserve(scratch, deques_bytes + victims_bytes + sizeof(size_t) * (s->n_tiles + 1));
+
+    if(data == NULL)
+        return 0;
+
+    s->deques = (struct tile_deque*)data;
+    s->victims = (int*)(data + deques_bytes);
+    s->storage = (size_t*)(data + deques_bytes + victims_bytes);
+
+    for(int w = 0; w < n_workers; ++w) {
+
+        int* order = s->victims + w*n_workers;
+        int count = 0;
+
+        for(int pass = 0; pass < 2; ++pass)
+            for(int i = 1; i < n_workers; ++i) {
+                int v = (w + i) % n_workers;
+                int same_node = worker_node == NULL || worker_node[v] == worker_node[w];
+                if(same_node == (pass == 0))
+                    order[count++] = v;
+            }
+    }
+
+    for(int w = 0; w < n_workers; ++w) {
+
+        struct tile_deque* q = &s->deques[w];
+        size_t first = s->n_tiles * w / n_workers;
+        size_t last = s->n_tiles * (w + 1) / n_workers;
+
+        q->tiles = s->storage + first;
+        for(size_t i = 0; i < last - first; ++i)
+            q->tiles[i] = last - 1 - i;
+
+        atomic_init(&q->top, 0);
+        atomic_init(&q->bottom, (long)(last - first));
+        q->executed = 0;
+        q->steals = 0;
+    }
+
+    return 1;
+}
+
+
+//Filas que cubre el bloque inicial del hilo worker; sirve para que el primer acceso a cada página lo haga
+//el hilo que va a procesarla
+static void scheduler_worker_rows(const struct tile_scheduler* s, int worker, size_t* first_row, size_t* last_row){
+
+    size_t first = s->n_tiles * worker / s->n_workers;
+    size_t last = s->n_tiles * (worker + 1) / s->n_workers;
+
+    *first_row = first / s->n_planes * s->rows_per_tile;
+    *last_row = last == first ? *first_row : ((last - 1) / s->n_planes + 1) * s->rows_per_tile;
+
+    if(*first_row > s->height)
+        *first_row = s->height;
+    if(*last_row > s->height)
+        *last_row = s->height;
+}
+
+
+//Toma el mosaico de abajo de la cola propia
+static int deque_pop(struct tile_deque* q, size_t* tile){
+
+    long b = atomic_load_explicit(&q->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&q->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long t = atomic_load_explicit(&q->top, memory_order_relaxed);
+
+    if(t > b) {
+        atomic_store_explicit(&q->bottom, b + 1, memory_order_relaxed);
+        return 0;
+    }
+
+    *tile = q->tiles[b];
+
+    if(t == b) {
+        //Último mosaico: se disputa con los ladrones
+        int won = atomic_compare_exchange_strong_explicit(&q->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed);
+        atomic_store_explicit(&q->bottom, b + 1, memory_order_relaxed);
+        return won;
+    }
+
+    return 1;
+}
+
+
+//Roba el mosaico de arriba de la cola de otro hilo. Devuelve -1 si la cola está vacía y 0 si perdió la carrera
+static int deque_steal(struct tile_deque* q, size_t* tile){
+
+    long t = atomic_load_explicit(&q->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long b = atomic_load_explicit(&q->bottom, memory_order_acquire);
+
+    if(t >= b)
+        return -1;
+
+    *tile = q->tiles[t];
+
+    return atomic_compare_exchange_strong_explicit(&q->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed);
+}
+
+
+//Siguiente mosaico del hilo worker: primero de su cola y, cuando se vacía, robando a los demás en orden.
+//Devuelve 0 cuando no queda trabajo en ninguna cola
+static int scheduler_next(struct tile_scheduler* s, int worker, size_t* plane, size_t* first_row, size_t* last_row){
+
+    struct tile_deque* own = &s->deques[worker];
+    size_t tile;
+    int found = deque_pop(own, &tile);
+
+    while(!found) {
+
+        int pending = 0;
+
+        for(int i = 0; i < s->n_workers - 1 && !found; ++i) {
+            int result = deque_steal(&s->deques[s->victims[worker*s->n_workers + i]], &tile);
+            found = result == 1;
+            pending |= result == 0;
+        }
+
+        if(found)
+            own->steals++;
+        else if(!pending)
+            return 0;
+    }
+
+    own->executed++;
+
+    *plane = tile % s->n_planes;
+    *first_row = tile / s->n_planes * s->rows_per_tile;
+    *last_row = *first_row + s->rows_per_tile < s->height ? *first_row + s->rows_per_tile : s->height;
+
+    return 1;
+}
+
+
+//Valor filtrado truncado a un byte, saturando fuera de [0, 255]
+static inline uint8_t saturate_u8(double value){
+
+    return value <= 0.0 ? 0 : value >= 255.0 ? 255 : (uint8_t)value;
+}
+
+
+//Devuelve el índice dentro de [0, n) que corresponde a i según el modo de borde, o -1 si el modo es constante
+static inline long edge_index(long i, long n, enum edge_mode mode){
+
+    if(i >= 0 && i < n)
+        return i;
+
+    switch(mode) {
+        case EDGE_CLAMP:
+            return i < 0 ? 0 : n - 1;
+        case EDGE_WRAP:
+            return ((i % n) + n) % n;
+        case EDGE_MIRROR: {
+            //Reflejo sin repetir el pixel del borde: -1 -> 1, n -> n-2
+            if(n == 1)
+                return 0;
+            long period = 2*(n - 1);
+            i = ((i % period) + period) % period;
+            return i < n ? i : period - i;
+        }
+        default:
+            return -1;
+    }
+}
+
+
+//Copia en buf la región [bx, bx+bw) x [by, by+bh) de la imagen, que puede salirse de ella, aplicando el modo de borde
+static void fill_halo(const struct convolution_args* a, unsigned char* buf, long bx, long by, size_t bw, size_t bh){
+
+    size_t channels = a->channels;
+    unsigned char value = (unsigned char)(a->edge_value < 0.0f ? 0.0f : a->edge_value > 255.0f ? 255.0f : a->edge_value + 0.5f);
+
+    for(size_t j = 0; j < bh; ++j) {
+
+        long y = edge_index(by + (long)j, a->height, a->edge);
+
+        for(size_t i = 0; i < bw; ++i) {
+
+            long x = edge_index(bx + (long)i, a->width, a->edge);
+            unsigned char* dst = buf + (j*bw + i)*channels;
+
+            for(size_t k = 0; k < channels; ++k)
+                dst[k] = x < 0 || y < 0 ? value : a->img[y*a->stride + x*channels + k];
+        }
+    }
+}
+
+
+//Límites de las franjas de halo a lo largo de un eje de n pixeles: [0, first) y [last, n) leen de las franjas y
+//[first, last) directamente del plano. Si el kernel cubre todo el eje, first == last y todo pasa por las franjas
+static void halo_bounds(long n, long mid, long* first, long* last){
+
+    *first = mid < n ? mid : n;
+    *last = n - mid > *first ? n - mid : *first;
+}
+
+
+//Construye las franjas de halo del motor directo: arriba y abajo con el ancho completo, y a izquierda y derecha
+//con la altura de la imagen. Cada franja contiene todas las ventanas de los pixeles de salida del borde.
+//Las cuatro se ubican en scratch. Devuelve 0 si no hay memoria
+static int build_halo_buffers(const struct convolution_args* a, struct halo_buffers* h, struct scratch_buffer* scratch){
+
+    long width = a->width;
+    long height = a->height;
+    long mid = a->kernel_size/2;
+
+    long top_rows, bottom_row, left_cols, right_col;
+
+    halo_bounds(height, mid, &top_rows, &bottom_row);
+    halo_bounds(width, mid, &left_cols, &right_col);
+
+    struct halo_strip* strips[4] = { &h->top, &h->bottom, &h->left, &h->right };
+
+    h->top.x = -mid;
+    h->top.y = -mid;
+    h->top.width = width + 2*mid;
+    h->top.height = top_rows + 2*mid;
+
+    h->bottom.x = -mid;
+    h->bottom.y = bottom_row - mid;
+    h->bottom.width = width + 2*mid;
+    h->bottom.height = height - bottom_row > 0 ? height - bottom_row + 2*mid : 0;
+
+    h->left.x = -mid;
+    h->left.y = 0;
+    h->left.width = left_cols + 2*mid;
+    h->left.height = height;
+
+    h->right.x = right_col - mid;
+    h->right.y = 0;
+    h->right.width = width - right_col > 0 ? width - right_col + 2*mid : 0;
+    h->right.height = height;
+
+    size_t offsets[4];
+    size_t bytes = 0;
+
+    for(int i = 0; i < 4; ++i) {
+        offsets[i] = bytes;
+        bytes += strips[i]->width * strips[i]->height * a->channels + 1;
+    }
+
+    unsigned char* data = (unsigned char*)scratch_reserve(scratch, bytes);
+
+    if(data == NULL)
+        return 0;
+
+    for(int i = 0; i < 4; ++i) {
+        strips[i]->data = data + offsets[i];
+        fill_halo(a, strips[i]->data, strips[i]->x, strips[i]->y, strips[i]->width, strips[i]->height);
+    }
+
+    return 1;
+}
+
+
+//Convolución directa de los pixeles [x0, x1) de la fila y de un plano, leyendo de src, que contiene la región
+//del plano que empieza en (src_x, src_y) con src_stride bytes por fila. Todas las ventanas caen dentro de src,
+//así que el ciclo interno no verifica límites
+static void convolve_row_segment(const struct convolution_args* a, const unsigned char* src, long src_x, long src_y,
+                                 size_t src_stride, size_t y, size_t x0, size_t x1){
+
+    int mid_size = a->kernel_size/2;
+    double** kernel = a->kernel;
+
+    double value;
+
+    unsigned char* b_p = a->blurred_img + y*a->stride + x0;
+    float* s_p = a->blurred_sum ? a->blurred_sum + y*a->width + x0 : NULL;
+
+    for(size_t x = x0; x < x1; ++x, ++b_p) {
+
+        value = 0;
+
+        //Esquina superior izquierda de la ventana del pixel dentro de src
+        const unsigned char* window = src + ((long)y - mid_size - src_y)*(long)src_stride + ((long)x - mid_size - src_x);
+
+        //Recorrido por cada uno de los valores de la matriz del kernel
+        for(int i = 0; i < 2*mid_size + 1; ++i){
+
+            const unsigned char* target = window + i*src_stride;
+
+            //Suma de valores multiplicados
+            for(int j = 0; j < 2*mid_size + 1; ++j)
+                value += kernel[i][j] * target[j];
+        }
+
+        //Asignación del valor filtrado al plano de salida
+        *b_p = saturate_u8(value);
+        if(s_p)
+            *s_p++ = (float)value;
+    }
+}
+
+
+//Función que realiza la convolución de las bandas de filas que le entrega el planificador.
+//Cada fila se divide en el interior, que lee directamente del plano, y los bordes, que leen
+//de las franjas de halo donde ya se aplicó el modo de borde
+static void executeConvolution(struct convolution_args args){
+
+    size_t width = args.width;
+    long top_rows, bottom_row, left_cols, right_col;
+
+    //Los mismos límites con que build_halo_buffers armó las franjas
+    halo_bounds(args.height, args.kernel_size/2, &top_rows, &bottom_row);
+    halo_bounds(args.width, args.kernel_size/2, &left_cols, &right_col);
+
+    size_t plane, first_row, last_row;
+
+    while(scheduler_next(args.scheduler, args.thread_id, &plane, &first_row, &last_row)) {
+
+        struct convolution_args tile = args;
+        tile.img = args.src->planes[plane];
+        tile.blurred_img = args.dst->planes[plane];
+        tile.blurred_sum = args.sums ? args.sums[plane] : NULL;
+        const struct halo_buffers* h = args.halo + plane;
+
+        //Loop que itera sobre las filas de la banda
+        for(size_t y = first_row; y < last_row; ++y) {
+
+            if((long)y < top_rows) {
+                convolve_row_segment(&tile, h->top.data, h->top.x, h->top.y, h->top.width, y, 0, width);
+                continue;
+            }
+
+            if((long)y >= bottom_row) {
+                convolve_row_segment(&tile, h->bottom.data, h->bottom.x, h->bottom.y, h->bottom.width, y, 0, width);
+                continue;
+            }
+
+            convolve_row_segment(&tile, h->left.data, h->left.x, h->left.y, h->left.width, y, 0, left_cols);
+
+            if(left_cols < right_col)
+                convolve_row_segment(&tile, tile.img, 0, 0, args.stride, y, left_cols, right_col);
+
+            convolve_row_segment(&tile, h->right.data, h->right.x, h->right.y, h->right.width, y, right_col, width);
+        }
+    }
+}
+
+
+//Convolución 1-D: dst[i] = suma de w[t] * src[i + t*step] para t en [0, taps)
+static void convolve_1d_scalar(const float* src, float* dst, size_t n, const float* w, int taps, size_t step){
+
+    for(size_t i = 0; i < n; ++i) {
+        float acc = 0.0f;
+        for(int t = 0; t < taps; ++t)
+            acc += w[t] * src[i + t*step];
+        dst[i] = acc;
+    }
+}
+
+#ifdef BLUR_X86_SIMD
+
+//Versión SSE4.1: ocho salidas por iteración en dos registros de 4 floats
+__attribute__((target("sse4.1")))
+static void convolve_1d_sse4(const float* src, float* dst, size_t n, const float* w, int taps, size_t step){
+
+    size_t i = 0;
+
+    for(; i + 8 <= n; i += 8) {
+        __m128 acc0 = _mm_setzero_ps();
+        __m128 acc1 = _mm_setzero_ps();
+        for(int t = 0; t < taps; ++t) {
+            __m128 weight = _mm_set1_ps(w[t]);
+            const float* p = src + i + t*step;
+            acc0 = _mm_add_ps(acc0, _mm_mul_ps(weight, _mm_loadu_ps(p)));
+            acc1 = _mm_add_ps(acc1, _mm_mul_ps(weight, _mm_loadu_ps(p + 4)));
+        }
+        _mm_storeu_ps(dst + i, acc0);
+        _mm_storeu_ps(dst + i + 4, acc1);
+    }
+
+    convolve_1d_scalar(src + i, dst + i, n - i, w, taps, step);
+}
+
+
+//Versión AVX2 con FMA: dieciséis salidas por iteración en dos registros de 8 floats
+__attribute__((target("avx2,fma")))
+static void convolve_1d_avx2(const float* src, float* dst, size_t n, const float* w, int taps, size_t step){
+
+    size_t i = 0;
+
+    for(; i + 16 <= n; i += 16) {
+        __m256 acc0 = _mm256_setzero_ps();
+        __m256 acc1 = _mm256_setzero_ps();
+        for(int t = 0; t < taps; ++t) {
+            __m256 weight = _mm256_set1_ps(w[t]);
+            const float* p = src + i + t*step;
+            acc0 = _mm256_fmadd_ps(weight, _mm256_loadu_ps(p), acc0);
+            acc1 = _mm256_fmadd_ps(weight, _mm256_loadu_ps(p + 8), acc1);
+        }
+        _mm256_storeu_ps(dst + i, acc0);
+        _mm256_storeu_ps(dst + i + 8, acc1);
+    }
+
+    convolve_1d_scalar(src + i, dst + i, n - i, w, taps, step);
+}
+
+
+//Versión AVX-512: treinta y dos salidas por iteración; la cola se resuelve con cargas enmascaradas
+__attribute__((target("avx512f")))
+static void convolve_1d_avx512(const float* src, float* dst, size_t n, const float* w, int taps, size_t step){
+
+    size_t i = 0;
+
+    for(; i + 32 <= n; i += 32) {
+        __m512 acc0 = _mm512_setzero_ps();
+        __m512 acc1 = _mm512_setzero_ps();
+        for(int t = 0; t < taps; ++t) {
+            __m512 weight = _mm512_set1_ps(w[t]);
+            const float* p = src + i + t*step;
+            acc0 = _mm512_fmadd_ps(weight, _mm512_loadu_ps(p), acc0);
+            acc1 = _mm512_fmadd_ps(weight, _mm512_loadu_ps(p + 16), acc1);
+        }
+        _mm512_storeu_ps(dst + i, acc0);
+        _mm512_storeu_ps(dst + i + 16, acc1);
+    }
+
+    for(; i < n; i += 16) {
+        __mmask16 mask = n - i >= 16 ? 0xFFFF : (__mmask16)((1u << (n - i)) - 1);
+        __m512 acc = _mm512_setzero_ps();
+        for(int t = 0; t < taps; ++t)
+            acc = _mm512_fmadd_ps(_mm512_set1_ps(w[t]), _mm512_maskz_loadu_ps(mask, src + i + t*step), acc);
+        _mm512_mask_storeu_ps(dst + i, mask, acc);
+    }
+}
+
+#endif
+
+//Firma común de las convoluciones 1-D en float
+typedef void (*convolve_1d_fn)(const float* src, float* dst, size_t n, const float* w, int taps, size_t step);
+
+
+//Kernels especializados para los tamaños más usados (3, 5, 7, 9 y 15) con la sigma por defecto: los taps están
+//desenrollados y los pesos son tablas constantes que el compilador calcula al compilar. Requieren que GCC
+//evalúe __builtin_exp en inicializadores estáticos; con otros compiladores se usa siempre la ruta genérica.
+#if defined(__GNUC__) && !defined(__clang__)
+#define BLUR_SPECIALIZED_KERNELS
+
+//Peso sin normalizar del tap x y suma de los pesos de un kernel de tamaño SIZE
+#define GAUSS_TAP(x) __builtin_exp(-(double)(x)*(x) / (2.0*DEFAULT_SIGMA*DEFAULT_SIGMA))
+#define GAUSS_SUM_3 (GAUSS_TAP(0) + 2*GAUSS_TAP(1))
+#define GAUSS_SUM_5 (GAUSS_SUM_3 + 2*GAUSS_TAP(2))
+#define GAUSS_SUM_7 (GAUSS_SUM_5 + 2*GAUSS_TAP(3))
+#define GAUSS_SUM_9 (GAUSS_SUM_7 + 2*GAUSS_TAP(4))
+#define GAUSS_SUM_15 (GAUSS_SUM_9 + 2*(GAUSS_TAP(5) + GAUSS_TAP(6) + GAUSS_TAP(7)))
+
+//Peso normalizado del tap t (0..SIZE-1) de un kernel de tamaño SIZE, igual que generate_kernel_1d
+#define GAUSS_WEIGHT(t, SIZE) ((float)(GAUSS_TAP((t) - (SIZE)/2) / GAUSS_SUM_##SIZE))
+
+//Listas de taps para desenrollar
+#define TAPS_3(T, SIZE) T(0, SIZE) T(1, SIZE) T(2, SIZE)
+#define TAPS_5(T, SIZE) TAPS_3(T, SIZE) T(3, SIZE) T(4, SIZE)
+#define TAPS_7(T, SIZE) TAPS_5(T, SIZE) T(5, SIZE) T(6, SIZE)
+#define TAPS_9(T, SIZE) TAPS_7(T, SIZE) T(7, SIZE) T(8, SIZE)
+#define TAPS_15(T, SIZE) TAPS_9(T, SIZE) T(9, SIZE) T(10, SIZE) T(11, SIZE) T(12, SIZE) T(13, SIZE) T(14, SIZE)
+
+#define GAUSS_TABLE_ENTRY(t, SIZE) GAUSS_WEIGHT(t, SIZE),
+
+static const float gauss_table_3[3] = { TAPS_3(GAUSS_TABLE_ENTRY, 3) };
+static const float gauss_table_5[5] = { TAPS_5(GAUSS_TABLE_ENTRY, 5) };
+static const float gauss_table_7[7] = { TAPS_7(GAUSS_TABLE_ENTRY, 7) };
+static const float gauss_table_9[9] = { TAPS_9(GAUSS_TABLE_ENTRY, 9) };
+static const float gauss_table_15[15] = { TAPS_15(GAUSS_TABLE_ENTRY, 15) };
+
+#define UNROLLED_TAP(t, SIZE) acc += gauss_table_##SIZE[t] * p[(t)*step];
+
+//Genera convolve_1d_k<SIZE>: taps desenrollados con pesos constantes, sin ciclo interno ni lectura de w
+#define DEFINE_SPECIALIZED_CONVOLVE(SIZE) \
+static void convolve_1d_k##SIZE(const float* src, float* dst, size_t n, const float* w, int taps, size_t step){ \
+    (void)w; \
+    (void)taps; \
+    for(size_t i = 0; i < n; ++i) { \
+        const float* p = src + i; \
+        float acc = 0.0f; \
+        TAPS_##SIZE(UNROLLED_TAP, SIZE) \
+        dst[i] = acc; \
+    } \
+}
+
+DEFINE_SPECIALIZED_CONVOLVE(3)
+DEFINE_SPECIALIZED_CONVOLVE(5)
+DEFINE_SPECIALIZED_CONVOLVE(7)
+DEFINE_SPECIALIZED_CONVOLVE(9)
+DEFINE_SPECIALIZED_CONVOLVE(15)
+
+#ifdef BLUR_X86_SIMD
+//Un tap vectorial: peso constante difundido y dos acumuladores independientes
+#define UNROLLED_TAP_VEC(t, SIZE) { \
+    VEC w_t = SET1(gauss_table_##SIZE[t]); \
+    const float* q = p + (t)*step; \
+    acc0 = MADD(w_t, LOADU(q), acc0); \
+    acc1 = MADD(w_t, LOADU(q + WIDTH), acc1); \
+}
+
+//Misma estructura que convolve_1d_<isa>, con los taps desenrollados; la cola usa la versión escalar especializada
+#define DEFINE_SPECIALIZED_CONVOLVE_VEC(SIZE, SUFFIX, ATTR) \
+ATTR static void convolve_1d_k##SIZE##SUFFIX(const float* src, float* dst, size_t n, const float* w, int taps, size_t step){ \
+    size_t i = 0; \
+    for(; i + 2*WIDTH <= n; i += 2*WIDTH) { \
+        const float* p = src + i; \
+        VEC acc0 = ZERO(); \
+        VEC acc1 = ZERO(); \
+        TAPS_##SIZE(UNROLLED_TAP_VEC, SIZE) \
+        STOREU(dst + i, acc0); \
+        STOREU(dst + i + WIDTH, acc1); \
+    } \
+    convolve_1d_k##SIZE(src + i, dst + i, n - i, w, taps, step); \
+}
+
+#define DEFINE_SPECIALIZED_SET(SUFFIX, ATTR) \
+    DEFINE_SPECIALIZED_CONVOLVE_VEC(3, SUFFIX, ATTR) \
+    DEFINE_SPECIALIZED_CONVOLVE_VEC(5, SUFFIX, ATTR) \
+    DEFINE_SPECIALIZED_CONVOLVE_VEC(7, SUFFIX, ATTR) \
+    DEFINE_SPECIALIZED_CONVOLVE_VEC(9, SUFFIX, ATTR) \
+    DEFINE_SPECIALIZED_CONVOLVE_VEC(15, SUFFIX, ATTR)
+
+#define VEC __m128
+#define WIDTH 4
+#define SET1 _mm_set1_ps
+#define ZERO _mm_setzero_ps
+#define LOADU _mm_loadu_ps
+#define STOREU _mm_storeu_ps
+#define MADD(a, b, c) _mm_add_ps(_mm_mul_ps(a, b), c)
+DEFINE_SPECIALIZED_SET(_sse4, __attribute__((target("sse4.1"))))
+#undef VEC
+#undef WIDTH
+#undef SET1
+#undef ZERO
+#undef LOADU
+#undef STOREU
+#undef MADD
+
+#define VEC __m256
+#define WIDTH 8
+#define SET1 _mm256_set1_ps
+#define ZERO _mm256_setzero_ps
+#define LOADU _mm256_loadu_ps
+#define STOREU _mm256_storeu_ps
+#define MADD _mm256_fmadd_ps
+DEFINE_SPECIALIZED_SET(_avx2, __attribute__((target("avx2,fma"))))
+#undef VEC
+#undef WIDTH
+#undef SET1
+#undef ZERO
+#undef LOADU
+#undef STOREU
+#undef MADD
+
+#define VEC __m512
+#define WIDTH 16
+#define SET1 _mm512_set1_ps
+#define ZERO _mm512_setzero_ps
+#define LOADU _mm512_loadu_ps
+#define STOREU _mm512_storeu_ps
+#define MADD _mm512_fmadd_ps
+DEFINE_SPECIALIZED_SET(_avx512, __attribute__((target("avx512f"))))
+#undef VEC
+#undef WIDTH
+#undef SET1
+#undef ZERO
+#undef LOADU
+#undef STOREU
+#undef MADD
+#endif
+
+#endif
+
+//Tamaños con kernel especializado
+static const int specialized_sizes[] = { 3, 5, 7, 9, 15 };
+
+#define N_SPECIALIZED (sizeof(specialized_sizes)/sizeof(specialized_sizes[0]))
+
+
+//Convolución 1-D en punto fijo: acumula en 32 bits y redondea una vez desplazando shift bits
+static void convolve_1d_q15_scalar(const int16_t* src, int16_t* dst, size_t n, const int16_t* w, int taps, size_t step, int shift){
+
+    int32_t round = 1 << (shift - 1);
+
+    for(size_t i = 0; i < n; ++i) {
+        int32_t acc = 0;
+        for(int t = 0; t < taps; ++t)
+            acc += (int32_t)w[t] * src[i + t*step];
+        dst[i] = (int16_t)((acc + round) >> shift);
+    }
+}
+
+#ifdef BLUR_X86_SIMD
+
+//Versión SSE4.1: pmaddwd multiplica 8 pares de int16 y suma dos taps por instrucción
+__attribute__((target("sse4.1")))
+static void convolve_1d_q15_sse4(const int16_t* src, int16_t* dst, size_t n, const int16_t* w, int taps, size_t step, int shift){
+
+    __m128i round = _mm_set1_epi32(1 << (shift - 1));
+    size_t i = 0;
+
+    for(; i + 8 <= n; i += 8) {
+        __m128i acc_lo = _mm_setzero_si128();
+        __m128i acc_hi = _mm_setzero_si128();
+
+        for(int t = 0; t < taps; t += 2) {
+            int16_t w_next = t + 1 < taps ? w[t + 1] : 0;
+            __m128i weights = _mm_set1_epi32(((int32_t)(uint16_t)w_next << 16) | (uint16_t)w[t]);
+            __m128i a = _mm_loadu_si128((const __m128i*)(src + i + t*step));
+            __m128i b = t + 1 < taps ? _mm_loadu_si128((const __m128i*)(src + i + (t + 1)*step)) : a;
+            acc_lo = _mm_add_epi32(acc_lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), weights));
+            acc_hi = _mm_add_epi32(acc_hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), weights));
+        }
+
+        acc_lo = _mm_srai_epi32(_mm_add_epi32(acc_lo, round), shift);
+        acc_hi = _mm_srai_epi32(_mm_add_epi32(acc_hi, round), shift);
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_packs_epi32(acc_lo, acc_hi));
+    }
+
+    convolve_1d_q15_scalar(src + i, dst + i, n - i, w, taps, step, shift);
+}
+
+
+//Versión AVX2: dieciséis salidas int16 por iteración, el doble de carriles que la versión float
+__attribute__((target("avx2")))
+static void convolve_1d_q15_avx2(const int16_t* src, int16_t* dst, size_t n, const int16_t* w, int taps, size_t step, int shift){
+
+    __m256i round = _mm256_set1_epi32(1 << (shift - 1));
+    size_t i = 0;
+
+    for(; i + 16 <= n; i += 16) {
+        //unpacklo/unpackhi trabajan por mitades de 128 bits: acc_lo tiene las salidas 0-3 y 8-11, acc_hi las 4-7 y 12-15
+        __m256i acc_lo = _mm256_setzero_si256();
+        __m256i acc_hi = _mm256_setzero_si256();
+
+        for(int t = 0; t < taps; t += 2) {
+            int16_t w_next = t + 1 < taps ? w[t + 1] : 0;
+            __m256i weights = _mm256_set1_epi32(((int32_t)(uint16_t)w_next << 16) | (uint16_t)w[t]);
+            __m256i a = _mm256_loadu_si256((const __m256i*)(src + i + t*step));
+            __m256i b = t + 1 < taps ? _mm256_loadu_si256((const __m256i*)(src + i + (t + 1)*step)) : a;
+            acc_lo = _mm256_add_epi32(acc_lo, _mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), weights));
+            acc_hi = _mm256_add_epi32(acc_hi, _mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), weights));
+        }
+
+        //packs también trabaja por mitades, lo que deja las dieciséis salidas en orden
+        acc_lo = _mm256_srai_epi32(_mm256_add_epi32(acc_lo, round), shift);
+        acc_hi = _mm256_srai_epi32(_mm256_add_epi32(acc_hi, round), shift);
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_packs_epi32(acc_lo, acc_hi));
+    }
+
+    convolve_1d_q15_scalar(src + i, dst + i, n - i, w, taps, step, shift);
+}
+
+#endif
+
+//Firma común de las convoluciones 1-D en punto fijo
+typedef void (*convolve_1d_q15_fn)(const int16_t* src, int16_t* dst, size_t n, const int16_t* w, int taps, size_t step, int shift);
+
+
+//Convierte n pixeles entrelazados de src en planes[0..channels); versión escalar para cualquier número de canales
+static void deinterleave_scalar(const unsigned char* src, unsigned char* const* planes, size_t channels, size_t n){
+
+    for(size_t i = 0; i < n; ++i)
+        for(size_t k = 0; k < channels; ++k)
+            planes[k][i] = src[i*channels + k];
+}
+
+
+//Inverso de deinterleave_scalar: escribe en dst los n pixeles de planes[0..channels) entrelazados
+static void interleave_scalar(unsigned char* const* planes, unsigned char* dst, size_t channels, size_t n){
+
+    for(size_t i = 0; i < n; ++i)
+        for(size_t k = 0; k < channels; ++k)
+            dst[i*channels + k] = planes[k][i];
+}
+
+typedef void (*deinterleave_fn)(const unsigned char* src, unsigned char* const* planes, size_t channels, size_t n);
+typedef void (*interleave_fn)(unsigned char* const* planes, unsigned char* dst, size_t channels, size_t n);
+
+#ifdef BLUR_X86_SIMD
+//Máscaras de pshufb para RGB: bloques de 48 bytes (16 pixeles). deinterleave_rgb_masks[c][b] lleva los bytes del
+//canal c que hay en el bloque de 16 bytes b a su posición en el plano; -1 deja un cero para combinar con OR
+static const signed char deinterleave_rgb_masks[3][3][16] = {
+    {{ 0,  3,  6,  9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+     {-1, -1, -1, -1, -1, -1,  2,  5,  8, 11, 14, -1, -1, -1, -1, -1},
+     {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  1,  4,  7, 10, 13}},
+    {{ 1,  4,  7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+     {-1, -1, -1, -1, -1,  0,  3,  6,  9, 12, 15, -1, -1, -1, -1, -1},
+     {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  2,  5,  8, 11, 14}},
+    {{ 2,  5,  8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+     {-1, -1, -1, -1, -1,  1,  4,  7, 10, 13, -1, -1, -1, -1, -1, -1},
+     {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  0,  3,  6,  9, 12, 15}}
+};
+
+//interleave_rgb_masks[b][c] coloca los bytes del plano c que van en el bloque de salida b
+static const signed char interleave_rgb_masks[3][3][16] = {
+    {{ 0, -1, -1,  1, -1, -1,  2, -1, -1,  3, -1, -1,  4, -1, -1,  5},
+     {-1,  0, -1, -1,  1, -1, -1,  2, -1, -1,  3, -1, -1,  4, -1, -1},
+     {-1, -1,  0, -1, -1,  1, -1, -1,  2, -1, -1,  3, -1, -1,  4, -1}},
+    {{-1, -1,  6, -1, -1,  7, -1, -1,  8, -1, -1,  9, -1, -1, 10, -1},
+     { 5, -1, -1,  6, -1, -1,  7, -1, -1,  8, -1, -1,  9, -1, -1, 10},
+     {-1,  5, -1, -1,  6, -1, -1,  7, -1, -1,  8, -1, -1,  9, -1, -1}},
+    {{-1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1, -1},
+     {-1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1},
+     {10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15}}
+};
+
+//Un pixel por canal: cada fila del plano es una copia de la fila de entrada
+static void copy_plane_row(const unsigned char* src, unsigned char* const* planes, size_t channels, size_t n){
+
+    (void)channels;
+    memcpy(planes[0], src, n);
+}
+
+
+static void copy_image_row(unsigned char* const* planes, unsigned char* dst, size_t channels, size_t n){
+
+    (void)channels;
+    memcpy(dst, planes[0], n);
+}
+
+
+//Gris con alfa: 8 pixeles por bloque de 16 bytes. pshufb deja el gris en la mitad baja y el alfa en la alta
+__attribute__((target("sse4.1")))
+static size_t deinterleave_ga_sse4(const unsigned char* src, unsigned char* const* planes, size_t n){
+
+    const __m128i mask = _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15);
+    size_t i = 0;
+
+    for(; i + 16 <= n; i += 16) {
+        __m128i a = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + 2*i)), mask);
+        __m128i b = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + 2*i + 16)), mask);
+        _mm_storeu_si128((__m128i*)(planes[0] + i), _mm_unpacklo_epi64(a, b));
+        _mm_storeu_si128((__m128i*)(planes[1] + i), _mm_unpackhi_epi64(a, b));
+    }
+
+    return i;
+}
+
+
+__attribute__((target("sse4.1")))
+static size_t interleave_ga_sse4(unsigned char* const* planes, unsigned char* dst, size_t n){
+
+    size_t i = 0;
+
+    for(; i + 16 <= n; i += 16) {
+        __m128i g = _mm_loadu_si128((const __m128i*)(planes[0] + i));
+        __m128i a = _mm_loadu_si128((const __m128i*)(planes[1] + i));
+        _mm_storeu_si128((__m128i*)(dst + 2*i), _mm_unpacklo_epi8(g, a));
+        _mm_storeu_si128((__m128i*)(dst + 2*i + 16), _mm_unpackhi_epi8(g, a));
+    }
+
+    return i;
+}
+
+
+__attribute__((target("sse4.1")))
+static size_t deinterleave_rgb_sse4(const unsigned char* src, unsigned char* const* planes, size_t n){
+
+    size_t i = 0;
+
+    for(; i + 16 <= n; i += 16) {
+
+        __m128i block[3];
+        for(int b = 0; b < 3; ++b)
+            block[b] = _mm_loadu_si128((const __m128i*)(src + 3*i + 16*b));
+
+        for(int c = 0; c < 3; ++c) {
+            __m128i plane = _mm_setzero_si128();
+            for(int b = 0; b < 3; ++b)
+                plane = _mm_or_si128(plane, _mm_shuffle_epi8(block[b], _mm_loadu_si128((const __m128i*)deinterleave_rgb_masks[c][b])));
+            _mm_storeu_si128((__m128i*)(planes[c] + i), plane);
+        }
+    }
+
+    return i;
+}
+
+
+__attribute__((target("sse4.1")))
+static size_t interleave_rgb_sse4(unsigned char* const* planes, unsigned char* dst, size_t n){
+
+    size_t i = 0;
+
+    for(; i + 16 <= n; i += 16) {
+
+        __m128i plane[3];
+        for(int c = 0; c < 3; ++c)
+            plane[c] = _mm_loadu_si128((const __m128i*)(planes[c] + i));
+
+        for(int b = 0; b < 3; ++b) {
+            __m128i block = _mm_setzero_si128();
+            for(int c = 0; c < 3; ++c)
+                block = _mm_or_si128(block, _mm_shuffle_epi8(plane[c], _mm_loadu_si128((const __m128i*)interleave_rgb_masks[b][c])));
+            _mm_storeu_si128((__m128i*)(dst + 3*i + 16*b), block);
+        }
+    }
+
+    return i;
+}
+
+
+//RGBA: pshufb agrupa cada canal de 4 pixeles en una palabra de 32 bits y una transposición 4x4 de palabras
+//arma los planos
+__attribute__((target("sse4.1")))
+static size_t deinterleave_rgba_sse4(const unsigned char* src, unsigned char* const* planes, size_t n){
+
+    const __m128i mask = _mm_setr_epi8(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+    size_t i = 0;
+
+    for(; i + 16 <= n; i += 16) {
+
+        __m128i v[4];
+        for(int b = 0; b < 4; ++b)
+            v[b] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + 4*i + 16*b)), mask);
+
+        __m128i t0 = _mm_unpacklo_epi32(v[0], v[1]);
+        __m128i t1 = _mm_unpacklo_epi32(v[2], v[3]);
+        __m128i t2 = _mm_unpackhi_epi32(v[0], v[1]);
+        __m128i t3 = _mm_unpackhi_epi32(v[2], v[3]);
+
+        _mm_storeu_si128((__m128i*)(planes[0] + i), _mm_unpacklo_epi64(t0, t1));
+        _mm_storeu_si128((__m128i*)(planes[1] + i), _mm_unpackhi_epi64(t0, t1));
+        _mm_storeu_si128((__m128i*)(planes[2] + i), _mm_unpacklo_epi64(t2, t3));
+        _mm_storeu_si128((__m128i*)(planes[3] + i), _mm_unpackhi_epi64(t2, t3));
+    }
+
+    return i;
+}
+
+
+__attribute__((target("sse4.1")))
+static size_t interleave_rgba_sse4(unsigned char* const* planes, unsigned char* dst, size_t n){
+
+    size_t i = 0;
+
+    for(; i + 16 <= n; i += 16) {
+
+        __m128i r = _mm_loadu_si128((const __m128i*)(planes[0] + i));
+        __m128i g = _mm_loadu_si128((const __m128i*)(planes[1] + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(planes[2] + i));
+        __m128i a = _mm_loadu_si128((const __m128i*)(planes[3] + i));
+
+        __m128i rg_lo = _mm_unpacklo_epi8(r, g);
+        __m128i rg_hi = _mm_unpackhi_epi8(r, g);
+        __m128i ba_lo = _mm_unpacklo_epi8(b, a);
+        __m128i ba_hi = _mm_unpackhi_epi8(b, a);
+
+        _mm_storeu_si128((__m128i*)(dst + 4*i), _mm_unpacklo_epi16(rg_lo, ba_lo));
+        _mm_storeu_si128((__m128i*)(dst + 4*i + 16), _mm_unpackhi_epi16(rg_lo, ba_lo));
+        _mm_storeu_si128((__m128i*)(dst + 4*i + 32), _mm_unpacklo_epi16(rg_hi, ba_hi));
+        _mm_storeu_si128((__m128i*)(dst + 4*i + 48), _mm_unpackhi_epi16(rg_hi, ba_hi));
+    }
+
+    return i;
+}
+
+
+//Versiones especializadas por número de canales; los pixeles que no completan un bloque de 16 van por la escalar
+__attribute__((target("sse4.1")))
+static void deinterleave_sse4(const unsigned char* src, unsigned char* const* planes, size_t channels, size_t n){
+
+    size_t i = 0;
+
+    switch(channels) {
+        case 1: copy_plane_row(src, planes, 1, n); return;
+        case 2: i = deinterleave_ga_sse4(src, planes, n); break;
+        case 3: i = deinterleave_rgb_sse4(src, planes, n); break;
+        case 4: i = deinterleave_rgba_sse4(src, planes, n); break;
+        default: break;
+    }
+
+    unsigned char* rest[MAX_PLANES];
+    for(size_t k = 0; k < channels; ++k)
+        rest[k] = planes[k] + i;
+
+    deinterleave_scalar(src + channels*i, rest, channels, n - i);
+}
+
+
+__attribute__((target("sse4.1")))
+static void interleave_sse4(unsigned char* const* planes, unsigned char* dst, size_t channels, size_t n){
+
+    size_t i = 0;
+
+    switch(channels) {
+        case 1: copy_image_row(planes, dst, 1, n); return;
+        case 2: i = interleave_ga_sse4(planes, dst, n); break;
+        case 3: i = interleave_rgb_sse4(planes, dst, n); break;
+        case 4: i = interleave_rgba_sse4(planes, dst, n); break;
+        default: break;
+    }
+
+    unsigned char* rest[MAX_PLANES];
+    for(size_t k = 0; k < channels; ++k)
+        rest[k] = planes[k] + i;
+
+    interleave_scalar(rest, dst + channels*i, channels, n - i);
+}
+#endif
+
+//Kernels de un nivel SIMD. Cada contexto tiene su tabla, que blur_image llena con el nivel de sus parámetros
+struct simd_kernels {
+    convolve_1d_fn convolve_1d;
+    convolve_1d_fn specialized[N_SPECIALIZED];      //En el orden de specialized_sizes; NULL si no hay
+    convolve_1d_q15_fn convolve_1d_q15;
+    deinterleave_fn deinterleave;
+    interleave_fn interleave;
+};
+
+
+//Reserva los planos de una imagen de width x height con n_planes canales; las filas quedan alineadas y con
+//relleno hasta un múltiplo de PLANE_ALIGN bytes
+static int planar_image_alloc(struct planar_image* p, size_t width, size_t height, size_t n_planes){
+
+    p->width = width;
+    p->height = height;
+    p->n_planes = n_planes;
+    p->stride = (width + PLANE_ALIGN - 1) / PLANE_ALIGN * PLANE_ALIGN;
+
+    for(size_t k = 0; k < ENGINE_PLANES; ++k)
+        p->planes[k] = NULL;
+
+    //Si falla, los planos ya reservados quedan para planar_image_free
+    for(size_t k = 0; k < n_planes; ++k)
+        if(posix_memalign((void**)&p->planes[k], PLANE_ALIGN, p->stride * height) != 0)
+            return 0;
+
+    return 1;
+}
+
+
+static void planar_image_free(struct planar_image* p){
+
+    for(size_t k = 0; k < ENGINE_PLANES; ++k)
+        free(p->planes[k]);
+}
+
+
+//Igual que planar_image_alloc, pero con los planos uno tras otro en scratch, que se agranda si hace falta
+static int planar_image_attach(struct planar_image* p, size_t width, size_t height, size_t n_planes, struct scratch_buffer* scratch){
+
+    p->width = width;
+    p->height = height;
+    p->n_planes = n_planes;
+    p->stride = (width + PLANE_ALIGN - 1) / PLANE_ALIGN * PLANE_ALIGN;
+
+    unsigned char* data = (unsigned char*)scratch_reserve(scratch, p->stride * height * n_planes);
+
+    for(size_t k = 0; k < ENGINE_PLANES; ++k)
+        p->planes[k] = data && k < n_planes ? data + k * p->stride * height : NULL;
+
+    return data != NULL;
+}
+
+
+//Separa las filas [first_row, last_row) de la imagen entrelazada de stb en los planos de p
+static void image_to_planar(const struct simd_kernels* kernels, const unsigned char* img, struct planar_image* p, size_t first_row, size_t last_row){
+
+    for(size_t y = first_row; y < last_row; ++y) {
+
+        unsigned char* rows[MAX_PLANES];
+        for(size_t k = 0; k < p->n_planes; ++k)
+            rows[k] = p->planes[k] + y*p->stride;
+
+        kernels->deinterleave(img + y*p->width*p->n_planes, rows, p->n_planes, p->width);
+    }
+}
+
+
+static inline int has_alpha(const struct planar_image* p){
+
+    return p->n_planes == 2 || p->n_planes == 4;
+}
+
+
+//Indica si el alfa (último canal) de los n pixeles entrelazados de img es opaco en toda la imagen
+static int alpha_is_opaque(const unsigned char* img, size_t n, int channels){
+
+    for(size_t i = 0; i < n; ++i)
+        if(img[i*channels + channels - 1] != 255)
+            return 0;
+
+    return 1;
+}
+
+
+//Con alfa (2 o 4 canales, el alfa es el último), multiplica los canales de color por el alfa antes de filtrar,
+//para que los pixeles transparentes no tiñan a sus vecinos. El producto, de 0 a 255*255, no cabe en un byte: se
+//guarda como 254*alto + bajo, con alto en planes[k] y bajo en planes[n_planes + k], ambos de 0 a 255. El color
+//premultiplicado es (254*alto + bajo)/255, y como 254 + 1 = 255 un borde constante v vale v en los dos planos
+static void premultiply_alpha(struct planar_image* p, size_t first_row, size_t last_row){
+
+    if(!has_alpha(p))
+        return;
+
+    size_t n_color = p->n_planes - 1;
+
+    for(size_t y = first_row; y < last_row; ++y) {
+
+        const unsigned char* alpha = p->planes[n_color] + y*p->stride;
+
+        for(size_t k = 0; k < n_color; ++k) {
+            unsigned char* high = p->planes[k] + y*p->stride;
+            unsigned char* low = p->planes[p->n_planes + k] + y*p->stride;
+            for(size_t x = 0; x < p->width; ++x) {
+                unsigned product = high[x] * alpha[x];
+                unsigned h = product >= 254u*255u ? 255u : product / 254u;
+                high[x] = (unsigned char)h;
+                low[x] = (unsigned char)(product - 254u*h);
+            }
+        }
+    }
+}
+
+
+//Inverso de premultiply_alpha sobre la imagen filtrada, cuyo alfa también quedó difuminado. Divide con los
+//valores sin redondear que dejaron los motores en sums (filas de width), así que una zona de color y alfa
+//constantes vuelve exacta aunque el alfa sea bajo
+static void unpremultiply_alpha(struct planar_image* p, float* const* sums, size_t first_row, size_t last_row){
+
+    if(!has_alpha(p))
+        return;
+
+    size_t n_color = p->n_planes - 1;
+
+    for(size_t y = first_row; y < last_row; ++y) {
+
+        const unsigned char* alpha = p->planes[n_color] + y*p->stride;
+        const float* alpha_sum = sums[n_color] + y*p->width;
+
+        for(size_t k = 0; k < n_color; ++k) {
+            const float* high = sums[k] + y*p->width;
+            const float* low = sums[p->n_planes + k] + y*p->width;
+            unsigned char* row = p->planes[k] + y*p->stride;
+            for(size_t x = 0; x < p->width; ++x)
+                row[x] = alpha[x] ? saturate_u8((254.0*high[x] + low[x]) / alpha_sum[x] + 0.5) : 0;
+        }
+    }
+}
+
+
+//Vuelve a entrelazar las filas [first_row, last_row) de los planos de p en img para escribirla con stb
+static void planar_to_image(const struct simd_kernels* kernels, const struct planar_image* p, unsigned char* img, size_t first_row, size_t last_row){
+
+    for(size_t y = first_row; y < last_row; ++y) {
+
+        unsigned char* rows[MAX_PLANES];
+        for(size_t k = 0; k < p->n_planes; ++k)
+            rows[k] = p->planes[k] + y*p->stride;
+
+        kernels->interleave(rows, img + y*p->width*p->n_planes, p->n_planes, p->width);
+    }
+}
+
+
+//Convierte a float los count pixeles de la fila src que empiezan en la columna x_begin, que puede estar fuera
+//de la imagen. Solo las columnas fuera de la imagen pasan por el modo de borde; el tramo interior se copia sin verificar
+static void load_padded_row(const struct convolution_args* a, const unsigned char* src, long x_begin, size_t count, float* dst){
+
+    size_t channels = a->channels;
+    size_t blur_channels = a->blur_channels;
+    long width = a->width;
+    long x_end = x_begin + (long)count;
+    long inner_begin = x_begin > 0 ? x_begin : 0;
+    long inner_end = x_end < width ? x_end : width;
+
+    for(long x = x_begin; x < x_end; ++x) {
+
+        if(x == inner_begin && inner_begin < inner_end) {
+            //Tramo interior
+            for(; x < inner_end; ++x)
+                for(size_t k = 0; k < blur_channels; ++k)
+                    dst[(x - x_begin)*blur_channels + k] = src[x*channels + k];
+            if(x == x_end)
+                break;
+        }
+
+        long xi = edge_index(x, width, a->edge);
+        for(size_t k = 0; k < blur_channels; ++k)
+            dst[(x - x_begin)*blur_channels + k] = xi < 0 ? a->edge_value : src[xi*channels + k];
+    }
+}
+
+
+//Igual que load_padded_row, pero para el motor de punto fijo
+static void load_padded_row_q15(const struct convolution_args* a, const unsigned char* src, long x_begin, size_t count, int16_t* dst){
+
+    size_t channels = a->channels;
+    size_t blur_channels = a->blur_channels;
+    long width = a->width;
+    long x_end = x_begin + (long)count;
+    long inner_begin = x_begin > 0 ? x_begin : 0;
+    long inner_end = x_end < width ? x_end : width;
+    int16_t value = (int16_t)(a->edge_value + 0.5f);
+
+    for(long x = x_begin; x < x_end; ++x) {
+
+        if(x == inner_begin && inner_begin < inner_end) {
+            for(; x < inner_end; ++x)
+                for(size_t k = 0; k < blur_channels; ++k)
+                    dst[(x - x_begin)*blur_channels + k] = src[x*channels + k];
+            if(x == x_end)
+                break;
+        }
+
+        long xi = edge_index(x, width, a->edge);
+        for(size_t k = 0; k < blur_channels; ++k)
+            dst[(x - x_begin)*blur_channels + k] = xi < 0 ? value : src[xi*channels + k];
+    }
+}
+
+
+//Función que realiza la convolución separable sobre las bandas de filas que le entrega el planificador,
+//recorriéndolas por mosaicos.
+//Cada mosaico calcula la pasada horizontal de sus filas más mid_size filas de halo arriba y abajo en un buffer
+//propio del hilo que cabe en caché, y de ahí hace la pasada vertical. El resultado intermedio nunca va a memoria.
+static void executeSeparableConvolution(struct convolution_args args){
+
+    size_t width = args.width;
+    size_t height = args.height;
+    size_t channels = args.channels;
+    size_t blur_channels = args.blur_channels;
+    size_t kernel_size = args.kernel_size;
+    size_t mid_size = kernel_size/2;
+
+    size_t tile_w = args.tile_w < width ? args.tile_w : width;
+    size_t tile_h = args.tile_h;
+    size_t stride = tile_w * blur_channels;
+
+    //Segmento de fila con halo a cada lado, buffer del mosaico y fila de salida, propios de cada hilo
+    float* padded_row = (float*)args.scratch->buffers[0].data;
+    float* scratch = (float*)args.scratch->buffers[1].data;
+    float* out_row = (float*)args.scratch->buffers[2].data;
+
+    struct tile_counters* counters = &args.counters[args.thread_id];
+
+    size_t plane, first_row, last_row;
+
+    while(scheduler_next(args.scheduler, args.thread_id, &plane, &first_row, &last_row)) {
+
+        const unsigned char* img = args.src->planes[plane];
+        unsigned char* blurred_img = args.dst->planes[plane];
+        float* blurred_sum = args.sums ? args.sums[plane] : NULL;
+
+        for(size_t y0 = first_row; y0 < last_row; y0 += tile_h) {
+
+            size_t th = last_row - y0 < tile_h ? last_row - y0 : tile_h;
+
+            for(size_t x0 = 0; x0 < width; x0 += tile_w) {
+
+                size_t tw = width - x0 < tile_w ? width - x0 : tile_w;
+                size_t seg_len = tw * blur_channels;
+
+                //Pasada horizontal de las filas del mosaico y su halo, con el modo de borde aplicado a filas y columnas.
+                //En modo constante, como el kernel está normalizado, una fila fuera de la imagen filtrada vale edge_value
+                for(size_t j = 0; j < th + 2*mid_size; ++j) {
+
+                    long y = edge_index((long)(y0 + j) - (long)mid_size, height, args.edge);
+                    float* dst = scratch + j*stride;
+
+                    if(y < 0) {
+                        for(size_t i = 0; i < seg_len; ++i)
+                            dst[i] = args.edge_value;
+                        continue;
+                    }
+
+                    load_padded_row(&args, img + y*args.stride, (long)x0 - (long)mid_size, tw + 2*mid_size, padded_row);
+
+                    args.convolve(padded_row, dst, seg_len, args.kernel_1d, kernel_size, blur_channels);
+
+                    counters->input_bytes += (tw + 2*mid_size) * channels;
+                    if(j < mid_size || j >= th + mid_size)
+                        counters->halo_rows++;
+                }
+
+                //Pasada vertical desde el buffer del mosaico
+                for(size_t j = 0; j < th; ++j) {
+
+                    args.convolve(scratch + j*stride, out_row, seg_len, args.kernel_1d, kernel_size, stride);
+
+                    unsigned char* b_p = blurred_img + (y0 + j)*args.stride + x0*blur_channels;
+                    for(size_t i = 0; i < seg_len; ++i)
+                        b_p[i] = saturate_u8(out_row[i]);
+
+                    if(blurred_sum)
+                        memcpy(blurred_sum + ((y0 + j)*width + x0)*blur_channels, out_row, sizeof(float) * seg_len);
+                }
+
+                counters->output_bytes += seg_len * th;
+                counters->scratch_bytes += 2 * sizeof(float) * seg_len * (th + 2*mid_size);
+                counters->tiles++;
+            }
+        }
+    }
+}
+
+
+//Función que realiza la convolución separable en punto fijo sobre el rango de filas del hilo.
+//La pasada horizontal deja un intermedio con FIXED_INTER_BITS bits fraccionarios en args.tmp_fixed.
+static void executeFixedConvolution(struct convolution_args args){
+
+    size_t width = args.width;
+    size_t height = args.height;
+    size_t blur_channels = args.blur_channels;
+    size_t kernel_size = args.kernel_size;
+    size_t mid_size = kernel_size/2;
+    size_t row_len = width * blur_channels;
+
+    size_t first_row = height * args.thread_id / args.n_threads;
+    size_t last_row = height * (args.thread_id + 1) / args.n_threads;
+
+    int16_t* padded_row = (int16_t*)args.scratch->buffers[0].data;
+    int16_t* out_row = (int16_t*)args.scratch->buffers[1].data;
+
+    int16_t* tmp = args.tmp_fixed;
+
+    //Pasada horizontal con el modo de borde aplicado a las columnas
+    for(size_t y = first_row; y < last_row; ++y) {
+
+        load_padded_row_q15(&args, args.img + y*args.stride, -(long)mid_size, width + 2*mid_size, padded_row);
+
+        args.convolve_q15(padded_row, tmp + (y + mid_size)*row_len, row_len, args.kernel_q15, kernel_size,
+                        blur_channels, FIXED_WEIGHT_BITS - FIXED_INTER_BITS);
+    }
+
+    pthread_barrier_wait(args.barrier);
+
+    //Filas de relleno de tmp: salvo en modo constante (ya rellenas), son copias de las filas filtradas que indica el modo
+    if(args.edge != EDGE_CONSTANT) {
+
+        if(args.thread_id == 0) {
+            for(size_t j = 1; j <= mid_size; ++j) {
+                long top = edge_index(-(long)j, height, args.edge);
+                long bottom = edge_index((long)(height - 1 + j), height, args.edge);
+                memcpy(tmp + (mid_size - j)*row_len, tmp + (top + mid_size)*row_len, sizeof(int16_t) * row_len);
+                memcpy(tmp + (height - 1 + j + mid_size)*row_len, tmp + (bottom + mid_size)*row_len, sizeof(int16_t) * row_len);
+            }
+        }
+
+        pthread_barrier_wait(args.barrier);
+    }
+
+    //Pasada vertical con el único redondeo a 8 bits. Si se pide el valor sin redondear, conserva los
+    //FIXED_INTER_BITS bits fraccionarios y redondea después
+    int fraction = args.blurred_sum ? FIXED_INTER_BITS : 0;
+
+    for(size_t y = first_row; y < last_row; ++y) {
+
+        args.convolve_q15(tmp + y*row_len, out_row, row_len, args.kernel_q15, kernel_size,
+                        row_len, FIXED_WEIGHT_BITS + FIXED_INTER_BITS - fraction);
+
+        if(fraction)
+            for(size_t i = 0; i < row_len; ++i) {
+                args.blurred_sum[y*row_len + i] = out_row[i] / (float)(1 << fraction);
+                out_row[i] = (int16_t)((out_row[i] + (1 << (fraction - 1))) >> fraction);
+            }
+
+        unsigned char* b_p = args.blurred_img + y*args.stride;
+        for(size_t i = 0; i < row_len; ++i)
+            b_p[i] = (uint8_t)(out_row[i] > 255 ? 255 : out_row[i] < 0 ? 0 : out_row[i]);
+    }
+}
+
+
+//Filtro de caja de radio r sobre una línea de n elementos separados por step, usando una suma acumulada.
+//Fuera de la línea se aplica el modo de borde (value en modo constante).
+static void box_blur_line(const float* in, float* out, size_t n, size_t step, int r, enum edge_mode mode, float value){
+
+    float inv = 1.0f / (2*r + 1);
+    float acc = 0.0f;
+
+    #define BOX_SAMPLE(i) ((i) >= 0 && (i) < (long)n ? in[(i)*step] : \
+                           edge_index((i), n, mode) < 0 ? value : in[edge_index((i), n, mode)*step])
+
+    for(long i = -r; i <= r; ++i)
+        acc += BOX_SAMPLE(i);
+
+    for(long i = 0; i < (long)n; ++i) {
+        out[i*step] = acc * inv;
+        acc += BOX_SAMPLE(i + r + 1) - BOX_SAMPLE(i - r);
+    }
+
+    #undef BOX_SAMPLE
+}
+
+
+//Fila y de una imagen de rows filas según el modo de borde, o NULL si cae fuera en modo constante
+static inline const float* box_row(const float* in, long y, size_t rows, size_t row_len, enum edge_mode mode){
+
+    long yi = edge_index(y, rows, mode);
+    return yi < 0 ? NULL : in + yi*row_len;
+}
+
+
+//Filtro de caja vertical de radio r sobre las columnas [first_col, last_col) de una imagen de rows filas.
+//Recorre la imagen fila por fila manteniendo una suma acumulada por columna en acc.
+static void box_blur_columns(const float* in, float* out, size_t rows, size_t row_len,
+                             size_t first_col, size_t last_col, int r, enum edge_mode mode, float value, float* acc){
+
+    float inv = 1.0f / (2*r + 1);
+
+    for(size_t c = first_col; c < last_col; ++c)
+        acc[c] = 0.0f;
+
+    for(long y = -r; y <= r; ++y) {
+        const float* row = box_row(in, y, rows, row_len, mode);
+        for(size_t c = first_col; c < last_col; ++c)
+            acc[c] += row ? row[c] : value;
+    }
+
+    for(long y = 0; y < (long)rows; ++y) {
+
+        const float* in_row = box_row(in, y + r + 1, rows, row_len, mode);
+        const float* out_row = box_row(in, y - r, rows, row_len, mode);
+
+        for(size_t c = first_col; c < last_col; ++c) {
+            out[y*row_len + c] = acc[c] * inv;
+            acc[c] += (in_row ? in_row[c] : value) - (out_row ? out_row[c] : value);
+        }
+    }
+}
+
+
+//Función que aproxima la convolución gaussiana con BOX_PASSES filtros de caja en cada dirección.
+//El costo por pixel no depende del tamaño del kernel.
+static void executeBoxConvolution(struct convolution_args args){
+
+    size_t width = args.width;
+    size_t height = args.height;
+    size_t channels = args.channels;
+    size_t blur_channels = args.blur_channels;
+    size_t row_len = width * blur_channels;
+
+    //Las pasadas horizontales se reparten por filas y las verticales por columnas
+    size_t first_row = height * args.thread_id / args.n_threads;
+    size_t last_row = height * (args.thread_id + 1) / args.n_threads;
+    size_t first_col = row_len * args.thread_id / args.n_threads;
+    size_t last_col = row_len * (args.thread_id + 1) / args.n_threads;
+
+    float* line_a = (float*)args.scratch->buffers[0].data;
+    float* line_b = (float*)args.scratch->buffers[1].data;
+    float* acc = (float*)args.scratch->buffers[2].data;
+
+    //Pasadas horizontales: las tres cajas se aplican sobre la fila antes de guardarla en tmp
+    for(size_t y = first_row; y < last_row; ++y) {
+
+        unsigned char* src = args.img + y*args.stride;
+
+        for(size_t x = 0; x < width; ++x)
+            for(size_t k = 0; k < blur_channels; ++k)
+                line_a[x*blur_channels + k] = src[x*channels + k];
+
+        for(size_t k = 0; k < blur_channels; ++k) {
+            box_blur_line(line_a + k, line_b + k, width, blur_channels, args.box_radius[0], args.edge, args.edge_value);
+            box_blur_line(line_b + k, line_a + k, width, blur_channels, args.box_radius[1], args.edge, args.edge_value);
+            box_blur_line(line_a + k, args.tmp + y*row_len + k, width, blur_channels, args.box_radius[2], args.edge, args.edge_value);
+        }
+    }
+
+    pthread_barrier_wait(args.barrier);
+
+    //Pasadas verticales sobre las columnas del hilo, alternando entre tmp y tmp2
+    box_blur_columns(args.tmp, args.tmp2, height, row_len, first_col, last_col, args.box_radius[0], args.edge, args.edge_value, acc);
+    box_blur_columns(args.tmp2, args.tmp, height, row_len, first_col, last_col, args.box_radius[1], args.edge, args.edge_value, acc);
+    box_blur_columns(args.tmp, args.tmp2, height, row_len, first_col, last_col, args.box_radius[2], args.edge, args.edge_value, acc);
+
+    for(size_t y = 0; y < height; ++y)
+        for(size_t c = first_col; c < last_col; ++c)
+            args.blurred_img[y*args.stride + c] = saturate_u8(args.tmp2[y*row_len + c]);
+
+    if(args.blurred_sum)
+        for(size_t y = 0; y < height; ++y)
+            memcpy(args.blurred_sum + y*row_len + first_col, args.tmp2 + y*row_len + first_col, sizeof(float) * (last_col - first_col));
+}
+
+
+//Pasadas causal y anticausal del filtro recursivo sobre una línea de n elementos separados por step.
+//La línea se extiende margin muestras a cada lado según el modo de borde para que el filtro arranque
+//en régimen; w debe tener espacio para n + 2*margin valores.
+static void iir_filter_line(float* line, double* w, size_t n, size_t step, const struct iir_coefficients* c,
+                            enum edge_mode mode, float edge_value){
+
+    long margin = c->margin;
+
+    #define IIR_SAMPLE(i) ((i) >= 0 && (i) < (long)n ? line[(i)*step] : \
+                           edge_index((i), n, mode) < 0 ? edge_value : line[edge_index((i), n, mode)*step])
+
+    //Pasada causal, arrancando en régimen con la primera muestra extendida
+    double w1 = IIR_SAMPLE(-margin), w2 = w1, w3 = w1;
+    for(long i = -margin; i < (long)n + margin; ++i) {
+        double value = c->B * IIR_SAMPLE(i) + c->b1 * w1 + c->b2 * w2 + c->b3 * w3;
+        w3 = w2;
+        w2 = w1;
+        w1 = value;
+        w[i + margin] = value;
+    }
+
+    #undef IIR_SAMPLE
+
+    //Pasada anticausal desde el final de la extensión
+    double y1 = w[n + 2*margin - 1], y2 = y1, y3 = y1;
+    for(long i = (long)n + margin; i-- > 0; ) {
+        double value = c->B * w[i + margin] + c->b1 * y1 + c->b2 * y2 + c->b3 * y3;
+        y3 = y2;
+        y2 = y1;
+        y1 = value;
+        if(i < (long)n)
+            line[i*step] = (float)value;
+    }
+}
+
+
+//Un paso del filtro recursivo sobre las columnas de una franja; state guarda las tres salidas anteriores
+static inline double iir_step(const struct iir_coefficients* c, double (*state)[IIR_STRIP_WIDTH], size_t j, double input){
+
+    double value = c->B * input + c->b1 * state[0][j] + c->b2 * state[1][j] + c->b3 * state[2][j];
+    state[2][j] = state[1][j];
+    state[1][j] = state[0][j];
+    state[0][j] = value;
+    return value;
+}
+
+
+//Función que aplica el filtro gaussiano recursivo. Las filas se reparten entre los hilos y las columnas
+//se procesan en franjas de IIR_STRIP_WIDTH para que la pasada vertical recorra memoria contigua.
+static void executeIIRConvolution(struct convolution_args args){
+
+    size_t width = args.width;
+    size_t height = args.height;
+    size_t channels = args.channels;
+    size_t blur_channels = args.blur_channels;
+    size_t row_len = width * blur_channels;
+    const struct iir_coefficients* c = &args.iir;
+    size_t margin = c->margin;
+
+    size_t first_row = height * args.thread_id / args.n_threads;
+    size_t last_row = height * (args.thread_id + 1) / args.n_threads;
+
+    size_t n_strips = (row_len + IIR_STRIP_WIDTH - 1) / IIR_STRIP_WIDTH;
+    size_t first_strip = n_strips * args.thread_id / args.n_threads;
+    size_t last_strip = n_strips * (args.thread_id + 1) / args.n_threads;
+
+    double* w = (double*)args.scratch->buffers[0].data;
+
+    //Filas de la extensión vertical de la franja: se copian antes de que la pasada causal sobrescriba tmp
+    float (*prefix)[IIR_STRIP_WIDTH] = args.scratch->buffers[1].data;
+    float (*suffix)[IIR_STRIP_WIDTH] = args.scratch->buffers[2].data;
+    double (*suffix_w)[IIR_STRIP_WIDTH] = args.scratch->buffers[3].data;
+
+    //Pasada horizontal, en el lugar sobre cada fila de tmp
+    for(size_t y = first_row; y < last_row; ++y) {
+
+        unsigned char* src = args.img + y*args.stride;
+        float* row = args.tmp + y*row_len;
+
+        for(size_t x = 0; x < width; ++x)
+            for(size_t k = 0; k < blur_channels; ++k)
+                row[x*blur_channels + k] = src[x*channels + k];
+
+        for(size_t k = 0; k < blur_channels; ++k)
+            iir_filter_line(row + k, w, width, blur_channels, c, args.edge, args.edge_value);
+    }
+
+    pthread_barrier_wait(args.barrier);
+
+    //Pasada vertical por franjas: la causal baja por la imagen guardando el resultado en tmp
+    //y la anticausal sube escribiendo directamente la imagen de salida
+    double state[3][IIR_STRIP_WIDTH];
+
+    for(size_t strip = first_strip; strip < last_strip; ++strip) {
+
+        size_t col = strip * IIR_STRIP_WIDTH;
+        size_t strip_width = row_len - col < IIR_STRIP_WIDTH ? row_len - col : IIR_STRIP_WIDTH;
+
+        for(size_t m = 0; m < margin; ++m) {
+            long top = edge_index((long)m - (long)margin, height, args.edge);
+            long bottom = edge_index((long)(height + m), height, args.edge);
+            for(size_t j = 0; j < strip_width; ++j) {
+                prefix[m][j] = top < 0 ? args.edge_value : args.tmp[top*row_len + col + j];
+                suffix[m][j] = bottom < 0 ? args.edge_value : args.tmp[bottom*row_len + col + j];
+            }
+        }
+
+        //Pasada causal sobre la extensión superior, la imagen y la extensión inferior
+        for(size_t j = 0; j < strip_width; ++j)
+            state[0][j] = state[1][j] = state[2][j] = margin ? prefix[0][j] : args.tmp[col + j];
+
+        for(size_t m = 0; m < margin; ++m)
+            for(size_t j = 0; j < strip_width; ++j)
+                iir_step(c, state, j, prefix[m][j]);
+
+        for(size_t y = 0; y < height; ++y) {
+            float* p = args.tmp + y*row_len + col;
+            for(size_t j = 0; j < strip_width; ++j)
+                p[j] = (float)iir_step(c, state, j, p[j]);
+        }
+
+        for(size_t m = 0; m < margin; ++m)
+            for(size_t j = 0; j < strip_width; ++j)
+                suffix_w[m][j] = iir_step(c, state, j, suffix[m][j]);
+
+        //Pasada anticausal en sentido inverso
+        for(size_t j = 0; j < strip_width; ++j)
+            state[0][j] = state[1][j] = state[2][j] = margin ? suffix_w[margin - 1][j] : args.tmp[(height - 1)*row_len + col + j];
+
+        for(size_t m = margin; m-- > 0; )
+            for(size_t j = 0; j < strip_width; ++j)
+                iir_step(c, state, j, suffix_w[m][j]);
+
+        for(size_t y = height; y-- > 0; ) {
+            float* p = args.tmp + y*row_len + col;
+            unsigned char* b_p = args.blurred_img + y*args.stride + col;
+            float* s_p = args.blurred_sum ? args.blurred_sum + y*row_len + col : NULL;
+            for(size_t j = 0; j < strip_width; ++j) {
+                double value = iir_step(c, state, j, p[j]);
+                b_p[j] = (uint8_t)(value < 0.0 ? 0.0 : value > 255.0 ? 255.0 : value);
+                if(s_p)
+                    s_p[j] = (float)value;
+            }
+        }
+    }
+}
+  
+
+//Espera a los demás hilos; sin barrera (un solo hilo) no hace nada
+static inline void sync_threads(pthread_barrier_t* barrier){
+
+    if(barrier)
+        pthread_barrier_wait(barrier);
+}
+
+
+static inline fft_complex complex_mul(fft_complex a, fft_complex b){
+
+    fft_complex r = { a.re*b.re - a.im*b.im, a.re*b.im + a.im*b.re };
+    return r;
+}
+
+
+//Mariposa radix 2 sobre m grupos
+static void fft_butterfly_2(fft_complex* out, size_t fstride, const fft_complex* tw, size_t m){
+
+    for(size_t k = 0; k < m; ++k) {
+        fft_complex t = complex_mul(out[k + m], tw[k*fstride]);
+        out[k + m].re = out[k].re - t.re;
+        out[k + m].im = out[k].im - t.im;
+        out[k].re += t.re;
+        out[k].im += t.im;
+    }
+}
+
+
+//Mariposa radix 4 sobre m grupos; la rotación por -i o +i depende del sentido de la transformada
+static void fft_butterfly_4(fft_complex* out, size_t fstride, const fft_complex* tw, size_t m, int inverse){
+
+    for(size_t k = 0; k < m; ++k) {
+        fft_complex s0 = complex_mul(out[k + m], tw[k*fstride]);
+        fft_complex s1 = complex_mul(out[k + 2*m], tw[2*k*fstride]);
+        fft_complex s2 = complex_mul(out[k + 3*m], tw[3*k*fstride]);
+
+        fft_complex s5 = { out[k].re - s1.re, out[k].im - s1.im };
+        out[k].re += s1.re;
+        out[k].im += s1.im;
+
+        fft_complex s3 = { s0.re + s2.re, s0.im + s2.im };
+        fft_complex s4 = { s0.re - s2.re, s0.im - s2.im };
+
+        out[k + 2*m].re = out[k].re - s3.re;
+        out[k + 2*m].im = out[k].im - s3.im;
+        out[k].re += s3.re;
+        out[k].im += s3.im;
+
+        if(inverse) {
+            out[k + m].re = s5.re - s4.im;
+            out[k + m].im = s5.im + s4.re;
+            out[k + 3*m].re = s5.re + s4.im;
+            out[k + 3*m].im = s5.im - s4.re;
+        }
+        else {
+            out[k + m].re = s5.re + s4.im;
+            out[k + m].im = s5.im - s4.re;
+            out[k + 3*m].re = s5.re - s4.im;
+            out[k + 3*m].im = s5.im + s4.re;
+        }
+    }
+}
+
+
+//Mariposa de radix p arbitrario (3, 5 y demás factores de los tamaños mixtos)
+static void fft_butterfly_generic(fft_complex* out, size_t fstride, const fft_complex* tw, size_t m, int p, size_t n){
+
+    fft_complex scratch[p];
+
+    for(size_t u = 0; u < m; ++u) {
+
+        for(int q = 0; q < p; ++q)
+            scratch[q] = out[u + q*m];
+
+        for(int q1 = 0; q1 < p; ++q1) {
+
+            size_t k = u + q1*m;
+            size_t tw_idx = 0;
+            out[k] = scratch[0];
+
+            for(int q = 1; q < p; ++q) {
+                tw_idx += fstride * k;
+                if(tw_idx >= n)
+                    tw_idx %= n;
+                fft_complex t = complex_mul(scratch[q], tw[tw_idx]);
+                out[k].re += t.re;
+                out[k].im += t.im;
+            }
+        }
+    }
+}
+
+
+//FFT recursiva de Cooley-Tukey de radix mixto (decimación en el tiempo, fuera de lugar)
+static void fft_work(fft_complex* out, const fft_complex* in, size_t fstride, const int* factors,
+                     const struct fft_plan* plan, int inverse){
+
+    int p = factors[0];
+    size_t m = factors[1];
+    fft_complex* out_begin = out;
+    fft_complex* out_end = out + p*m;
+
+    if(m == 1) {
+        for(; out != out_end; ++out, in += fstride)
+            *out = *in;
+    }
+    else {
+        for(; out != out_end; out += m, in += fstride)
+            fft_work(out, in, fstride*p, factors + 2, plan, inverse);
+    }
+
+    const fft_complex* tw = plan->twiddles[inverse];
+
+    switch(p) {
+        case 2: fft_butterfly_2(out_begin, fstride, tw, m); break;
+        case 4: fft_butterfly_4(out_begin, fstride, tw, m, inverse); break;
+        default: fft_butterfly_generic(out_begin, fstride, tw, m, p, plan->n); break;
+    }
+}
+
+
+//Transformada de tamaño plan->n de in hacia out (no pueden coincidir). La inversa no está normalizada
+static void fft_execute(const struct fft_plan* plan, const fft_complex* in, fft_complex* out, int inverse){
+
+    fft_work(out, in, 1, plan->factors, plan, inverse);
+}
+
+
+//Procesa un mosaico de la imagen con origen (ox, oy) en el dominio con relleno, en tres fases separadas por barreras:
+//FFT de filas, FFT de columnas con producto por el espectro del kernel e IFFT, e IFFT de filas con overlap-add
+static void fft_process_tile(const struct convolution_args* a, size_t ox, size_t oy, fft_complex* line_a, fft_complex* line_b){
+
+    struct fft_context* f = a->fft;
+    size_t nx = f->plan_x.n;
+    size_t ny = f->plan_y.n;
+    size_t mid = a->kernel_size/2;
+    size_t padded_w = a->width + 2*mid;
+    size_t padded_h = a->height + 2*mid;
+    size_t blur_channels = a->blur_channels;
+
+    size_t first_row = ny * a->thread_id / a->n_threads;
+    size_t last_row = ny * (a->thread_id + 1) / a->n_threads;
+    size_t first_col = nx * a->thread_id / a->n_threads;
+    size_t last_col = nx * (a->thread_id + 1) / a->n_threads;
+
+    //Fase 1: carga de filas y FFT horizontal, con el modo de borde para los pixeles fuera de la imagen
+    for(size_t r = first_row; r < last_row; ++r) {
+
+        long y = edge_index((long)(oy + r) - (long)mid, a->height, a->edge);
+
+        for(size_t p = 0; p < f->n_planes; ++p) {
+
+            fft_complex* dst = f->tile + p*nx*ny + r*nx;
+
+            if(r >= f->tile_h || oy + r >= padded_h) {
+                memset(dst, 0, sizeof(fft_complex) * nx);
+                continue;
+            }
+
+            for(size_t x = 0; x < nx; ++x) {
+
+                long img_x = (long)(ox + x) - (long)mid;
+                float values[2] = { 0.0f, 0.0f };
+
+                if(x < f->tile_w && ox + x < padded_w) {
+                    long xi = edge_index(img_x, a->width, a->edge);
+                    for(size_t k = 2*p; k < 2*p + 2 && k < blur_channels; ++k)
+                        values[k - 2*p] = xi < 0 || y < 0 ? a->edge_value : a->src->planes[k][y*a->stride + xi];
+                }
+
+                line_a[x].re = values[0];
+                line_a[x].im = values[1];
+            }
+
+            fft_execute(&f->plan_x, line_a, dst, 0);
+        }
+    }
+
+    sync_threads(a->barrier);
+
+    //Fase 2: FFT vertical, producto por el espectro del kernel e IFFT vertical
+    for(size_t x = first_col; x < last_col; ++x) {
+        for(size_t p = 0; p < f->n_planes; ++p) {
+
+            fft_complex* plane = f->tile + p*nx*ny;
+
+            for(size_t r = 0; r < ny; ++r)
+                line_a[r] = plane[r*nx + x];
+
+            fft_execute(&f->plan_y, line_a, line_b, 0);
+
+            for(size_t r = 0; r < ny; ++r)
+                line_b[r] = complex_mul(line_b[r], f->spectrum[r*nx + x]);
+
+            fft_execute(&f->plan_y, line_b, line_a, 1);
+
+            for(size_t r = 0; r < ny; ++r)
+                plane[r*nx + x] = line_a[r];
+        }
+    }
+
+    sync_threads(a->barrier);
+
+    //Fase 3: IFFT horizontal y suma al acumulador. La salida (px, py) corresponde al índice (px + 2*mid, py + 2*mid)
+    //de la convolución lineal completa del dominio con relleno
+    for(size_t r = first_row; r < last_row; ++r) {
+
+        long py = (long)(oy + r) - 2*(long)mid;
+
+        if(py < 0 || py >= (long)a->height || r >= f->tile_h + a->kernel_size - 1)
+            continue;
+
+        for(size_t p = 0; p < f->n_planes; ++p) {
+
+            fft_execute(&f->plan_x, f->tile + p*nx*ny + r*nx, line_a, 1);
+
+            float* acc_row = f->acc + py*a->width*blur_channels;
+
+            for(size_t x = 0; x < nx && x < f->tile_w + a->kernel_size - 1; ++x) {
+
+                long px = (long)(ox + x) - 2*(long)mid;
+
+                if(px < 0 || px >= (long)a->width)
+                    continue;
+
+                acc_row[px*blur_channels + 2*p] += line_a[x].re;
+                if(2*p + 1 < blur_channels)
+                    acc_row[px*blur_channels + 2*p + 1] += line_a[x].im;
+            }
+        }
+    }
+
+    //El siguiente mosaico reutiliza los planos
+    sync_threads(a->barrier);
+}
+
+
+//Función que realiza la convolución en el dominio de la frecuencia recorriendo la imagen por mosaicos.
+//Todos los hilos colaboran en cada mosaico repartiéndose sus filas y columnas. A diferencia de los demás
+//motores procesa todos los planos a la vez, empacándolos de dos en dos en cada FFT compleja.
+static void executeFFTConvolution(struct convolution_args args){
+
+    struct fft_context* f = args.fft;
+    size_t mid = args.kernel_size/2;
+    size_t padded_w = args.width + 2*mid;
+    size_t padded_h = args.height + 2*mid;
+    size_t row_len = args.width * args.blur_channels;
+
+    size_t first_row = args.height * args.thread_id / args.n_threads;
+    size_t last_row = args.height * (args.thread_id + 1) / args.n_threads;
+
+    fft_complex* line_a = (fft_complex*)args.scratch->buffers[0].data;
+    fft_complex* line_b = (fft_complex*)args.scratch->buffers[1].data;
+
+    memset(f->acc + first_row*row_len, 0, sizeof(float) * (last_row - first_row) * row_len);
+    sync_threads(args.barrier);
+
+    for(size_t oy = 0; oy < padded_h; oy += f->tile_h)
+        for(size_t ox = 0; ox < padded_w; ox += f->tile_w)
+            fft_process_tile(&args, ox, oy, line_a, line_b);
+
+    for(size_t y = first_row; y < last_row; ++y) {
+        float* acc_row = f->acc + y*row_len;
+        for(size_t k = 0; k < args.blur_channels; ++k) {
+            unsigned char* b_p = args.dst->planes[k] + y*args.stride;
+            float* s_p = args.sums ? args.sums[k] + y*args.width : NULL;
+            for(size_t x = 0; x < args.width; ++x) {
+                float value = acc_row[x*args.blur_channels + k];
+                b_p[x] = (uint8_t)(value < 0.0f ? 0.0f : value > 255.0f ? 255.0f : value);
+                if(s_p)
+                    s_p[x] = value;
+            }
+        }
+    }
+}
+
+
+//Función para generar el kernel gaussiano con desviación estándar sigma
+static void generate_kernel(int size, double sigma, double** kernel) 
+{   
+    //Suma para normalizar el kernel después 
+    double sum = 0.0; 
+    
+    int mid = size/2;
+
+    //Generar kernel de tamaño size x size usando funcion de densidad de probabilidad de Gauss
+    for (int x = -mid; x <= mid; x++) { 
+        for (int y = -mid; y <= mid; y++) { 
+            kernel[x + mid][y + mid] = exp(-(x * x + y * y) / (2 * sigma * sigma)) / (2 * M_PI * sigma * sigma); 
+            sum += kernel[x + mid][y + mid]; 
+        } 
+    } 
+  
+    //Normalización del kernel para un efecto mas limpio en el blurring
+    for (int i = 0; i < size; ++i) 
+        for (int j = 0; j < size; ++j) 
+            kernel[i][j] /= sum; 
+} 
+
+
+//Función para generar el kernel gaussiano 1-D cuyo producto externo es el kernel 2-D
+static void generate_kernel_1d(int size, double sigma, float* kernel_1d) 
+{   
+    double sum = 0.0; 
+    double values[size];
+
+    int mid = size/2;
+
+    for (int x = -mid; x <= mid; x++) { 
+        values[x + mid] = exp(-(x * x) / (2 * sigma * sigma)); 
+        sum += values[x + mid]; 
+    } 
+
+    for (int i = 0; i < size; ++i) 
+        kernel_1d[i] = (float)(values[i] / sum); 
+} 
+
+
+//Verifica si el kernel 2-D es de rango 1, es decir, igual al producto externo del kernel 1-D
+static int kernel_is_separable(int size, double** kernel, const float* kernel_1d) 
+{   
+    for (int i = 0; i < size; ++i) 
+        for (int j = 0; j < size; ++j) 
+            if (fabs(kernel[i][j] - (double)kernel_1d[i] * kernel_1d[j]) > 1e-6 * kernel[i][j])
+                return 0;
+
+    return 1;
+}
+
+
+//Kernels ya generados, que se reutilizan entre imágenes con el mismo tamaño y sigma. Al llenarse se descarta el
+//usado hace más tiempo
+#define KERNEL_CACHE_SIZE 8
+
+struct cached_kernel {
+    size_t kernel_size;         //0 si la entrada está libre
+    double sigma;
+    double** kernel;
+    float* kernel_1d;
+    int separable;
+    unsigned long last_use;
+};
+
+
+static void cached_kernel_free(struct cached_kernel* entry)
+{
+    for(size_t i = 0; entry->kernel && i < entry->kernel_size; ++i)
+        free(entry->kernel[i]);
+    free(entry->kernel);
+    free(entry->kernel_1d);
+    entry->kernel_size = 0;
+}
+
+
+struct kernel_cache {
+    struct cached_kernel entries[KERNEL_CACHE_SIZE];
+    unsigned long clock;
+};
+
+
+//Devuelve el kernel de tamaño kernel_size y desviación sigma, generándolo si no estaba. hit queda en 1 si ya estaba.
+//NULL si no hay memoria para generarlo
+static const struct cached_kernel* get_cached_kernel(struct kernel_cache* cache, size_t kernel_size, double sigma, int* hit)
+{
+    struct cached_kernel* slot = &cache->entries[0];
+
+    for(size_t i = 0; i < KERNEL_CACHE_SIZE; ++i) {
+
+        struct cached_kernel* entry = &cache->entries[i];
+
+        if(entry->kernel_size == kernel_size && entry->sigma == sigma) {
+            entry->last_use = ++cache->clock;
+            *hit = 1;
+            return entry;
+        }
+
+        if(entry->kernel_size == 0 || (slot->kernel_size != 0 && entry->last_use < slot->last_use))
+            slot = entry;
+    }
+
+    if(slot->kernel_size != 0)
+        cached_kernel_free(slot);
+
+    slot->kernel_size = kernel_size;
+    slot->sigma = sigma;
+    slot->kernel = (double**)calloc(kernel_size, sizeof(double*));
+    slot->kernel_1d = (float*)malloc(sizeof(float) * kernel_size);
+
+    int allocated = slot->kernel != NULL && slot->kernel_1d != NULL;
+    for(size_t i = 0; i < kernel_size && allocated; ++i)
+        allocated = (slot->kernel[i] = (double*)malloc(sizeof(double) * kernel_size)) != NULL;
+
+    if(!allocated) {
+        cached_kernel_free(slot);
+        return NULL;
+    }
+
+    generate_kernel(kernel_size, sigma, slot->kernel);
+    generate_kernel_1d(kernel_size, sigma, slot->kernel_1d);
+    slot->separable = kernel_is_separable(kernel_size, slot->kernel, slot->kernel_1d);
+    slot->last_use = ++cache->clock;
+
+    *hit = 0;
+    return slot;
+}
+
+
+static void kernel_cache_free(struct kernel_cache* cache)
+{
+    for(size_t i = 0; i < KERNEL_CACHE_SIZE; ++i)
+        if(cache->entries[i].kernel_size != 0)
+            cached_kernel_free(&cache->entries[i]);
+}
+
+
+//Elige el mosaico del motor separable para que su buffer (tile_h + 2*mid filas de tile_w pixeles en float)
+//ocupe a lo sumo la mitad de la parte de la caché L2 que le toca a su hilo, si l2_sharers hilos la comparten.
+//Prefiere mosaicos anchos y los angosta solo si el halo superaría a las filas útiles.
+static void choose_separable_tile(size_t kernel_size, size_t width, size_t height, int l2_sharers, size_t* tile_w, size_t* tile_h) 
+{   
+    long l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    if (l2 <= 0) 
+        l2 = 1 << 20;
+
+    size_t budget = (size_t)l2 / 2 / (l2_sharers > 1 ? l2_sharers : 1);
+    size_t mid = kernel_size / 2;
+    size_t w = width < 1024 ? width : 1024;
+    size_t rows = budget / (w * sizeof(float));
+
+    while (w > 64 && rows < 4 * mid) {
+        w /= 2;
+        rows = budget / (w * sizeof(float));
+    }
+
+    size_t h = rows > 2 * mid + 8 ? rows - 2 * mid : 8;
+
+    *tile_w = w;
+    *tile_h = h < height ? h : height;
+} 
+
+
+//Cuantiza el kernel 1-D a Q0.15 de modo que los pesos sumen exactamente 1.0 (1 << FIXED_WEIGHT_BITS).
+//Reparte las unidades que faltan tras truncar entre los pesos con mayor residuo. Un peso de 1.0 (kernel de 1,
+//o sigma tan pequeño que el kernel es un impulso) no cabe en un int16: se satura a INT16_MAX y el resto pasa al
+//vecino. Con kernel de 1 no hay vecino y la suma queda en 1 - 2^-15, que tras el redondeo final sigue copiando
+//cada byte tal cual. Devuelve 0 si algún peso no está en [0, 1], lo que solo pasa con un kernel no finito.
+static int quantize_kernel_q15(int size, const float* kernel_1d, int16_t* kernel_q15) 
+{   
+    const int32_t one = 1 << FIXED_WEIGHT_BITS;
+    int32_t values[size];
+    double residues[size];
+    int32_t sum = 0;
+
+    for (int i = 0; i < size; ++i) 
+        if (!(kernel_1d[i] >= 0.0f && kernel_1d[i] <= 1.0f)) 
+            return 0;
+
+    for (int i = 0; i < size; ++i) {
+        double scaled = kernel_1d[i] * (double)one;
+        values[i] = (int32_t)floor(scaled);
+        residues[i] = scaled - values[i];
+        sum += values[i];
+    }
+
+    while (sum < one) {
+        int best = 0;
+        for (int i = 1; i < size; ++i) 
+            if (residues[i] > residues[best]) 
+                best = i;
+        values[best]++;
+        residues[best] = -1.0;
+        sum++;
+    }
+
+    for (int i = 0; i < size; ++i) {
+        if (values[i] > INT16_MAX) {
+            if (size > 1)
+                values[i + 1 < size ? i + 1 : i - 1] += values[i] - INT16_MAX;
+            values[i] = INT16_MAX;
+        }
+    }
+
+    for (int i = 0; i < size; ++i)
+        kernel_q15[i] = (int16_t)values[i];
+
+    return 1;
+} 
+
+
+//Cota de la desviación, en niveles de intensidad, del motor de punto fijo frente a la convolución en double con
+//el kernel 2-D exacto. Suma el error de cuantización de los pesos, el redondeo del intermedio y el redondeo final.
+static double fixed_deviation_bound(int size, double** kernel, const int16_t* kernel_q15, double* quantization) 
+{   
+    const double one = 1 << FIXED_WEIGHT_BITS;
+
+    *quantization = 0.0;
+    for (int i = 0; i < size; ++i) 
+        for (int j = 0; j < size; ++j) 
+            *quantization += fabs(kernel_q15[i] / one * kernel_q15[j] / one - kernel[i][j]);
+    *quantization *= 255.0;
+
+    return *quantization + 0.5 / (1 << FIXED_INTER_BITS) + 0.5;
+} 
+
+
+//Calcula los coeficientes del filtro recursivo de Young-van Vliet para sigma >= 0.5.
+//Ya vienen divididos por b0 para que cada pasada sea y[n] = B*x[n] + b1*y[n-1] + b2*y[n-2] + b3*y[n-3].
+static void compute_iir_coefficients(double sigma, struct iir_coefficients* c) 
+{   
+    double q = sigma >= 2.5 ? 0.98711 * sigma - 0.96330 : 3.97156 - 4.14554 * sqrt(1.0 - 0.26891 * sigma);
+    double q2 = q * q;
+    double q3 = q2 * q;
+
+    double b0 = 1.57825 + 2.44413 * q + 1.4281 * q2 + 0.422205 * q3;
+
+    c->b1 = (2.44413 * q + 2.85619 * q2 + 1.26661 * q3) / b0;
+    c->b2 = -(1.4281 * q2 + 1.26661 * q3) / b0;
+    c->b3 = 0.422205 * q3 / b0;
+    c->B = 1.0 - (c->b1 + c->b2 + c->b3);
+
+    //La respuesta al impulso es despreciable más allá de 3 sigma
+    c->margin = (size_t)ceil(3.0 * sigma);
+} 
+
+
+//Calcula los radios de las cajas cuya cascada tiene la misma varianza que el kernel 1-D.
+//Como el kernel está truncado a size elementos, su varianza puede ser menor que sigma².
+static void compute_box_radii(int size, const float* kernel_1d, int* radii) 
+{   
+    int mid = size/2;
+    double variance = 0.0;
+
+    for (int x = -mid; x <= mid; x++) 
+        variance += x * x * (double)kernel_1d[x + mid]; 
+
+    //Ancho ideal de caja y los dos anchos impares más cercanos
+    double w_ideal = sqrt(12.0 * variance / BOX_PASSES + 1.0);
+    int w_low = (int)floor(w_ideal);
+    if (w_low % 2 == 0) 
+        w_low--;
+    int w_up = w_low + 2;
+
+    //Cantidad de cajas que usan el ancho menor para ajustar la varianza
+    int m = (int)round((12.0 * variance - BOX_PASSES * w_low * w_low - 4.0 * BOX_PASSES * w_low - 3.0 * BOX_PASSES) / (-4.0 * w_low - 4.0));
+
+    for (int i = 0; i < BOX_PASSES; ++i) 
+        radii[i] = ((i < m ? w_low : w_up) - 1) / 2; 
+} 
+
+
+//Calcula el error máximo entre el kernel 2-D exacto y el equivalente de la cascada de cajas.
+//En sum_error devuelve la suma de errores absolutos, que acota el error por pixel en unidades de intensidad.
+static double box_cascade_error(int size, double** kernel, const int* radii, double* sum_error) 
+{   
+    //Respuesta al impulso 1-D de la cascada
+    int support = 1;
+    for (int i = 0; i < BOX_PASSES; ++i) 
+        support += 2 * radii[i];
+
+    double response[support];
+    double next[support];
+
+    for (int i = 0; i < support; ++i) 
+        response[i] = i == support/2 ? 1.0 : 0.0;
+
+    for (int p = 0; p < BOX_PASSES; ++p) {
+        for (int i = 0; i < support; ++i) {
+            next[i] = 0.0;
+            for (int d = -radii[p]; d <= radii[p]; ++d) 
+                if (i + d >= 0 && i + d < support) 
+                    next[i] += response[i + d] / (2 * radii[p] + 1);
+        }
+        memcpy(response, next, sizeof(response));
+    }
+
+    //Comparación en el soporte común de ambos kernels
+    int half = (support > size ? support : size) / 2;
+    double max_error = 0.0;
+    *sum_error = 0.0;
+
+    for (int x = -half; x <= half; x++) { 
+        for (int y = -half; y <= half; y++) { 
+            double exact = abs(x) <= size/2 && abs(y) <= size/2 ? kernel[x + size/2][y + size/2] : 0.0;
+            double approx = abs(x) <= support/2 && abs(y) <= support/2 ? response[x + support/2] * response[y + support/2] : 0.0;
+            double error = fabs(exact - approx);
+
+            if (error > max_error) 
+                max_error = error;
+            *sum_error += error;
+        } 
+    } 
+
+    return max_error;
+} 
+
+
+//Detecta con CPUID el conjunto de instrucciones más ancho que soportan la CPU y el sistema operativo
+enum simd_level blur_detect_simd_level(void) 
+{   
+#ifdef BLUR_X86_SIMD
+    unsigned int eax, ebx, ecx, edx;
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) 
+        return SIMD_SCALAR;
+
+    int sse4 = (ecx >> 19) & 1;
+    int fma = (ecx >> 12) & 1;
+    int osxsave = (ecx >> 27) & 1;
+
+    if (!sse4) 
+        return SIMD_SCALAR;
+
+    //Los registros AVX solo se pueden usar si el sistema operativo los guarda en los cambios de contexto
+    unsigned long long xcr0 = 0;
+    if (osxsave) {
+        unsigned int lo, hi;
+        __asm__ __volatile__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+        xcr0 = ((unsigned long long)hi << 32) | lo;
+    }
+
+    if (__get_cpuid_max(0, NULL) < 7 || (xcr0 & 0x6) != 0x6) 
+        return SIMD_SSE4;
+
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+
+    int avx2 = (ebx >> 5) & 1;
+    int avx512f = (ebx >> 16) & 1;
+
+    if (avx512f && (xcr0 & 0xE6) == 0xE6) 
+        return SIMD_AVX512;
+
+    if (avx2 && fma) 
+        return SIMD_AVX2;
+
+    return SIMD_SSE4;
+#else
+    return SIMD_SCALAR;
+#endif
+} 
+
+
+//Llena k con las implementaciones de la convolución 1-D y de la conversión entre formatos para el nivel dado
+static void simd_kernels_init(struct simd_kernels* k, enum simd_level level) 
+{   
+    memset(k, 0, sizeof(*k));
+    k->convolve_1d = convolve_1d_scalar;
+    k->convolve_1d_q15 = convolve_1d_q15_scalar;
+    k->deinterleave = deinterleave_scalar;
+    k->interleave = interleave_scalar;
+
+    //Kernels especializados: la versión compilada para el conjunto de instrucciones más ancho disponible
+#ifdef BLUR_SPECIALIZED_KERNELS
+    convolve_1d_fn specialized[N_SPECIALIZED] = { convolve_1d_k3, convolve_1d_k5, convolve_1d_k7, convolve_1d_k9, convolve_1d_k15 };
+#ifdef BLUR_X86_SIMD
+    convolve_1d_fn specialized_sse4[N_SPECIALIZED] = { convolve_1d_k3_sse4, convolve_1d_k5_sse4, convolve_1d_k7_sse4, convolve_1d_k9_sse4, convolve_1d_k15_sse4 };
+    convolve_1d_fn specialized_avx2[N_SPECIALIZED] = { convolve_1d_k3_avx2, convolve_1d_k5_avx2, convolve_1d_k7_avx2, convolve_1d_k9_avx2, convolve_1d_k15_avx2 };
+    convolve_1d_fn specialized_avx512[N_SPECIALIZED] = { convolve_1d_k3_avx512, convolve_1d_k5_avx512, convolve_1d_k7_avx512, convolve_1d_k9_avx512, convolve_1d_k15_avx512 };
+
+    if (level == SIMD_AVX512) 
+        memcpy(specialized, specialized_avx512, sizeof(specialized));
+    else if (level == SIMD_AVX2) 
+        memcpy(specialized, specialized_avx2, sizeof(specialized));
+    else if (level == SIMD_SSE4) 
+        memcpy(specialized, specialized_sse4, sizeof(specialized));
+#endif
+    memcpy(k->specialized, specialized, sizeof(specialized));
+#endif
+
+    //La versión en punto fijo no tiene variante AVX-512 (requeriría AVX-512BW); usa la de AVX2
+#ifdef BLUR_X86_SIMD
+    switch (level) {
+        case SIMD_AVX512: k->convolve_1d = convolve_1d_avx512; k->convolve_1d_q15 = convolve_1d_q15_avx2; break;
+        case SIMD_AVX2: k->convolve_1d = convolve_1d_avx2; k->convolve_1d_q15 = convolve_1d_q15_avx2; break;
+        case SIMD_SSE4: k->convolve_1d = convolve_1d_sse4; k->convolve_1d_q15 = convolve_1d_q15_sse4; break;
+        default: break;
+    }
+
+    //La conversión entre formatos solo mueve bytes; la versión de 128 bits basta para todos los niveles
+    if (level != SIMD_SCALAR) {
+        k->deinterleave = deinterleave_sse4;
+        k->interleave = interleave_sse4;
+    }
+#endif
+} 
+
+
+double blur_wall_time(void) 
+{   
+    struct timeval t;
+    gettimeofday(&t, NULL);
+    return t.tv_sec + t.tv_usec / 1e6;
+} 
+
+
+//Devuelve la convolución 1-D para un kernel de tamaño kernel_size y desviación sigma: la especializada si existe
+//para ese tamaño y sigma es la de las tablas, o la genérica en otro caso
+static convolve_1d_fn select_convolve_1d(const struct simd_kernels* k, int kernel_size, double sigma) 
+{   
+    if (sigma != DEFAULT_SIGMA) 
+        return k->convolve_1d;
+
+    for (size_t i = 0; i < N_SPECIALIZED; ++i) 
+        if (specialized_sizes[i] == kernel_size && k->specialized[i]) 
+            return k->specialized[i];
+
+    return k->convolve_1d;
+} 
+
+
+//Compara el tiempo de cada kernel especializado con el de la ruta genérica sobre filas sintéticas,
+//tanto con paso 3 (pasada horizontal sobre RGB) como con paso de fila (pasada vertical), con los kernels de level
+void blur_benchmark_kernels(enum simd_level level) 
+{   
+    struct simd_kernels k;
+    simd_kernels_init(&k, level);
+
+    const size_t n = 3 * 1920;
+    const size_t rows = 64;
+
+    float* src = (float*)malloc(sizeof(float) * n * (rows + 16));
+    float* dst = (float*)malloc(sizeof(float) * n);
+
+    if (src == NULL || dst == NULL) {
+        perror("Error reservando memoria para el benchmark!\n");
+        free(src);
+        free(dst);
+        return;
+    }
+
+    for (size_t i = 0; i < n * (rows + 16); ++i) 
+        src[i] = (float)(i % 251);
+
+    printf("\n%-8s %-10s %14s %14s %10s\n", "kernel", "pasada", "generico (ns)", "especial. (ns)", "speedup");
+
+    for (size_t s = 0; s < N_SPECIALIZED; ++s) {
+
+        int size = specialized_sizes[s];
+        float weights[size];
+        generate_kernel_1d(size, DEFAULT_SIGMA, weights);
+
+        convolve_1d_fn variants[2] = { k.convolve_1d, select_convolve_1d(&k, size, DEFAULT_SIGMA) };
+
+        for (int pass = 0; pass < 2; ++pass) {
+
+            size_t step = pass == 0 ? 3 : n;
+            double best[2] = { 1e30, 1e30 };
+
+            for (int v = 0; v < 2; ++v) {
+                for (int rep = 0; rep < 20; ++rep) {
+                    double start = blur_wall_time();
+                    for (size_t r = 0; r < rows; ++r) 
+                        variants[v](src + (pass == 0 ? r * n : r), dst, pass == 0 ? n - 3 * (size - 1) : n, weights, size, step);
+                    double elapsed = blur_wall_time() - start;
+                    if (elapsed < best[v]) 
+                        best[v] = elapsed;
+                }
+            }
+
+            printf("%-8d %-10s %14.0f %14.0f %9.2fx%s\n", size, pass == 0 ? "horizontal" : "vertical",
+                   best[0] * 1e9, best[1] * 1e9, best[0] / best[1], variants[1] == k.convolve_1d ? " (sin especializar)" : "");
+        }
+    }
+
+    free(src);
+    free(dst);
+} 
+
+
+//Prepara el plan de una FFT de tamaño n: factoriza n priorizando radix 4 y 2, y calcula los twiddles
+//Devuelve 0 si no hay memoria para las tablas de giros
+static int fft_plan_init(struct fft_plan* plan, size_t n) 
+{   
+    plan->n = n;
+    plan->twiddles[0] = (fft_complex*)malloc(sizeof(fft_complex) * n);
+    plan->twiddles[1] = (fft_complex*)malloc(sizeof(fft_complex) * n);
+
+    if (plan->twiddles[0] == NULL || plan->twiddles[1] == NULL) 
+        return 0;
+
+    size_t remaining = n;
+    size_t p = 4;
+    int i = 0;
+
+    do {
+        while (remaining % p) {
+            p = p == 4 ? 2 : p == 2 ? 3 : p + 2;
+            if (p * p > remaining) 
+                p = remaining;
+        }
+        remaining /= p;
+        plan->factors[i++] = (int)p;
+        plan->factors[i++] = (int)remaining;
+    } while (remaining > 1);
+
+    for (int inverse = 0; inverse < 2; ++inverse) {
+        for (size_t k = 0; k < n; ++k) {
+            double phase = (inverse ? 2.0 : -2.0) * M_PI * k / n;
+            plan->twiddles[inverse][k].re = (float)cos(phase);
+            plan->twiddles[inverse][k].im = (float)sin(phase);
+        }
+    }
+
+    return 1;
+} 
+
+
+static void fft_plan_free(struct fft_plan* plan) 
+{   
+    free(plan->twiddles[0]);
+    free(plan->twiddles[1]);
+} 
+
+
+//Menor tamaño >= n cuyos únicos factores primos son 2, 3 y 5
+static size_t fft_nice_size(size_t n) 
+{   
+    for (;; ++n) {
+        size_t m = n;
+        while (m % 2 == 0) m /= 2;
+        while (m % 3 == 0) m /= 3;
+        while (m % 5 == 0) m /= 5;
+        if (m == 1) 
+            return n;
+    }
+} 
+
+
+//Tamaño de FFT por dimensión. El mosaico base es el mayor cuyos planos caben en la caché L2 y al menos
+//cuatro veces el kernel, para que el solapamiento no domine; si la imagen con relleno cabe en menos, se usa un único mosaico ajustado a ella
+static size_t fft_choose_size(size_t kernel_size, size_t padded) 
+{   
+    long l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    if (l2 <= 0) 
+        l2 = 1 << 20;
+
+    size_t base = 64;
+    while (2 * (2*base) * (2*base) * sizeof(fft_complex) <= (size_t)l2) 
+        base *= 2;
+
+    size_t n = fft_nice_size(base > 4*(kernel_size - 1) ? base : 4*(kernel_size - 1));
+
+    if (padded + kernel_size - 1 <= n) 
+        return fft_nice_size(padded + kernel_size - 1);
+
+    return n;
+} 
+
+
+//Prepara los planes, el espectro del kernel y los buffers del motor FFT
+static void fft_context_free(struct fft_context* f);
+
+
+//Prepara los planes, el espectro del kernel y los buffers del motor FFT. Devuelve 0 si no hay memoria, con f ya
+//liberado
+static int fft_context_init(struct fft_context* f, double** kernel, size_t kernel_size, size_t width, size_t height, size_t blur_channels) 
+{   
+    size_t mid = kernel_size/2;
+    size_t nx = fft_choose_size(kernel_size, width + 2*mid);
+    size_t ny = fft_choose_size(kernel_size, height + 2*mid);
+
+    memset(f, 0, sizeof(*f));
+    int planned = fft_plan_init(&f->plan_x, nx);
+    planned = fft_plan_init(&f->plan_y, ny) && planned;
+
+    f->tile_w = nx - kernel_size + 1;
+    f->tile_h = ny - kernel_size + 1;
+    f->n_planes = (blur_channels + 1) / 2;
+
+    f->tile = (fft_complex*)malloc(sizeof(fft_complex) * nx * ny * f->n_planes);
+    f->spectrum = (fft_complex*)malloc(sizeof(fft_complex) * nx * ny);
+    f->acc = (float*)malloc(sizeof(float) * width * height * blur_channels);
+
+    //Espectro del kernel: FFT de filas seguida de FFT de columnas, normalizado para que la IFFT no lo requiera
+    fft_complex* line_a = (fft_complex*)malloc(sizeof(fft_complex) * (nx > ny ? nx : ny));
+    fft_complex* line_b = (fft_complex*)malloc(sizeof(fft_complex) * (nx > ny ? nx : ny));
+
+    if (!planned || !f->tile || !f->spectrum || !f->acc || !line_a || !line_b) {
+        free(line_a);
+        free(line_b);
+        fft_context_free(f);
+        return 0;
+    }
+
+    for (size_t r = 0; r < ny; ++r) {
+        for (size_t x = 0; x < nx; ++x) {
+            line_a[x].re = r < kernel_size && x < kernel_size ? (float)kernel[r][x] : 0.0f;
+            line_a[x].im = 0.0f;
+        }
+        fft_execute(&f->plan_x, line_a, f->spectrum + r*nx, 0);
+    }
+
+    for (size_t x = 0; x < nx; ++x) {
+        for (size_t r = 0; r < ny; ++r) 
+            line_a[r] = f->spectrum[r*nx + x];
+
+        fft_execute(&f->plan_y, line_a, line_b, 0);
+
+        for (size_t r = 0; r < ny; ++r) {
+            f->spectrum[r*nx + x].re = line_b[r].re / (nx * ny);
+            f->spectrum[r*nx + x].im = line_b[r].im / (nx * ny);
+        }
+    }
+
+    free(line_a);
+    free(line_b);
+
+    return 1;
+} 
+
+
+static void fft_context_free(struct fft_context* f) 
+{   
+    fft_plan_free(&f->plan_x);
+    fft_plan_free(&f->plan_y);
+    free(f->tile);
+    free(f->spectrum);
+    free(f->acc);
+} 
+
+
+//Costo en segundos de un tap de la convolución 1-D convolve; mínimo de tres mediciones
+static double measure_tap_cost(convolve_1d_fn convolve) 
+{   
+    float src[4096 + 64];
+    float dst[4096];
+    float w[32];
+    const size_t n = sizeof(dst) / sizeof(dst[0]);
+
+    for (size_t i = 0; i < n + 64; ++i) 
+        src[i] = (float)(i % 251);
+    for (int t = 0; t < 32; ++t) 
+        w[t] = 1.0f / 32;
+
+    double tap_cost = 1e30;
+    double start;
+    double elapsed;
+
+    for (int rep = 0; rep < 3; ++rep) {
+        size_t calls = 0;
+        start = blur_wall_time();
+        do {
+            convolve(src, dst, n, w, 31, 1);
+            ++calls;
+            elapsed = blur_wall_time() - start;
+        } while (elapsed < 0.002);
+
+        if (elapsed / (calls * n * 31) < tap_cost) 
+            tap_cost = elapsed / (calls * n * 31);
+    }
+
+    return tap_cost;
+} 
+
+
+//Mide en este equipo el tamaño de kernel a partir del cual el motor FFT es más rápido que el espacial:
+//2K taps por pixel si el kernel es separable o K² si no lo es, frente al costo de procesar un mosaico
+//de una imagen sintética, con la convolución 1-D convolve. Devuelve 0 si el FFT no gana en ninguno de los tamaños probados
+//y -1 si no hay memoria para medirlo.
+static long measure_fft_crossover(int separable, convolve_1d_fn convolve) 
+{   
+    static const size_t candidates[] = { 9, 15, 31, 47, 63, 95, 127, 191, 255 };
+    const size_t side = 512;
+
+    double tap_cost = measure_tap_cost(convolve);
+    double start;
+    double elapsed;
+
+    //Imagen sintética de tres planos para medir el costo de un mosaico
+    struct planar_image src, dst;
+    int allocated = planar_image_alloc(&src, side, side, 3);
+    allocated = planar_image_alloc(&dst, side, side, 3) && allocated;
+
+    if (!allocated) {
+        planar_image_free(&src);
+        planar_image_free(&dst);
+        return -1;
+    }
+
+    for (size_t k = 0; k < 3; ++k) 
+        for (size_t i = 0; i < side * src.stride; ++i) 
+            src.planes[k][i] = (unsigned char)(i * 7 + k);
+
+    long crossover = 0;
+
+    for (size_t c = 0; c < sizeof(candidates)/sizeof(candidates[0]) && crossover == 0; ++c) {
+
+        size_t kernel_size = candidates[c];
+
+        if (separable && kernel_size < FFT_MIN_KERNEL) 
+            continue;
+
+        double** kernel = (double**)calloc(kernel_size, sizeof(double*));
+        allocated = kernel != NULL;
+        for (size_t i = 0; i < kernel_size && allocated; ++i) 
+            allocated = (kernel[i] = (double*)calloc(kernel_size, sizeof(double))) != NULL;
+
+        struct fft_context f;
+        if (allocated) {
+            kernel[kernel_size/2][kernel_size/2] = 1.0;
+            allocated = fft_context_init(&f, kernel, kernel_size, side, side, 3);
+        }
+
+        if (!allocated) {
+            for (size_t i = 0; kernel && i < kernel_size; ++i) 
+                free(kernel[i]);
+            free(kernel);
+            crossover = -1;
+            break;
+        }
+
+        struct convolution_args a;
+        memset(&a, 0, sizeof(a));
+        a.src = &src;
+        a.dst = &dst;
+        a.stride = src.stride;
+        a.n_planes = 3;
+        a.width = side;
+        a.height = side;
+        a.channels = 3;
+        a.blur_channels = 3;
+        a.kernel_size = kernel_size;
+        a.n_threads = 1;
+        a.fft = &f;
+
+        fft_complex* line_a = (fft_complex*)malloc(sizeof(fft_complex) * (f.plan_x.n > f.plan_y.n ? f.plan_x.n : f.plan_y.n));
+        fft_complex* line_b = (fft_complex*)malloc(sizeof(fft_complex) * (f.plan_x.n > f.plan_y.n ? f.plan_x.n : f.plan_y.n));
+
+        if (line_a == NULL || line_b == NULL) {
+            free(line_a);
+            free(line_b);
+            fft_context_free(&f);
+            for (size_t i = 0; i < kernel_size; ++i) 
+                free(kernel[i]);
+            free(kernel);
+            crossover = -1;
+            break;
+        }
+
+        //La primera pasada solo calienta la caché y las páginas de los buffers
+        fft_process_tile(&a, 0, 0, line_a, line_b);
+
+        //Se toma el mínimo de varias repeticiones para filtrar interrupciones del sistema
+        double best = 1e30;
+        for (int rep = 0; rep < 3; ++rep) {
+            start = blur_wall_time();
+            fft_process_tile(&a, 0, 0, line_a, line_b);
+            elapsed = blur_wall_time() - start;
+            if (elapsed < best) 
+                best = elapsed;
+        }
+        double fft_cost = best / (f.tile_w * f.tile_h * 3);
+
+        double spatial_cost = (separable ? 2 * kernel_size : kernel_size * kernel_size) * tap_cost;
+
+        if (fft_cost < spatial_cost) 
+            crossover = (long)kernel_size;
+
+        free(line_a);
+        free(line_b);
+        fft_context_free(&f);
+        for (size_t i = 0; i < kernel_size; ++i) 
+            free(kernel[i]);
+        free(kernel);
+    }
+
+    planar_image_free(&src);
+    planar_image_free(&dst);
+
+    return crossover;
+} 
+
+
+//Pool de hilos persistente: se crea una vez y lo comparten la conversión a planos, el filtro y la conversión
+//de vuelta de todas las imágenes. Cada tarea la ejecutan todos los hilos, que pueden sincronizarse entre sí
+//con la barrera del pool
+struct thread_pool {
+    int n_threads;
+    int active;                 //Hilos que atienden las tareas: los primeros active; el resto espera sin participar
+    pthread_t* threads;
+    struct pool_worker* workers;
+    pthread_mutex_t lock;
+    pthread_cond_t job_ready;
+    pthread_cond_t job_done;
+    pool_job_fn job;
+    void* job_arg;
+    unsigned long generation;   //Número de tareas lanzadas; cada hilo espera a que cambie
+    int running;                //Hilos que no han terminado la tarea actual
+    int shutdown;
+    pthread_barrier_t barrier;
+    int* worker_cpu;            //CPU y nodo NUMA de cada hilo si están fijados; NULL si no
+    int* worker_node;
+};
+
+//Función que asigna trabajo a cada uno de los hilos
+//Hilo del pool y su posición
+struct pool_worker {
+    struct thread_pool* pool;
+    int thread_id;
+};
+
+
+static void* pool_worker_main(void* arg){
+
+    struct pool_worker* worker = (struct pool_worker*)arg;
+    struct thread_pool* pool = worker->pool;
+    unsigned long seen = 0;
+
+    for(;;) {
+
+        pthread_mutex_lock(&pool->lock);
+
+        while(pool->generation == seen && !pool->shutdown)
+            pthread_cond_wait(&pool->job_ready, &pool->lock);
+
+        if(pool->shutdown) {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+
+        seen = pool->generation;
+        pool_job_fn job = pool->job;
+        void* job_arg = pool->job_arg;
+        int active = pool->active;
+
+        pthread_mutex_unlock(&pool->lock);
+
+        if(worker->thread_id >= active)
+            continue;
+
+        job(job_arg, worker->thread_id, active);
+
+        pthread_mutex_lock(&pool->lock);
+        if(--pool->running == 0)
+            pthread_cond_signal(&pool->job_done);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+
+//Crea los n_threads hilos del pool, que quedan dormidos hasta la primera tarea
+static int thread_pool_init(struct thread_pool* pool, int n_threads){
+
+    pool->n_threads = n_threads;
+    pool->active = n_threads;
+    pool->generation = 0;
+    pool->running = 0;
+    pool->shutdown = 0;
+    pool->worker_cpu = NULL;
+    pool->worker_node = NULL;
+    pool->threads = (pthread_t*)malloc(sizeof(pthread_t) * n_threads);
+    pool->workers = (struct pool_worker*)malloc(sizeof(struct pool_worker) * n_threads);
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->job_ready, NULL);
+    pthread_cond_init(&pool->job_done, NULL);
+    pthread_barrier_init(&pool->barrier, NULL, n_threads);
+
+    if(pool->threads == NULL || pool->workers == NULL) {
+        pool->n_threads = 0;
+        return 0;
+    }
+
+    for(int i = 0; i < n_threads; ++i) {
+
+        pool->workers[i].pool = pool;
+        pool->workers[i].thread_id = i;
+
+        if(pthread_create(&pool->threads[i], NULL, pool_worker_main, &pool->workers[i]) != 0) {
+            pool->n_threads = i;
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+
+//Ejecuta job(arg, id, n) en todos los hilos del pool y espera a que terminen
+void blur_pool_run(struct thread_pool* pool, pool_job_fn job, void* arg){
+
+    pthread_mutex_lock(&pool->lock);
+
+    pool->job = job;
+    pool->job_arg = arg;
+    pool->running = pool->active;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->job_ready);
+
+    while(pool->running > 0)
+        pthread_cond_wait(&pool->job_done, &pool->lock);
+
+    pthread_mutex_unlock(&pool->lock);
+}
+
+
+//Limita las siguientes tareas a los primeros n hilos del pool; la barrera pasa a esperar a n
+void blur_pool_set_active(struct thread_pool* pool, int n){
+
+    if(n < 1 || n > pool->n_threads)
+        n = pool->n_threads;
+
+    if(n == pool->active)
+        return;
+
+    pthread_barrier_destroy(&pool->barrier);
+    pthread_barrier_init(&pool->barrier, NULL, n);
+    pool->active = n;
+}
+
+
+int blur_pool_threads(const struct thread_pool* pool){
+
+    return pool->n_threads;
+}
+
+
+int blur_pool_active(const struct thread_pool* pool){
+
+    return pool->active;
+}
+
+
+static void thread_pool_destroy(struct thread_pool* pool){
+
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->job_ready);
+    pthread_mutex_unlock(&pool->lock);
+
+    for(int i = 0; i < pool->n_threads; ++i)
+        pthread_join(pool->threads[i], NULL);
+
+    pthread_barrier_destroy(&pool->barrier);
+    pthread_cond_destroy(&pool->job_ready);
+    pthread_cond_destroy(&pool->job_done);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->threads);
+    free(pool->workers);
+    free(pool->worker_cpu);
+    free(pool->worker_node);
+}
+
+
+//Nombres de las políticas de fijación de los hilos en la línea de comandos
+const char* blur_affinity_names[] = {"none", "compact", "scatter", "list"};
+
+
+//Interpreta una lista de CPUs de /sys o de la línea de comandos ("0-3,8,10-11") y llama a add con cada una
+static int parse_cpu_list(const char* list, void (*add)(void* ctx, int cpu), void* ctx){
+
+    const char* p = list;
+
+    while(*p && *p != '\n') {
+
+        char* end;
+        long first = strtol(p, &end, 10);
+
+        if(end == p || first < 0)
+            return 0;
+
+        long last = first;
+        p = end;
+
+        if(*p == '-') {
+            last = strtol(p + 1, &end, 10);
+            if(end == p + 1 || last < first)
+                return 0;
+            p = end;
+        }
+
+        for(long cpu = first; cpu <= last; ++cpu)
+            add(ctx, (int)cpu);
+
+        if(*p == ',')
+            ++p;
+    }
+
+    return 1;
+}
+
+
+struct cpu_array {
+    int* cpus;
+    int count;
+    int capacity;
+};
+
+
+static void cpu_array_add(void* ctx, int cpu){
+
+    struct cpu_array* a = (struct cpu_array*)ctx;
+
+    if(a->count == a->capacity) {
+        a->capacity = a->capacity ? 2*a->capacity : 16;
+        a->cpus = (int*)realloc(a->cpus, sizeof(int) * a->capacity);
+    }
+
+    a->cpus[a->count++] = cpu;
+}
+
+
+//Lee los nodos en línea y sus CPUs de /sys/devices/system/node. Sin esa información (kernel sin NUMA) todas las
+//CPUs en línea quedan en el nodo 0
+void blur_read_numa_topology(struct numa_topology* t){
+
+    struct cpu_array nodes = { NULL, 0, 0 };
+    struct cpu_array all = { NULL, 0, 0 };
+    struct cpu_array node_of = { NULL, 0, 0 };
+    char line[4096];
+
+    FILE* fp = fopen("/sys/devices/system/node/online", "r");
+    if(fp) {
+        if(fgets(line, sizeof(line), fp))
+            parse_cpu_list(line, cpu_array_add, &nodes);
+        fclose(fp);
+    }
+
+    t->n_nodes = 1;
+
+    for(int i = 0; i < nodes.count; ++i) {
+
+        char path[64];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", nodes.cpus[i]);
+
+        fp = fopen(path, "r");
+        if(fp == NULL)
+            continue;
+
+        int before = all.count;
+        if(fgets(line, sizeof(line), fp))
+            parse_cpu_list(line, cpu_array_add, &all);
+        fclose(fp);
+
+        for(int j = before; j < all.count; ++j)
+            cpu_array_add(&node_of, nodes.cpus[i]);
+
+        if(nodes.cpus[i] + 1 > t->n_nodes)
+            t->n_nodes = nodes.cpus[i] + 1;
+    }
+
+    if(all.count == 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        for(int cpu = 0; cpu < (online > 0 ? online : 1); ++cpu) {
+            cpu_array_add(&all, cpu);
+            cpu_array_add(&node_of, 0);
+        }
+    }
+
+    t->n_cpus = all.count;
+    t->cpus = all.cpus;
+    t->max_cpu = 0;
+
+    for(int i = 0; i < all.count; ++i)
+        if(all.cpus[i] > t->max_cpu)
+            t->max_cpu = all.cpus[i];
+
+    t->cpu_node = (int*)malloc(sizeof(int) * (t->max_cpu + 1));
+    for(int cpu = 0; cpu <= t->max_cpu; ++cpu)
+        t->cpu_node[cpu] = 0;
+    for(int i = 0; i < all.count; ++i)
+        t->cpu_node[all.cpus[i]] = node_of.cpus[i];
+
+    free(nodes.cpus);
+    free(node_of.cpus);
+}
+
+
+void blur_free_numa_topology(struct numa_topology* t){
+
+    free(t->cpus);
+    free(t->cpu_node);
+}
+
+
+//Elige la CPU de cada hilo: compact llena un nodo antes de pasar al siguiente, scatter alterna entre nodos y
+//list recorre la lista dada. Devuelve 0 si la lista contiene CPUs que no están en línea
+int blur_assign_worker_cpus(const struct numa_topology* t, enum affinity_policy policy, const char* list, int n_workers, int* cpus){
+
+    if(policy == AFFINITY_LIST) {
+
+        struct cpu_array chosen = { NULL, 0, 0 };
+
+        if(!parse_cpu_list(list, cpu_array_add, &chosen) || chosen.count == 0) {
+            free(chosen.cpus);
+            return 0;
+        }
+
+        for(int i = 0; i < chosen.count; ++i)
+            if(chosen.cpus[i] > t->max_cpu) {
+                free(chosen.cpus);
+                return 0;
+            }
+
+        for(int w = 0; w < n_workers; ++w)
+            cpus[w] = chosen.cpus[w % chosen.count];
+
+        free(chosen.cpus);
+        return 1;
+    }
+
+    if(policy == AFFINITY_COMPACT) {
+        for(int w = 0; w < n_workers; ++w)
+            cpus[w] = t->cpus[w % t->n_cpus];
+        return 1;
+    }
+
+    //Scatter: la k-ésima CPU de cada nodo antes de la (k+1)-ésima de cualquiera
+    int* order = (int*)malloc(sizeof(int) * t->n_cpus);
+    int count = 0;
+
+    for(int k = 0; count < t->n_cpus; ++k)
+        for(int node = 0; node < t->n_nodes; ++node) {
+            int seen = 0;
+            for(int i = 0; i < t->n_cpus; ++i)
+                if(t->cpu_node[t->cpus[i]] == node && seen++ == k)
+                    order[count++] = t->cpus[i];
+        }
+
+    for(int w = 0; w < n_workers; ++w)
+        cpus[w] = order[w % t->n_cpus];
+
+    free(order);
+    return 1;
+}
+
+
+//Fija cada hilo del pool a su CPU desde el propio hilo
+static void pin_job(void* arg, int thread_id, int n_threads){
+
+    (void)n_threads;
+    const int* cpus = (const int*)arg;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpus[thread_id], &set);
+
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+
+//Nodo en que reside cada una de las count páginas de addr, consultado al kernel con move_pages
+static void query_page_nodes(void** pages, int* status, size_t count){
+
+    if(syscall(SYS_move_pages, 0, count, pages, NULL, status, 0) != 0)
+        for(size_t i = 0; i < count; ++i)
+            status[i] = -1;
+}
+
+
+//Cuenta las páginas de las filas [first_row, last_row) de los planos de p que están en el nodo node
+static void count_local_pages(const struct planar_image* p, size_t n_planes, size_t first_row, size_t last_row, int node,
+                              size_t* local, size_t* total){
+
+    long page_size = sysconf(_SC_PAGESIZE);
+
+    for(size_t k = 0; k < n_planes; ++k) {
+
+        uintptr_t begin = (uintptr_t)(p->planes[k] + first_row*p->stride) / page_size * page_size;
+        uintptr_t end = (uintptr_t)(p->planes[k] + last_row*p->stride);
+        size_t count = end > begin ? (end - begin + page_size - 1) / page_size : 0;
+
+        if(count == 0)
+            continue;
+
+        void** pages = (void**)malloc(sizeof(void*) * count);
+        int* status = (int*)malloc(sizeof(int) * count);
+
+        if(pages == NULL || status == NULL) {
+            free(pages);
+            free(status);
+            continue;
+        }
+
+        for(size_t i = 0; i < count; ++i)
+            pages[i] = (void*)(begin + i*page_size);
+
+        query_page_nodes(pages, status, count);
+
+        for(size_t i = 0; i < count; ++i)
+            *local += status[i] == node;
+        *total += count;
+
+        free(pages);
+        free(status);
+    }
+}
+
+
+//Primer acceso a los planos de salida: cada hilo escribe las filas de su bloque inicial del planificador
+struct first_touch_job {
+    const struct planar_image* planes;
+    size_t n_planes;
+    const struct tile_scheduler* scheduler;
+};
+
+
+static void first_touch_job(void* arg, int thread_id, int n_threads){
+
+    (void)n_threads;
+    struct first_touch_job* job = (struct first_touch_job*)arg;
+    size_t first_row, last_row;
+
+    scheduler_worker_rows(job->scheduler, thread_id, &first_row, &last_row);
+
+    for(size_t k = 0; k < job->n_planes; ++k)
+        memset(job->planes->planes[k] + first_row*job->planes->stride, 0, (last_row - first_row)*job->planes->stride);
+}
+
+
+//Perfil del equipo para elegir la cantidad de hilos y el mosaico con "auto". La topología y la cuota del cgroup
+//se leen en cada arranque; las mediciones se guardan en disco y se reutilizan mientras ambas y el conjunto de
+//instrucciones no cambien
+#define PROFILE_VERSION 1
+
+//Rendimiento que agrega un segundo hilo en el mismo núcleo físico, frente a uno solo
+#define SMT_GAIN 0.25
+
+//Bytes por hilo que copia la medición de ancho de banda; bastante más que una caché L3
+#define BANDWIDTH_BYTES (32 << 20)
+
+
+static void lowest_cpu(void* ctx, int cpu){
+
+    int* lowest = (int*)ctx;
+
+    if(*lowest < 0 || cpu < *lowest)
+        *lowest = cpu;
+}
+
+
+//CPUs disponibles para el proceso y cuántos núcleos físicos distintos ocupan. Los hermanos SMT de un núcleo
+//comparten thread_siblings_list, así que la CPU más baja de la lista identifica al núcleo
+static void detect_cores(int* logical, int* physical){
+
+    cpu_set_t set;
+    struct cpu_array cores = { NULL, 0, 0 };
+    char line[4096];
+
+    if(sched_getaffinity(0, sizeof(set), &set) != 0) {
+        CPU_ZERO(&set);
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        for(int cpu = 0; cpu < (online > 0 ? online : 1); ++cpu)
+            CPU_SET(cpu, &set);
+    }
+
+    *logical = CPU_COUNT(&set);
+
+    for(int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+
+        if(!CPU_ISSET(cpu, &set))
+            continue;
+
+        char path[96];
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu);
+
+        int core = -1;
+        FILE* fp = fopen(path, "r");
+        if(fp) {
+            if(fgets(line, sizeof(line), fp))
+                parse_cpu_list(line, lowest_cpu, &core);
+            fclose(fp);
+        }
+
+        if(core < 0)
+            core = cpu;
+
+        int seen = 0;
+        for(int i = 0; i < cores.count; ++i)
+            if(cores.cpus[i] == core)
+                seen = 1;
+
+        if(!seen)
+            cpu_array_add(&cores, core);
+    }
+
+    *physical = cores.count > 0 ? cores.count : 1;
+    free(cores.cpus);
+}
+
+
+//Cuota de CPU del cgroup en CPUs (cpu.max en cgroup v2, cfs_quota_us/cfs_period_us en v1); 0 si no hay límite
+static double read_cgroup_quota(void){
+
+    long quota = -1, period = 0;
+    char first[32];
+
+    FILE* fp = fopen("/sys/fs/cgroup/cpu.max", "r");
+    if(fp) {
+        if(fscanf(fp, "%31s %ld", first, &period) == 2 && strcmp(first, "max") != 0)
+            quota = atol(first);
+        fclose(fp);
+    }
+    else {
+        fp = fopen("/sys/fs/cgroup/cpu/cpu.cfs_quota_us", "r");
+        if(fp) {
+            if(fscanf(fp, "%ld", &quota) != 1)
+                quota = -1;
+            fclose(fp);
+        }
+
+        fp = fopen("/sys/fs/cgroup/cpu/cpu.cfs_period_us", "r");
+        if(fp) {
+            if(fscanf(fp, "%ld", &period) != 1)
+                period = 0;
+            fclose(fp);
+        }
+    }
+
+    return quota > 0 && period > 0 ? (double)quota / period : 0.0;
+}
+
+
+//Hilos que tiene sentido crear: las CPUs disponibles, recortadas a la cuota redondeada hacia arriba
+int blur_host_usable_threads(const struct host_profile* p){
+
+    int usable = p->logical_cpus;
+
+    if(p->quota_cpus > 0.0 && (int)ceil(p->quota_cpus) < usable)
+        usable = (int)ceil(p->quota_cpus);
+
+    return usable > 0 ? usable : 1;
+}
+
+
+//Núcleos que aportan rendimiento completo: los físicos, recortados a la cuota
+static double host_full_cores(const struct host_profile* p){
+
+    double cores = p->physical_cores;
+
+    if(p->quota_cpus > 0.0 && p->quota_cpus < cores)
+        cores = p->quota_cpus;
+
+    return cores;
+}
+
+
+struct copy_worker {
+    pthread_barrier_t* start;
+    double seconds;
+};
+
+
+//Copia su buffer varias veces tras esperar a los demás hilos y guarda la mejor vuelta
+static void* copy_worker_main(void* arg){
+
+    struct copy_worker* w = (struct copy_worker*)arg;
+    unsigned char* src = (unsigned char*)malloc(BANDWIDTH_BYTES);
+    unsigned char* dst = (unsigned char*)malloc(BANDWIDTH_BYTES);
+
+    memset(src, 1, BANDWIDTH_BYTES);
+    memset(dst, 0, BANDWIDTH_BYTES);
+
+    pthread_barrier_wait(w->start);
+
+    w->seconds = 1e30;
+    for(int rep = 0; rep < 3; ++rep) {
+        double start = blur_wall_time();
+        memcpy(dst, src, BANDWIDTH_BYTES);
+        double elapsed = blur_wall_time() - start;
+        if(elapsed < w->seconds)
+            w->seconds = elapsed;
+    }
+
+    free(src);
+    free(dst);
+    return NULL;
+}
+
+
+//Ancho de banda de memcpy en GB/s (lectura más escritura) con n hilos copiando a la vez
+static double measure_copy_bandwidth(int n){
+
+    pthread_t threads[n];
+    struct copy_worker workers[n];
+    pthread_barrier_t start;
+
+    pthread_barrier_init(&start, NULL, n);
+
+    for(int i = 0; i < n; ++i) {
+        workers[i].start = &start;
+        pthread_create(&threads[i], NULL, copy_worker_main, &workers[i]);
+    }
+
+    double slowest = 0.0;
+    for(int i = 0; i < n; ++i) {
+        pthread_join(threads[i], NULL);
+        if(workers[i].seconds > slowest)
+            slowest = workers[i].seconds;
+    }
+
+    pthread_barrier_destroy(&start);
+
+    return 2.0 * BANDWIDTH_BYTES * n / slowest / 1e9;
+}
+
+
+static void empty_job(void* arg, int thread_id, int n_threads){
+
+    (void)arg;
+    (void)thread_id;
+    (void)n_threads;
+}
+
+
+//Costo por hilo en microsegundos de lanzar una tarea vacía a un pool de n hilos y esperar a que termine
+static double measure_dispatch_cost(int n){
+
+    struct thread_pool pool;
+    const int runs = 200;
+
+    if(!thread_pool_init(&pool, n)) {
+        thread_pool_destroy(&pool);
+        return 10.0;
+    }
+
+    blur_pool_run(&pool, empty_job, NULL);
+
+    double start = blur_wall_time();
+    for(int i = 0; i < runs; ++i)
+        blur_pool_run(&pool, empty_job, NULL);
+    double elapsed = blur_wall_time() - start;
+
+    thread_pool_destroy(&pool);
+
+    return elapsed / runs / n * 1e6;
+}
+
+
+//Lee las CPUs disponibles, los núcleos físicos y la cuota; no mide nada
+void blur_detect_host(struct host_profile* p, enum simd_level simd){
+
+    memset(p, 0, sizeof(*p));
+    detect_cores(&p->logical_cpus, &p->physical_cores);
+    p->quota_cpus = read_cgroup_quota();
+    p->simd = simd;
+    p->crossover[0] = -1;
+    p->crossover[1] = -1;
+}
+
+
+//Mide el ancho de banda con uno y con todos los núcleos, el costo de un tap y el de lanzar una tarea al pool.
+//El cruce con el FFT, que tarda más, se mide la primera vez que hace falta
+void blur_calibrate_host(struct host_profile* p){
+
+    int usable = blur_host_usable_threads(p);
+    int cores = (int)ceil(host_full_cores(p));
+
+    p->bandwidth_1 = measure_copy_bandwidth(1);
+    p->bandwidth_all = cores > 1 ? measure_copy_bandwidth(cores) : p->bandwidth_1;
+    struct simd_kernels kernels;
+    simd_kernels_init(&kernels, p->simd);
+
+    p->tap_ns = measure_tap_cost(kernels.convolve_1d) * 1e9;
+    p->dispatch_us = measure_dispatch_cost(usable);
+    p->crossover[0] = -1;
+    p->crossover[1] = -1;
+    p->dirty = 1;
+}
+
+
+//Archivo del perfil: $XDG_CACHE_HOME/blur_effect.perfil, o ~/.cache/blur_effect.perfil. Crea el directorio
+void blur_default_profile_path(char* path, size_t size){
+
+    const char* cache = getenv("XDG_CACHE_HOME");
+    const char* home = getenv("HOME");
+
+    if(cache && *cache)
+        snprintf(path, size, "%s/blur_effect.perfil", cache);
+    else if(home && *home) {
+        snprintf(path, size, "%s/.cache", home);
+        mkdir(path, 0755);
+        snprintf(path, size, "%s/.cache/blur_effect.perfil", home);
+    }
+    else
+        snprintf(path, size, "blur_effect.perfil");
+}
+
+
+//Carga las mediciones del archivo si se tomaron en un equipo con las mismas CPUs, núcleos, cuota y kernels SIMD
+//que p, que ya debe tener lo detectado. Devuelve 0 si no hay archivo o no corresponde a este equipo
+int blur_load_host_profile(const char* path, struct host_profile* p){
+
+    FILE* fp = fopen(path, "r");
+
+    if(fp == NULL)
+        return 0;
+
+    struct host_profile file = *p;
+    char line[256];
+    char key[64];
+    char text[64];
+    double value;
+    int version = 0;
+
+    file.logical_cpus = file.physical_cores = -1;
+    file.quota_cpus = -1.0;
+    file.dispatch_us = -1.0;
+
+    while(fgets(line, sizeof(line), fp)) {
+
+        if(line[0] == '#' || sscanf(line, "%63s %63s", key, text) != 2)
+            continue;
+
+        value = atof(text);
+
+        if(strcmp(key, "version") == 0)
+            version = (int)value;
+        else if(strcmp(key, "cpus_logicas") == 0)
+            file.logical_cpus = (int)value;
+        else if(strcmp(key, "nucleos_fisicos") == 0)
+            file.physical_cores = (int)value;
+        else if(strcmp(key, "cuota_cpus") == 0)
+            file.quota_cpus = value;
+        else if(strcmp(key, "simd") == 0)
+            file.simd = strcmp(text, blur_simd_names[p->simd]) == 0 ? p->simd : (enum simd_level)-1;
+        else if(strcmp(key, "ancho_banda_1") == 0)
+            file.bandwidth_1 = value;
+        else if(strcmp(key, "ancho_banda_total") == 0)
+            file.bandwidth_all = value;
+        else if(strcmp(key, "costo_tap_ns") == 0)
+            file.tap_ns = value;
+        else if(strcmp(key, "costo_tarea_us") == 0)
+            file.dispatch_us = value;
+        else if(strcmp(key, "cruce_fft_no_separable") == 0)
+            file.crossover[0] = (long)value;
+        else if(strcmp(key, "cruce_fft_separable") == 0)
+            file.crossover[1] = (long)value;
+    }
+
+    fclose(fp);
+
+    if(version != PROFILE_VERSION || file.logical_cpus != p->logical_cpus ||
+       file.physical_cores != p->physical_cores || fabs(file.quota_cpus - p->quota_cpus) > 1e-6 || file.simd != p->simd ||
+       file.bandwidth_1 <= 0.0 || file.bandwidth_all <= 0.0 || file.tap_ns <= 0.0 || file.dispatch_us < 0.0)
+        return 0;
+
+    *p = file;
+    p->dirty = 0;
+    return 1;
+}
+
+
+int blur_save_host_profile(const char* path, struct host_profile* p){
+
+    FILE* fp = fopen(path, "w");
+
+    if(fp == NULL)
+        return 0;
+
+    fprintf(fp, "# Perfil de calibracion de blur_effect; se regenera si cambian las CPUs, la cuota o --simd\n");
+    fprintf(fp, "version %d\n", PROFILE_VERSION);
+    fprintf(fp, "cpus_logicas %d\n", p->logical_cpus);
+    fprintf(fp, "nucleos_fisicos %d\n", p->physical_cores);
+    fprintf(fp, "cuota_cpus %f\n", p->quota_cpus);
+    fprintf(fp, "simd %s\n", blur_simd_names[p->simd]);
+    fprintf(fp, "ancho_banda_1 %f\n", p->bandwidth_1);
+    fprintf(fp, "ancho_banda_total %f\n", p->bandwidth_all);
+    fprintf(fp, "costo_tap_ns %f\n", p->tap_ns);
+    fprintf(fp, "costo_tarea_us %f\n", p->dispatch_us);
+    fprintf(fp, "cruce_fft_no_separable %ld\n", p->crossover[0]);
+    fprintf(fp, "cruce_fft_separable %ld\n", p->crossover[1]);
+
+    fclose(fp);
+    p->dirty = 0;
+    return 1;
+}
+
+
+//Estima el tiempo del filtro con n hilos como el mayor entre cálculo y tráfico a memoria, más el costo de
+//despertar a los hilos en cada tarea, y devuelve la menor cantidad de hilos que queda a un 5% del mejor.
+//El cálculo escala con los núcleos físicos y solo un SMT_GAIN con sus hermanos; la memoria, hasta el ancho de
+//banda medido con todos los núcleos. Los motores por bandas no usan más hilos que bandas mínimas haya
+static int choose_thread_count(const struct host_profile* p, enum blur_engine engine, size_t width, size_t height,
+                        size_t planes, size_t kernel_size){
+
+    double pixels = (double)width * height * planes;
+    double taps;
+    double bytes = 6.0;         //Conversión a planos, lectura y escritura del filtro y conversión de vuelta
+    double tasks = 3.0;         //Tareas del pool por imagen, contando las barreras internas de los motores
+    size_t max_threads = height / 8;
+
+    switch(engine) {
+        case ENGINE_DIRECT:
+            taps = (double)kernel_size * kernel_size;
+            max_threads = height * planes;
+            break;
+        case ENGINE_FIXED:
+            taps = 2.0 * kernel_size;
+            bytes += 4.0;
+            tasks += 2.0 * planes;
+            break;
+        case ENGINE_BOX:
+            taps = 4.0 * BOX_PASSES;
+            bytes += 2.0 * BOX_PASSES * 2 * sizeof(float);
+            tasks += 2.0 * BOX_PASSES * planes;
+            break;
+        case ENGINE_IIR:
+            taps = 16.0;
+            bytes += 4.0 * sizeof(float);
+            tasks += 2.0 * planes;
+            break;
+        case ENGINE_FFT:
+            taps = 2.0 * (p->crossover[1] > 0 ? p->crossover[1] : FFT_MIN_KERNEL);
+            bytes += 4.0 * sizeof(float);
+            tasks += 3.0 * (width / 256 + 1) * (height / 256 + 1);
+            break;
+        default:
+            taps = 2.0 * kernel_size;
+            max_threads = height * planes / (4 * kernel_size);
+            break;
+    }
+
+    double compute = pixels * taps * p->tap_ns * 1e-9;
+    double traffic = pixels * bytes / 1e9;
+    double cores = host_full_cores(p);
+    int usable = blur_host_usable_threads(p);
+
+    if(max_threads < 1)
+        max_threads = 1;
+    if((size_t)usable > max_threads)
+        usable = (int)max_threads;
+
+    double times[usable + 1];
+    double best = 1e30;
+
+    for(int n = 1; n <= usable; ++n) {
+
+        double parallel = n < cores ? n : cores + SMT_GAIN * (n - cores);
+        double bandwidth = n * p->bandwidth_1 < p->bandwidth_all ? n * p->bandwidth_1 : p->bandwidth_all;
+        double memory = traffic / bandwidth;
+
+        times[n] = (compute / parallel > memory ? compute / parallel : memory) + tasks * n * p->dispatch_us * 1e-6;
+        if(times[n] < best)
+            best = times[n];
+    }
+
+    int n = 1;
+    while(times[n] > 1.05 * best)
+        ++n;
+
+    return n;
+}
+
+
+//Bytes de cada buffer propio del hilo que usa el motor de a. blur_image los reserva antes de lanzar la
+//convolución, para que ningún hilo se quede sin memoria a medio camino con los demás esperándolo en una barrera
+static void worker_scratch_sizes(const struct convolution_args* a, size_t bytes[WORKER_SCRATCH_BUFFERS]){
+
+    size_t mid = a->kernel_size/2;
+    size_t row_len = a->width * a->blur_channels;
+    size_t tile_w = a->tile_w < a->width ? a->tile_w : a->width;
+
+    memset(bytes, 0, sizeof(size_t) * WORKER_SCRATCH_BUFFERS);
+
+    switch(a->engine) {
+
+    case ENGINE_SEPARABLE:
+        bytes[0] = sizeof(float) * (tile_w + 2*mid) * a->blur_channels;
+        bytes[1] = sizeof(float) * (a->tile_h + 2*mid) * tile_w * a->blur_channels;
+        bytes[2] = sizeof(float) * tile_w * a->blur_channels;
+        break;
+
+    case ENGINE_FIXED:
+        bytes[0] = sizeof(int16_t) * (a->width + 2*mid) * a->blur_channels;
+        bytes[1] = sizeof(int16_t) * row_len;
+        break;
+
+    case ENGINE_BOX:
+        bytes[0] = bytes[1] = bytes[2] = sizeof(float) * row_len;
+        break;
+
+    case ENGINE_IIR:
+        bytes[0] = sizeof(double) * ((a->width > a->height ? a->width : a->height) + 2*a->iir.margin);
+        bytes[1] = bytes[2] = sizeof(float[IIR_STRIP_WIDTH]) * (a->iir.margin + 1);
+        bytes[3] = sizeof(double[IIR_STRIP_WIDTH]) * (a->iir.margin + 1);
+        break;
+
+    case ENGINE_FFT:
+        bytes[0] = bytes[1] = sizeof(fft_complex) * (a->fft->plan_x.n > a->fft->plan_y.n ? a->fft->plan_x.n : a->fft->plan_y.n);
+        break;
+
+    default:
+        break;
+    }
+}
+
+
+static void *assignWork(void *args) 
+{ 
+    struct convolution_args * my_args = (struct convolution_args *)args;
+
+    //El motor FFT empaca los planos de dos en dos y los procesa todos juntos
+    if(my_args->engine == ENGINE_FFT) {
+        executeFFTConvolution(*my_args);
+        return NULL;
+    }
+
+    //Los motores directo y separable toman bandas de filas de todos los planos del planificador con robo de trabajo
+    if(my_args->engine == ENGINE_SEPARABLE) {
+        executeSeparableConvolution(*my_args);
+        return NULL;
+    }
+
+    if(my_args->engine == ENGINE_DIRECT) {
+        executeConvolution(*my_args);
+        return NULL;
+    }
+
+    //Los demás motores recorren los planos uno tras otro, con fases separadas por barreras
+    for(size_t k = 0; k < my_args->n_planes; ++k) {
+
+        struct convolution_args plane = *my_args;
+        plane.img = my_args->src->planes[k];
+        plane.blurred_img = my_args->dst->planes[k];
+        plane.blurred_sum = my_args->sums ? my_args->sums[k] : NULL;
+        plane.halo = my_args->halo + k;
+
+        if(plane.engine == ENGINE_FIXED)
+            executeFixedConvolution(plane);
+        else if(plane.engine == ENGINE_IIR)
+            executeIIRConvolution(plane);
+        else
+            executeBoxConvolution(plane);
+
+        //Los buffers son compartidos: se espera a que todos los hilos terminen el plano antes de reutilizarlos
+        pthread_barrier_wait(my_args->barrier);
+    }
+
+    return NULL; 
+}
+
+
+//Tarea del filtro: cada hilo toma sus parámetros del arreglo de convolution_args
+static void blur_job(void* arg, int thread_id, int n_threads){
+
+    (void)n_threads;
+    assignWork((struct convolution_args*)arg + thread_id);
+}
+
+
+//Conversión entre el formato entrelazado de stb y los planos, repartida por filas
+struct conversion_job {
+    unsigned char* img;
+    struct planar_image* planes;
+    int to_planar;
+    int alpha;                  //Premultiplicar el alfa al pasar a planos, o dividir por él al volver
+    const struct tile_scheduler* scheduler;     //Si no es NULL, cada hilo convierte las filas de su bloque inicial
+    float* const* sums;         //Valores sin redondear de los motores, para dividir por el alfa
+    const struct simd_kernels* kernels;
+};
+
+
+static void conversion_job(void* arg, int thread_id, int n_threads){
+
+    struct conversion_job* job = (struct conversion_job*)arg;
+    size_t first_row = job->planes->height * thread_id / n_threads;
+    size_t last_row = job->planes->height * (thread_id + 1) / n_threads;
+
+    if(job->scheduler)
+        scheduler_worker_rows(job->scheduler, thread_id, &first_row, &last_row);
+
+    if(job->to_planar) {
+        image_to_planar(job->kernels, job->img, job->planes, first_row, last_row);
+        if(job->alpha)
+            premultiply_alpha(job->planes, first_row, last_row);
+    }
+    else {
+        if(job->alpha)
+            unpremultiply_alpha(job->planes, job->sums, first_row, last_row);
+        planar_to_image(job->kernels, job->planes, job->img, first_row, last_row);
+    }
+}
+
+
+//Contexto de la librería: el pool, los kernels ya generados y los buffers de trabajo de blur_image, que se
+//conservan entre llamadas. Los buffers solo crecen, así que tras la primera imagen de cada tamaño, motor y
+//kernel no se vuelve a reservar memoria
+struct blur_context {
+    struct thread_pool pool;
+    struct blur_params defaults;        //Parámetros de blur_image cuando se llama sin ellos
+    struct simd_kernels simd;           //Kernels del nivel SIMD de la llamada en curso
+    int verbose;                        //Imprimir los detalles de cada imagen
+    double seconds;                     //Tiempo de la convolución de la última imagen
+    struct kernel_cache kernels;
+    long crossover[2];                  //Cruce con el FFT medido sin perfil; -1 si no se ha medido
+    struct scratch_buffer src_planes;
+    struct scratch_buffer dst_planes;
+    struct scratch_buffer scheduler;
+    struct scratch_buffer halo[ENGINE_PLANES];
+    struct scratch_buffer sums;
+    struct scratch_buffer tmp;
+    struct scratch_buffer tmp2;
+    struct scratch_buffer tmp_fixed;
+    struct scratch_buffer kernel_q15;
+    struct worker_scratch* workers;     //Uno por hilo del pool
+    struct fft_context fft;             //Planes y espectro del motor FFT para la última imagen que lo usó
+    int fft_ready;
+    size_t fft_key[4];                  //Tamaño de kernel, ancho, alto y planos con que se preparó fft
+    double fft_sigma;
+};
+
+
+//Crea el pool de n_threads hilos. Devuelve NULL si no se pudieron crear los hilos
+struct blur_context* blur_context_create(int n_threads, const struct blur_params* defaults)
+{
+    struct blur_context* ctx = (struct blur_context*)calloc(1, sizeof(struct blur_context));
+
+    if(ctx == NULL)
+        return NULL;
+
+    ctx->defaults = *defaults;
+    ctx->crossover[0] = -1;
+    ctx->crossover[1] = -1;
+    ctx->workers = (struct worker_scratch*)calloc(n_threads, sizeof(struct worker_scratch));
+
+    if(ctx->workers == NULL || !thread_pool_init(&ctx->pool, n_threads)) {
+        if(ctx->workers)
+            thread_pool_destroy(&ctx->pool);
+        free(ctx->workers);
+        free(ctx);
+        return NULL;
+    }
+
+    return ctx;
+}
+
+
+void blur_context_destroy(struct blur_context* ctx)
+{
+    thread_pool_destroy(&ctx->pool);
+    kernel_cache_free(&ctx->kernels);
+
+    if(ctx->fft_ready)
+        fft_context_free(&ctx->fft);
+
+    scratch_release(&ctx->src_planes);
+    scratch_release(&ctx->dst_planes);
+    scratch_release(&ctx->scheduler);
+    scratch_release(&ctx->sums);
+    scratch_release(&ctx->tmp);
+    scratch_release(&ctx->tmp2);
+    scratch_release(&ctx->tmp_fixed);
+    scratch_release(&ctx->kernel_q15);
+
+    for(size_t k = 0; k < ENGINE_PLANES; ++k)
+        scratch_release(&ctx->halo[k]);
+
+    for(int i = 0; i < ctx->pool.n_threads; ++i)
+        for(size_t b = 0; b < WORKER_SCRATCH_BUFFERS; ++b)
+            scratch_release(&ctx->workers[i].buffers[b]);
+
+    free(ctx->workers);
+    free(ctx);
+}
+
+
+//Pool del contexto, para fijar sus hilos, limitar los activos con blur_pool_set_active o lanzar otras tareas
+struct thread_pool* blur_context_pool(struct blur_context* ctx)
+{
+    return &ctx->pool;
+}
+
+
+//Guarda la CPU y el nodo de cada hilo, que usan el reparto de mosaicos en modo NUMA y el informe de páginas, y
+//fija los hilos
+int blur_context_pin(struct blur_context* ctx, const int* cpus, const int* nodes)
+{
+    struct thread_pool* pool = &ctx->pool;
+    size_t bytes = sizeof(int) * pool->n_threads;
+
+    if(pool->worker_cpu == NULL)
+        pool->worker_cpu = (int*)malloc(bytes);
+    if(pool->worker_node == NULL)
+        pool->worker_node = (int*)malloc(bytes);
+
+    if(pool->worker_cpu == NULL || pool->worker_node == NULL)
+        return 0;
+
+    memcpy(pool->worker_cpu, cpus, bytes);
+    memcpy(pool->worker_node, nodes, bytes);
+    blur_pool_run(pool, pin_job, pool->worker_cpu);
+    return 1;
+}
+
+
+void blur_context_set_verbose(struct blur_context* ctx, int verbose)
+{
+    ctx->verbose = verbose;
+}
+
+
+//Tiempo de la convolución de la última llamada a blur_image
+double blur_context_seconds(const struct blur_context* ctx)
+{
+    return ctx->seconds;
+}
+
+
+//Detalles del filtro de cada imagen; solo se imprimen si el contexto es verboso
+static void blur_log(const struct blur_context* ctx, const char* format, ...)
+{
+    if(!ctx->verbose)
+        return;
+
+    va_list args;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+}
+
+
+//Difumina la imagen in con los hilos activos del pool del contexto y escribe el resultado en out->pixels, que
+//debe tener espacio para in->width * in->height * in->channels bytes; out toma las dimensiones de in. Con params
+//en NULL se usan los del contexto. Devuelve 0 si los parámetros no sirven para la imagen
+int blur_image(struct blur_context* ctx, const struct blur_frame* in, struct blur_frame* out, const struct blur_params* params)
+{
+    struct thread_pool* pool = &ctx->pool;
+
+    if(params == NULL)
+        params = &ctx->defaults;
+
+    int width = in->width;
+    int height = in->height;
+    int channels = in->channels;
+    unsigned char* img = in->pixels;
+
+    size_t kernel_size = params->kernel_size;
+    double sigma = params->sigma;
+    enum blur_engine engine = params->engine;
+    enum edge_mode edge = params->edge;
+    //Fuera de [0, 255] no es un valor de pixel y desbordaría el relleno del motor en punto fijo
+    float edge_value = params->edge_value < 0.0f ? 0.0f : params->edge_value > 255.0f ? 255.0f : params->edge_value;
+    size_t tile_w = params->tile_w;
+    size_t tile_h = params->tile_h;
+    struct host_profile* profile = params->profile;
+
+    if(width < 1 || height < 1 || channels < 1 || channels > MAX_PLANES || kernel_size % 2 == 0 ||
+       kernel_size > MAX_KERNEL_SIZE || !(isfinite(sigma) && sigma > 0.0)) {
+        perror("Imagen, tamaño de kernel o sigma no validos!\n");
+        return 0;
+    }
+
+    //Los kernels SIMD son de esta llamada: dos contextos, o dos llamadas al mismo, pueden usar niveles distintos
+    simd_kernels_init(&ctx->simd, params->simd);
+
+    //Se difuminan todos los canales: gris, gris con alfa, RGB o RGBA
+    size_t blur_planes = channels;
+
+    //Un alfa opaco se copia tal cual; si no, se difumina junto con el color premultiplicado, que ocupa dos planos
+    //por canal de color
+    int alpha = channels == 2 || channels == 4;
+    int opaque = alpha && alpha_is_opaque(img, (size_t)width * height, channels);
+    size_t n_low = alpha && !opaque ? channels - 1 : 0;
+
+    if(opaque)
+        blur_planes = channels - 1;
+
+    blur_planes += n_low;
+
+    //Los motores trabajan sobre planos separados por canal con filas alineadas; los de la parte baja del color
+    //premultiplicado van después de los del canal
+    struct planar_image src_planes;
+    struct planar_image dst_planes;
+
+    //En modo NUMA el primer acceso decide el nodo de cada página, y el reparto de bandas cambia con la altura:
+    //los planos de la imagen anterior ya quedaron ubicados, así que se liberan y cada imagen usa páginas nuevas
+    if(params->numa) {
+        scratch_release(&ctx->src_planes);
+        scratch_release(&ctx->dst_planes);
+    }
+
+    if(!planar_image_attach(&src_planes, width, height, channels + n_low, &ctx->src_planes) ||
+       !planar_image_attach(&dst_planes, width, height, channels + n_low, &ctx->dst_planes)) {
+        perror("Error reservando los planos de la imagen!\n");
+        return 0;
+    }
+
+    src_planes.n_planes = channels;
+    dst_planes.n_planes = channels;
+
+    //Con el color premultiplicado, los motores dejan también sus valores sin redondear para dividir por el alfa
+    float* sums[ENGINE_PLANES] = { NULL };
+
+    if(n_low) {
+
+        float* data = (float*)scratch_reserve(&ctx->sums, sizeof(float) * (size_t)width * height * blur_planes);
+
+        if(data == NULL) {
+            perror("Error reservando los planos de la imagen!\n");
+            return 0;
+        }
+
+        for(size_t k = 0; k < blur_planes; ++k)
+            sums[k] = data + k * (size_t)width * height;
+    }
+
+    size_t mid_size = kernel_size / 2 ;
+
+    //Los kernels 2-D y 1-D se generan una sola vez por tamaño y sigma en todo el contexto
+    int kernel_hit;
+    const struct cached_kernel* cached = get_cached_kernel(&ctx->kernels, kernel_size, sigma, &kernel_hit);
+
+    if(cached == NULL) {
+        perror("Error reservando memoria para el kernel!\n");
+        return 0;
+    }
+
+    double** kernel = cached->kernel;
+
+    blur_log(ctx, "\nKernel gaussiano usado para el filtro%s: \n\n", kernel_hit ? " (reutilizado)" : "");
+    for(size_t i = 0; i < kernel_size && ctx->verbose; ++i) {
+
+        for(size_t j = 0; j < kernel_size; ++j)
+            printf("%f ", kernel[i][j]);
+
+        printf("\n");
+    }
+
+    //Kernel 1-D para el motor separable
+    float* kernel_1d = cached->kernel_1d;
+
+    //Por defecto se usa el motor separable siempre que el kernel lo sea
+    int separable = cached->separable;
+
+    //Para kernels grandes, o que no son separables, se compara con el motor FFT usando el cruce medido en este equipo.
+    //La medición se hace una sola vez por contexto, o una sola vez por equipo si hay perfil
+    long* crossover_slot = profile ? &profile->crossover[separable] : &ctx->crossover[separable];
+
+    if(engine == ENGINE_AUTO && (kernel_size >= FFT_MIN_KERNEL || !separable)) {
+
+        if(*crossover_slot < 0) {
+
+            long measured = measure_fft_crossover(separable, ctx->simd.convolve_1d);
+
+            if(measured < 0) {
+                perror("Error reservando memoria para medir el cruce con el FFT!\n");
+                return 0;
+            }
+
+            *crossover_slot = measured;
+            if(profile)
+                profile->dirty = 1;
+        }
+
+        size_t crossover = (size_t)*crossover_slot;
+
+        if(crossover)
+            blur_log(ctx, "\nCruce separable/FFT medido: kernel %ld\n", crossover);
+        else
+            blur_log(ctx, "\nCruce separable/FFT medido: el FFT no gana hasta kernel 255\n");
+
+        if(crossover && kernel_size >= crossover)
+            engine = ENGINE_FFT;
+    }
+
+    if(engine == ENGINE_AUTO)
+        engine = separable ? ENGINE_SEPARABLE : ENGINE_DIRECT;
+
+    if((engine == ENGINE_SEPARABLE || engine == ENGINE_FIXED) && !separable) {
+        perror("El kernel no es separable!\n");
+        return 0;
+    }
+
+    //Con hilos "auto" se usan los que el perfil estima más rápidos para esta resolución, motor y kernel
+    if(profile) {
+
+        int chosen = choose_thread_count(profile, engine, width, height, blur_planes, kernel_size);
+        blur_pool_set_active(pool, chosen);
+
+        blur_log(ctx, "\nHilos automaticos: %d de %d (%d nucleos fisicos, %d CPUs", chosen, pool->n_threads,
+                 profile->physical_cores, profile->logical_cpus);
+        if(profile->quota_cpus > 0.0)
+            blur_log(ctx, ", cuota %.2f", profile->quota_cpus);
+        blur_log(ctx, ")\n");
+    }
+
+    int n_threads = pool->active;
+
+    blur_log(ctx, "\nMotor de convolucion: %s\n", blur_engine_names[engine]);
+    blur_log(ctx, "Kernels SIMD: %s\n", blur_simd_names[params->simd]);
+    blur_log(ctx, "Modo de borde: %s\n", blur_edge_names[edge]);
+    blur_log(ctx, "Planos difuminados: %ld de %d%s\n", blur_planes, channels,
+             opaque ? " (alfa opaco, se copia)" : n_low ? " (color premultiplicado en dos planos por canal)" : "");
+
+    //Radios de la cascada de cajas y su error frente al kernel exacto
+    int box_radius[BOX_PASSES];
+
+    if(engine == ENGINE_BOX) {
+
+        double sum_error;
+        compute_box_radii(kernel_size, kernel_1d, box_radius);
+        double max_error = box_cascade_error(kernel_size, kernel, box_radius, &sum_error);
+
+        blur_log(ctx, "\nRadios de las cajas: %d %d %d\n", box_radius[0], box_radius[1], box_radius[2]);
+        blur_log(ctx, "Error maximo frente al kernel exacto: %e (cota por pixel: %f niveles)\n", max_error, 255.0 * sum_error);
+    }
+
+    //Pesos cuantizados del motor de punto fijo y su desviación máxima frente a la ruta en double
+    int16_t* kernel_q15 = NULL;
+
+    if(engine == ENGINE_FIXED) {
+
+        kernel_q15 = (int16_t*)scratch_reserve(&ctx->kernel_q15, sizeof(int16_t) * kernel_size);
+
+        if(kernel_q15 == NULL) {
+            perror("Error reservando los buffers del filtro!\n");
+            return 0;
+        }
+
+        if(!quantize_kernel_q15(kernel_size, kernel_1d, kernel_q15)) {
+            perror("Kernel con pesos no finitos, no se puede cuantizar a Q0.15!\n");
+            return 0;
+        }
+
+        double quantization;
+        double deviation = fixed_deviation_bound(kernel_size, kernel, kernel_q15, &quantization);
+
+        blur_log(ctx, "\nDesviacion maxima frente a la ruta double: %f niveles (cuantizacion de pesos: %f)\n", deviation, quantization);
+    }
+
+    //Coeficientes del filtro recursivo; el kernel_size no interviene en este motor
+    struct iir_coefficients iir;
+
+    if(engine == ENGINE_IIR) {
+
+        if(sigma < 0.5) {
+            perror("El filtro recursivo requiere sigma >= 0.5!\n");
+            return 0;
+        }
+
+        compute_iir_coefficients(sigma, &iir);
+        blur_log(ctx, "\nFiltro recursivo con sigma %f: B=%f b1=%f b2=%f b3=%f\n", sigma, iir.B, iir.b1, iir.b2, iir.b3);
+    }
+
+    unsigned char* blurred_img = out->pixels;
+
+    float* tmp = NULL;
+    float* tmp2 = NULL;
+
+    //El motor separable recorre la imagen por mosaicos con halo; sin tamaño explícito se ajusta a la caché
+    struct tile_counters counters[n_threads];
+    memset(counters, 0, sizeof(counters));
+
+    if(engine == ENGINE_SEPARABLE) {
+
+        //Si hay más hilos que núcleos físicos, los hermanos SMT se reparten la L2
+        int l2_sharers = 1;
+        if(profile && n_threads > profile->physical_cores)
+            l2_sharers = profile->logical_cpus / profile->physical_cores;
+
+        if(tile_w == 0)
+            choose_separable_tile(kernel_size, width, height, l2_sharers, &tile_w, &tile_h);
+
+        blur_log(ctx, "\nMosaicos de %ldx%ld pixeles con halo de %ld\n", tile_w, tile_h, mid_size);
+    }
+
+    //Kernel 1-D desenrollado si hay uno especializado para este tamaño y sigma
+    convolve_1d_fn convolve = select_convolve_1d(&ctx->simd, kernel_size, sigma);
+
+    if(engine == ENGINE_SEPARABLE)
+        blur_log(ctx, "Convolucion 1-D: %s\n", convolve == ctx->simd.convolve_1d ? "generica" : "especializada");
+
+    //Bandas de filas de los motores directo y separable: unas ocho por hilo. En el separable cada banda recalcula
+    //kernel_size - 1 filas de halo, así que se piden al menos 4*kernel_size filas para que no pase de un 25%
+    struct tile_scheduler scheduler;
+
+    if(engine == ENGINE_DIRECT || engine == ENGINE_SEPARABLE) {
+
+        size_t rows = choose_rows_per_tile(height, blur_planes, n_threads, engine == ENGINE_SEPARABLE ? 4*kernel_size : 1);
+        if(!scheduler_init(&scheduler, n_threads, height, blur_planes, rows, params->numa ? pool->worker_node : NULL, &ctx->scheduler)) {
+            perror("Error reservando los buffers del filtro!\n");
+            return 0;
+        }
+
+        blur_log(ctx, "\nBandas de %ld filas: %ld por plano, %ld en total\n", rows, scheduler.bands, scheduler.n_tiles);
+    }
+
+    //En modo NUMA los planos se convierten con el reparto inicial del planificador, para que cada página quede
+    //en el nodo del hilo que la va a leer
+    const struct tile_scheduler* placement = params->numa && (engine == ENGINE_DIRECT || engine == ENGINE_SEPARABLE) ? &scheduler : NULL;
+
+    double convert_start = blur_wall_time();
+
+    struct conversion_job to_planar = { img, &src_planes, 1, n_low != 0, placement, NULL, &ctx->simd };
+    blur_pool_run(pool, conversion_job, &to_planar);
+
+    double deinterleave_time = blur_wall_time() - convert_start;
+
+    if(placement) {
+        struct first_touch_job touch = { &dst_planes, channels + n_low, placement };
+        blur_pool_run(pool, first_touch_job, &touch);
+    }
+
+    //El motor directo lee los pixeles cercanos al borde de franjas con el modo de borde ya aplicado, una por plano
+    struct halo_buffers halo[ENGINE_PLANES];
+
+    if(engine == ENGINE_DIRECT) {
+
+        for(size_t k = 0; k < blur_planes; ++k) {
+
+            struct convolution_args halo_args;
+            memset(&halo_args, 0, sizeof(halo_args));
+            halo_args.img = src_planes.planes[k];
+            halo_args.stride = src_planes.stride;
+            halo_args.width = width;
+            halo_args.height = height;
+            halo_args.channels = 1;
+            halo_args.kernel_size = kernel_size;
+            halo_args.edge = edge;
+            halo_args.edge_value = edge_value;
+
+            if(!build_halo_buffers(&halo_args, &halo[k], &ctx->halo[k])) {
+                perror("Error reservando los buffers del filtro!\n");
+                return 0;
+            }
+        }
+    }
+
+    //Igual que el separable, pero con un intermedio de int16 con FIXED_INTER_BITS bits fraccionarios
+    int16_t* tmp_fixed = NULL;
+
+    if(engine == ENGINE_FIXED) {
+
+        size_t row_len = (size_t)width;
+        tmp_fixed = (int16_t*)scratch_reserve(&ctx->tmp_fixed, sizeof(int16_t) * row_len * (height + 2*mid_size));
+
+        if(tmp_fixed == NULL) {
+            perror("Error reservando los buffers del filtro!\n");
+            return 0;
+        }
+
+        //En modo constante las filas de relleno ya quedan listas; en los demás las copia el motor tras la pasada horizontal
+        int16_t pad = (int16_t)(edge_value * (1 << FIXED_INTER_BITS) + 0.5f);
+
+        for(size_t i = 0; i < row_len * mid_size; ++i) {
+            tmp_fixed[i] = pad;
+            tmp_fixed[row_len * (height + mid_size) + i] = pad;
+        }
+    }
+
+    //El motor FFT procesa la imagen por mosaicos compartidos entre todos los hilos. Los planes y el espectro del
+    //kernel se conservan mientras no cambien el kernel ni las dimensiones
+    if(engine == ENGINE_FFT) {
+
+        size_t key[4] = { kernel_size, (size_t)width, (size_t)height, blur_planes };
+
+        if(ctx->fft_ready && (memcmp(ctx->fft_key, key, sizeof(key)) != 0 || ctx->fft_sigma != sigma)) {
+            fft_context_free(&ctx->fft);
+            ctx->fft_ready = 0;
+        }
+
+        if(!ctx->fft_ready) {
+            if(!fft_context_init(&ctx->fft, kernel, kernel_size, width, height, blur_planes)) {
+                perror("Error reservando los buffers del filtro!\n");
+                return 0;
+            }
+
+            memcpy(ctx->fft_key, key, sizeof(key));
+            ctx->fft_sigma = sigma;
+            ctx->fft_ready = 1;
+        }
+
+        blur_log(ctx, "\nFFT de %ldx%ld, mosaicos de %ldx%ld pixeles\n", ctx->fft.plan_x.n, ctx->fft.plan_y.n, ctx->fft.tile_w, ctx->fft.tile_h);
+    }
+
+    //El motor de cajas alterna entre dos buffers del tamaño de la imagen; el recursivo solo usa uno
+    if(engine == ENGINE_BOX || engine == ENGINE_IIR) {
+
+        tmp = (float*)scratch_reserve(&ctx->tmp, sizeof(float) * width * height);
+        if(engine == ENGINE_BOX)
+            tmp2 = (float*)scratch_reserve(&ctx->tmp2, sizeof(float) * width * height);
+
+        if(tmp == NULL || (engine == ENGINE_BOX && tmp2 == NULL)) {
+            perror("Error reservando los buffers del filtro!\n");
+            return 0;
+        }
+    }
+
+    struct convolution_args args[n_threads];
+
+    struct timeval start, end;
+
+    for (int i = 0; i < n_threads; i++) {
+
+        args[i].src = &src_planes;
+        args[i].dst = &dst_planes;
+        args[i].sums = n_low ? sums : NULL;
+        args[i].blurred_sum = NULL;
+        args[i].n_planes = blur_planes;
+        args[i].scheduler = &scheduler;
+        args[i].stride = src_planes.stride;
+        args[i].width = width;
+        args[i].height = height;
+        args[i].channels = 1;
+        args[i].blur_channels = engine == ENGINE_FFT ? blur_planes : 1;
+        args[i].kernel = kernel;
+        args[i].kernel_size = kernel_size;
+        args[i].n_threads = n_threads;
+        args[i].thread_id = i;
+        args[i].scratch = &ctx->workers[i];
+        args[i].edge = edge;
+        args[i].edge_value = edge_value;
+        args[i].halo = halo;
+        args[i].engine = engine;
+        args[i].kernel_1d = kernel_1d;
+        args[i].convolve = convolve;
+        args[i].tile_w = tile_w;
+        args[i].tile_h = tile_h;
+        args[i].counters = counters;
+        args[i].tmp = tmp;
+        args[i].barrier = &pool->barrier;
+        args[i].tmp2 = tmp2;
+        args[i].iir = iir;
+        args[i].fft = &ctx->fft;
+        args[i].convolve_q15 = ctx->simd.convolve_1d_q15;
+        args[i].kernel_q15 = kernel_q15;
+        args[i].tmp_fixed = tmp_fixed;
+        memcpy(args[i].box_radius, box_radius, sizeof(box_radius));
+
+        //Buffers propios del hilo para el motor
+        size_t bytes[WORKER_SCRATCH_BUFFERS];
+        worker_scratch_sizes(&args[i], bytes);
+
+        for(size_t b = 0; b < WORKER_SCRATCH_BUFFERS; ++b)
+            if(bytes[b] && scratch_reserve(&ctx->workers[i].buffers[b], bytes[b]) == NULL) {
+                perror("Error reservando los buffers del filtro!\n");
+                return 0;
+            }
+    }
+
+    //Calculo de tiempo antes de iniciar operaciones de convolución
+	gettimeofday(&start, NULL);
+
+    //Los hilos del pool ejecutan la convolución
+    blur_pool_run(pool, blur_job, args);
+
+    //Calculo de tiempo después de aplicar convolución a todos los pixeles de la imágen
+    gettimeofday(&end, NULL);
+
+    //Bandas procesadas por cada hilo y cuántas robó a otros
+    if(engine == ENGINE_DIRECT || engine == ENGINE_SEPARABLE) {
+
+        blur_log(ctx, "\n");
+        for(int i = 0; i < n_threads; ++i)
+            blur_log(ctx, "Hilo %d: %ld bandas, %ld robadas\n", i, scheduler.deques[i].executed, scheduler.deques[i].steals);
+    }
+
+    //Ubicación de las páginas del bloque inicial de cada hilo frente al nodo en que corre
+    if(ctx->verbose && placement && pool->worker_node) {
+
+        printf("\n");
+        for(int i = 0; i < n_threads; ++i) {
+
+            size_t first_row, last_row, local = 0, total = 0;
+            scheduler_worker_rows(&scheduler, i, &first_row, &last_row);
+
+            count_local_pages(&src_planes, blur_planes, first_row, last_row, pool->worker_node[i], &local, &total);
+            count_local_pages(&dst_planes, blur_planes, first_row, last_row, pool->worker_node[i], &local, &total);
+
+            printf("Hilo %d (CPU %d, nodo %d): filas %ld-%ld, %ld de %ld paginas en su nodo\n", i, pool->worker_cpu[i],
+                   pool->worker_node[i], first_row, last_row, local, total);
+        }
+    }
+
+    //Tráfico a memoria estimado con los contadores de los mosaicos, frente a escribir y releer
+    //un buffer intermedio en float del tamaño de la imagen
+    if(engine == ENGINE_SEPARABLE && ctx->verbose) {
+
+        struct tile_counters total = {0, 0, 0, 0, 0};
+        for(int i = 0; i < n_threads; ++i) {
+            total.tiles += counters[i].tiles;
+            total.halo_rows += counters[i].halo_rows;
+            total.input_bytes += counters[i].input_bytes;
+            total.output_bytes += counters[i].output_bytes;
+            total.scratch_bytes += counters[i].scratch_bytes;
+        }
+
+        double untiled = (double)width * height * blur_planes * (2.0 + 2.0 * sizeof(float));
+        double tiled = (double)total.input_bytes + total.output_bytes;
+
+        //El buffer del mosaico solo se descuenta si cabe en la caché L2
+        long l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+        if(l2 <= 0 || (tile_h + 2*mid_size) * tile_w * sizeof(float) > (size_t)l2)
+            tiled += total.scratch_bytes;
+
+        printf("\nMosaicos procesados: %ld, filas de halo recalculadas: %ld\n", total.tiles, total.halo_rows);
+        printf("Trafico estimado a memoria: %.1f MB sin mosaicos, %.1f MB con mosaicos (ahorro %.1f MB)\n",
+               untiled / 1e6, tiled / 1e6, (untiled - tiled) / 1e6);
+    }
+
+    //Volvemos al formato entrelazado con el filtro aplicado
+    convert_start = blur_wall_time();
+
+    if(opaque)
+        for(size_t y = 0; y < (size_t)height; ++y)
+            memcpy(dst_planes.planes[channels - 1] + y*dst_planes.stride, src_planes.planes[channels - 1] + y*src_planes.stride, width);
+
+    struct conversion_job to_image = { blurred_img, &dst_planes, 0, n_low != 0, placement, sums, &ctx->simd };
+    blur_pool_run(pool, conversion_job, &to_image);
+
+    double interleave_time = blur_wall_time() - convert_start;
+
+    blur_log(ctx, "\nConversion a planos: %f s, de vuelta a entrelazado: %f s (stride de %ld bytes)\n",
+             deinterleave_time, interleave_time, src_planes.stride);
+
+    out->width = width;
+    out->height = height;
+    out->channels = channels;
+
+    //Tiempo total(Elapsed Wall time)
+    long elapsed_seconds = (end.tv_sec - start.tv_sec);
+    long micros = ((elapsed_seconds * 1000000) + end.tv_usec) - (start.tv_usec);
+
+    ctx->seconds = (double)micros / pow(10,6);
+
+    return 1;
+}
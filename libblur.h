@@ -0,0 +1,105 @@
+//libblur: filtro gaussiano multihilo sobre imágenes entrelazadas de 8 bits (gris, gris con alfa, RGB o RGBA)
+//
+//Un blur_context es dueño del pool de hilos, de los kernels ya generados y de todos los buffers de trabajo, que
+//se conservan entre llamadas. Una vez difuminada una imagen de cierto tamaño con cierto motor y kernel, las
+//siguientes iguales no reservan memoria: el llamador solo pone el buffer de salida.
+//
+//    struct blur_params params = { 9, DEFAULT_SIGMA, ENGINE_AUTO, blur_detect_simd_level(), 0, 0, EDGE_CLAMP, 0.0f, 0, NULL };
+//    struct blur_context* ctx = blur_context_create(4, &params);
+//    struct blur_frame in = { pixeles, ancho, alto, canales };
+//    struct blur_frame out = { salida, 0, 0, 0 };               //ancho * alto * canales bytes
+//    blur_image(ctx, &in, &out, NULL);
+//    blur_context_destroy(ctx);
+//
+//Biblioteca estática o compartida: ver LEEME.txt
+#ifndef LIBBLUR_H
+#define LIBBLUR_H
+
+#include <stddef.h>
+
+//Conjuntos de instrucciones para los kernels de convolución 1-D, de menor a mayor ancho
+enum simd_level {
+    SIMD_SCALAR,
+    SIMD_SSE4,
+    SIMD_AVX2,
+    SIMD_AVX512,
+};
+
+extern const char* blur_simd_names[SIMD_AVX512 + 1];
+
+//Modos de borde: qué valor toman los pixeles fuera de la imagen
+enum edge_mode {
+    EDGE_CLAMP,         //Repite el pixel del borde
+    EDGE_MIRROR,        //Refleja la imagen sin repetir el pixel del borde
+    EDGE_WRAP,          //Toma los pixeles del lado opuesto
+    EDGE_CONSTANT,      //Usa un valor fijo
+};
+
+extern const char* blur_edge_names[EDGE_CONSTANT + 1];
+
+//Motores de convolución disponibles
+enum blur_engine {
+    ENGINE_AUTO,        //Selección automática según el kernel
+    ENGINE_DIRECT,      //Convolución directa KxK (motor de referencia)
+    ENGINE_SEPARABLE,   //Dos pasadas 1-D: horizontal y luego vertical
+    ENGINE_BOX,         //Cascada de tres filtros de caja, costo constante por pixel
+    ENGINE_IIR,         //Filtro recursivo de Young-van Vliet, costo constante para cualquier sigma
+    ENGINE_FFT,         //Convolución en frecuencia por mosaicos con overlap-add
+    ENGINE_FIXED,       //Separable en punto fijo con pesos Q0.15 y acumulación en 32 bits
+};
+
+extern const char* blur_engine_names[ENGINE_FIXED + 1];
+
+//Desviación estándar por defecto del kernel gaussiano
+#define DEFAULT_SIGMA 15.0
+
+//Mayor tamaño de kernel que acepta blur_image: el motor directo guarda el kernel 2-D completo
+#define MAX_KERNEL_SIZE 2047
+
+//Máximo de canales de una imagen de stb_image
+#define MAX_PLANES 4
+
+//Parámetros del filtro, comunes a todas las imágenes de una ejecución
+struct blur_params {
+    size_t kernel_size;
+    double sigma;
+    enum blur_engine engine;
+    enum simd_level simd;       //Kernels de convolución y de conversión de cada llamada, no globales al proceso
+    size_t tile_w;              //0 para elegirlo según la caché
+    size_t tile_h;
+    enum edge_mode edge;
+    float edge_value;
+    int numa;                   //Primer acceso a los planos por el hilo que procesará cada banda
+    struct host_profile* profile;   //Perfil del equipo con hilos "auto"; NULL si se dieron a mano
+};
+
+//Imagen entrelazada como la entrega stb_image: width * height pixeles de channels bytes, fila tras fila
+struct blur_frame {
+    unsigned char* pixels;
+    int width;
+    int height;
+    int channels;
+};
+
+//Pool de hilos y perfil del equipo: opacos fuera de la librería; la línea de comandos los maneja con
+//libblur_internal.h
+struct thread_pool;
+struct host_profile;
+
+//Contexto del filtro; su contenido es privado de la librería
+struct blur_context;
+
+struct blur_context* blur_context_create(int n_threads, const struct blur_params* defaults);
+void blur_context_destroy(struct blur_context* ctx);
+struct thread_pool* blur_context_pool(struct blur_context* ctx);
+void blur_context_set_verbose(struct blur_context* ctx, int verbose);
+double blur_context_seconds(const struct blur_context* ctx);
+int blur_image(struct blur_context* ctx, const struct blur_frame* in, struct blur_frame* out, const struct blur_params* params);
+
+//Fija cada hilo i del pool del contexto a la CPU cpus[i], del nodo NUMA nodes[i]; 0 si no hay memoria
+int blur_context_pin(struct blur_context* ctx, const int* cpus, const int* nodes);
+
+//Kernels SIMD más anchos que soporta la CPU
+enum simd_level blur_detect_simd_level(void);
+
+#endif
@@ -0,0 +1,64 @@
+//Partes de libblur que solo usa la línea de comandos (blur_effect.c): el pool de hilos del contexto, la
+//topología NUMA y la fijación de hilos, el perfil del equipo y el reloj. No se instala junto a libblur.h
+#ifndef LIBBLUR_INTERNAL_H
+#define LIBBLUR_INTERNAL_H
+
+#include "libblur.h"
+
+//Tarea que ejecutan todos los hilos del pool: recibe el argumento compartido, el id del hilo y el total de hilos
+typedef void (*pool_job_fn)(void* arg, int thread_id, int n_threads);
+
+//Política de fijación de los hilos del pool a CPUs
+enum affinity_policy {AFFINITY_NONE, AFFINITY_COMPACT, AFFINITY_SCATTER, AFFINITY_LIST};
+
+extern const char* blur_affinity_names[AFFINITY_LIST + 1];
+
+//Topología NUMA leída de /sys: el nodo de cada CPU en línea
+struct numa_topology {
+    int n_nodes;
+    int n_cpus;
+    int* cpus;                  //CPUs en línea ordenadas por nodo y dentro de cada nodo
+    int* cpu_node;              //Nodo de cada CPU, indexado por número de CPU
+    int max_cpu;
+};
+
+//Perfil del equipo con que se eligen la cantidad de hilos y el mosaico con "auto"
+struct host_profile {
+    int logical_cpus;           //CPUs en las que puede correr el proceso
+    int physical_cores;         //Núcleos físicos distintos entre esas CPUs
+    double quota_cpus;          //Cuota de CPU del cgroup, en CPUs; 0 si no hay
+    enum simd_level simd;       //Kernels con que se midió el costo de un tap
+    double bandwidth_1;         //GB/s de memcpy con un hilo
+    double bandwidth_all;       //GB/s de memcpy con un hilo por núcleo a la vez
+    double tap_ns;              //Costo de un tap de la convolución 1-D
+    double dispatch_us;         //Costo por hilo de lanzar una tarea al pool y esperarla
+    long crossover[2];          //Cruce con el FFT sin y con kernel separable; 0 si no gana, -1 si no se ha medido
+    int dirty;                  //Hay mediciones que no están en el archivo
+};
+
+//Pool de hilos del contexto (blur_context_pool)
+void blur_pool_run(struct thread_pool* pool, pool_job_fn job, void* arg);
+void blur_pool_set_active(struct thread_pool* pool, int n);
+int blur_pool_threads(const struct thread_pool* pool);
+int blur_pool_active(const struct thread_pool* pool);
+
+//Topología y fijación de hilos
+void blur_read_numa_topology(struct numa_topology* t);
+void blur_free_numa_topology(struct numa_topology* t);
+int blur_assign_worker_cpus(const struct numa_topology* t, enum affinity_policy policy, const char* list, int n_workers, int* cpus);
+
+//Kernels SIMD
+void blur_benchmark_kernels(enum simd_level level);
+
+//Perfil del equipo
+void blur_detect_host(struct host_profile* p, enum simd_level simd);
+void blur_calibrate_host(struct host_profile* p);
+void blur_default_profile_path(char* path, size_t size);
+int blur_load_host_profile(const char* path, struct host_profile* p);
+int blur_save_host_profile(const char* path, struct host_profile* p);
+int blur_host_usable_threads(const struct host_profile* p);
+
+//Reloj de pared en segundos
+double blur_wall_time(void);
+
+#endif
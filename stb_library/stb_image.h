@@ -376,6 +376,15 @@ typedef struct
 STBIDEF stbi_uc *stbi_load_from_memory   (stbi_uc           const *buffer, int len   , int *x, int *y, int *channels_in_file, int desired_channels);
 STBIDEF stbi_uc *stbi_load_from_callbacks(stbi_io_callbacks const *clbk  , void *user, int *x, int *y, int *channels_in_file, int desired_channels);
 
+// baseline JPEGs with restart markers (a DRI segment) are entropy-decoded in
+// parallel by the caller's threads: 'parallel' must call task(task_arg, i) once
+// for every i in [0, count), from any threads, and return when all calls have
+// finished. Everything else is decoded exactly like stbi_load_from_memory.
+typedef void stbi_parallel_func(void *context, int count, void (*task)(void *task_arg, int index), void *task_arg);
+
+STBIDEF stbi_uc *stbi_load_from_memory_parallel(stbi_uc const *buffer, int len, int *x, int *y, int *channels_in_file, int desired_channels,
+                                                stbi_parallel_func *parallel, void *parallel_context);
+
 #ifndef STBI_NO_STDIO
 STBIDEF stbi_uc *stbi_load            (char const *filename, int *x, int *y, int *channels_in_file, int desired_channels);
 STBIDEF stbi_uc *stbi_load_from_file  (FILE *f, int *x, int *y, int *channels_in_file, int desired_channels);
@@ -754,6 +763,9 @@ typedef struct
 
    stbi_uc *img_buffer, *img_buffer_end;
    stbi_uc *img_buffer_original, *img_buffer_original_end;
+
+   stbi_parallel_func *parallel;
+   void *parallel_context;
 } stbi__context;
 
 
@@ -764,6 +776,7 @@ static void stbi__start_mem(stbi__context *s, stbi_uc const *buffer, int len)
 {
    s->io.read = NULL;
    s->read_from_callbacks = 0;
+   s->parallel = NULL;
    s->img_buffer = s->img_buffer_original = (stbi_uc *) buffer;
    s->img_buffer_end = s->img_buffer_original_end = (stbi_uc *) buffer+len;
 }
@@ -775,6 +788,7 @@ static void stbi__start_callbacks(stbi__context *s, stbi_io_callbacks *c, void *
    s->io_user_data = user;
    s->buflen = sizeof(s->buffer_start);
    s->read_from_callbacks = 1;
+   s->parallel = NULL;
    s->img_buffer_original = s->buffer_start;
    stbi__refill_buffer(s);
    s->img_buffer_original_end = s->img_buffer_end;
@@ -1335,6 +1349,16 @@ STBIDEF stbi_uc *stbi_load_from_memory(stbi_uc const *buffer, int len, int *x, i
    return stbi__load_and_postprocess_8bit(&s,x,y,comp,req_comp);
 }
 
+STBIDEF stbi_uc *stbi_load_from_memory_parallel(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp,
+                                                stbi_parallel_func *parallel, void *parallel_context)
+{
+   stbi__context s;
+   stbi__start_mem(&s,buffer,len);
+   s.parallel = parallel;
+   s.parallel_context = parallel_context;
+   return stbi__load_and_postprocess_8bit(&s,x,y,comp,req_comp);
+}
+
 STBIDEF stbi_uc *stbi_load_from_callbacks(stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *comp, int req_comp)
 {
    stbi__context s;
@@ -2831,8 +2855,154 @@ static void stbi__jpeg_reset(stbi__jpeg *j)
    // since we don't even allow 1<<30 pixels
 }
 
+// parallel decoding of baseline scans with restart markers: the entropy-coded
+// segment is indexed first, then runs of whole restart intervals are decoded by
+// the caller's threads, each with its own copy of the decoder state. Intervals
+// cover disjoint MCUs, so the workers write disjoint blocks of img_comp[].data.
+#define STBI__PARALLEL_MIN_MCUS  512   // smallest run of MCUs worth a task
+
+typedef struct
+{
+   stbi__jpeg *z;
+   stbi_uc **start;     // first byte of every restart interval
+   stbi_uc **end;       // first byte after every restart interval
+   stbi_uc *failed;     // one flag per task
+   int intervals, per_task, mcus, mcu_w;
+} stbi__jpeg_intervals;
+
+// decode the MCU at (i,j); with a single component in the scan every block is an MCU
+static int stbi__jpeg_decode_mcu(stbi__jpeg *z, int i, int j)
+{
+   STBI_SIMD_ALIGN(short, data[64]);
+   int k,x,y;
+   if (z->scan_n == 1) {
+      int n = z->order[0];
+      int ha = z->img_comp[n].ha;
+      if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+      z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
+      return 1;
+   }
+   for (k=0; k < z->scan_n; ++k) {
+      int n = z->order[k];
+      for (y=0; y < z->img_comp[n].v; ++y) {
+         for (x=0; x < z->img_comp[n].h; ++x) {
+            int x2 = (i*z->img_comp[n].h + x)*8;
+            int y2 = (j*z->img_comp[n].v + y)*8;
+            int ha = z->img_comp[n].ha;
+            if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+            z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data);
+         }
+      }
+   }
+   return 1;
+}
+
+static void stbi__jpeg_interval_task(void *arg, int index)
+{
+   stbi__jpeg_intervals *iv = (stbi__jpeg_intervals *) arg;
+   int first = index * iv->per_task;
+   int last = first + iv->per_task < iv->intervals ? first + iv->per_task : iv->intervals;
+   stbi__context s;
+   stbi__jpeg *z = (stbi__jpeg *) stbi__malloc(sizeof(stbi__jpeg));
+   int k, m;
+   if (!z) { iv->failed[index] = 1; return; }
+   memcpy(z, iv->z, sizeof(*z));
+   memset(&s, 0, sizeof(s));
+   z->s = &s;
+   for (k=first; k < last && !iv->failed[index]; ++k) {
+      int m_end = (k+1) * z->restart_interval < iv->mcus ? (k+1) * z->restart_interval : iv->mcus;
+      s.img_buffer = iv->start[k];
+      s.img_buffer_end = iv->end[k];
+      stbi__jpeg_reset(z);
+      for (m = k * z->restart_interval; m < m_end; ++m) {
+         if (!stbi__jpeg_decode_mcu(z, m % iv->mcu_w, m / iv->mcu_w)) {
+            iv->failed[index] = 1;
+            break;
+         }
+      }
+   }
+   STBI_FREE(z);
+}
+
+// find the start of every restart interval and the marker that ends the scan;
+// returns 0 if the RSTn markers don't match the restart interval
+static int stbi__jpeg_index_intervals(stbi__jpeg *z, stbi__jpeg_intervals *iv)
+{
+   stbi_uc *p = z->s->img_buffer, *e = z->s->img_buffer_end, *q;
+   int n = 0;
+   iv->start[0] = p;
+   while (p < e) {
+      if (*p != 0xff) { ++p; continue; }
+      q = p + 1;
+      while (q < e && *q == 0xff) ++q; // fill bytes
+      if (q >= e) return 0;
+      if (*q == 0x00) { p = q + 1; continue; }
+      iv->end[n++] = p;
+      if (!STBI__RESTART(*q)) {
+         if (n != iv->intervals) return 0;
+         z->marker = *q;
+         z->s->img_buffer = q + 1;
+         return 1;
+      }
+      if (*q != 0xd0 + ((n-1) & 7) || n >= iv->intervals) return 0;
+      iv->start[n] = p = q + 1;
+   }
+   return 0;
+}
+
+// returns -1 if the scan should be decoded sequentially instead
+static int stbi__parse_entropy_coded_data_parallel(stbi__jpeg *z)
+{
+   stbi__jpeg_intervals iv;
+   stbi_uc *scan_start = z->s->img_buffer;
+   int tasks, k, ok = 1;
+   if (z->scan_n == 1) {
+      int n = z->order[0];
+      iv.mcu_w = (z->img_comp[n].x+7) >> 3;
+      iv.mcus = iv.mcu_w * ((z->img_comp[n].y+7) >> 3);
+   } else {
+      iv.mcu_w = z->img_mcu_x;
+      iv.mcus = z->img_mcu_x * z->img_mcu_y;
+   }
+   iv.intervals = (iv.mcus + z->restart_interval - 1) / z->restart_interval;
+   iv.per_task = (STBI__PARALLEL_MIN_MCUS + z->restart_interval - 1) / z->restart_interval;
+   tasks = (iv.intervals + iv.per_task - 1) / iv.per_task;
+   if (tasks < 2) return -1;
+
+   iv.z = z;
+   iv.start = (stbi_uc **) stbi__malloc_mad2(iv.intervals, 2 * sizeof(stbi_uc *), 0);
+   iv.failed = (stbi_uc *) stbi__malloc(tasks);
+   if (!iv.start || !iv.failed) {
+      STBI_FREE(iv.start);
+      STBI_FREE(iv.failed);
+      return -1;
+   }
+   iv.end = iv.start + iv.intervals;
+   memset(iv.failed, 0, tasks);
+
+   if (!stbi__jpeg_index_intervals(z, &iv)) {
+      // truncated scan or unexpected markers: let the sequential decoder deal with it
+      z->s->img_buffer = scan_start;
+      z->marker = STBI__MARKER_none;
+      STBI_FREE(iv.start);
+      STBI_FREE(iv.failed);
+      return -1;
+   }
+   z->s->parallel(z->s->parallel_context, tasks, stbi__jpeg_interval_task, &iv);
+   for (k=0; k < tasks; ++k)
+      if (iv.failed[k]) ok = 0;
+   STBI_FREE(iv.start);
+   STBI_FREE(iv.failed);
+   // the workers' failure reasons may be thread-local, so report one here
+   return ok ? 1 : stbi__err("bad restart interval", "Corrupt JPEG");
+}
+
 static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
 {
+   if (!z->progressive && z->restart_interval && z->s->parallel && !z->s->read_from_callbacks) {
+      int r = stbi__parse_entropy_coded_data_parallel(z);
+      if (r >= 0) return r;
+   }
    stbi__jpeg_reset(z);
    if (!z->progressive) {
       if (z->scan_n == 1) {
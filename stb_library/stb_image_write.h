@@ -31,6 +31,9 @@ BUILDING:
    unsigned char * my_compress(unsigned char *data, int data_len, int *out_len, int quality);
    The returned data will be freed with STBIW_FREE() (free() by default),
    so it must be heap allocated with STBIW_MALLOC() (malloc() by default),
+   You can #define STBIW_WRITE_BUFFER_SIZE to change how many bytes the BMP, TGA,
+   HDR and JPEG writers collect before each call to the write callback (16384
+   by default; the buffer lives in the writer's stack frame).
 
 UNICODE:
 
@@ -64,6 +67,25 @@ USAGE:
    where the callback is:
       void stbi_write_func(void *context, void *data, int size);
 
+   JPEG can also be entropy-coded in parallel by the caller's threads:
+
+     int stbi_write_jpg_parallel(char const *filename, int w, int h, int comp, const void *data, int quality,
+                                 int bands, stbi_write_parallel_func *parallel, void *parallel_context);
+     int stbi_write_jpg_parallel_to_func(stbi_write_func *func, void *context, int w, int h, int comp,
+                                 const void *data, int quality, int bands, stbi_write_parallel_func *parallel,
+                                 void *parallel_context);
+
+   The image is split into about 'bands' bands of whole MCU rows. Each band is
+   coded into its own buffer with fresh DC predictors, and the buffers are
+   concatenated in order with RSTn markers between them and a DRI segment in the
+   header, so the result is still a baseline JPEG. 'parallel' must call
+   task(task_arg, i) once for every i in [0, count), from any threads, and return
+   when all calls have finished:
+
+      void stbi_write_parallel_func(void *context, int count, void (*task)(void *task_arg, int index), void *task_arg);
+
+   With bands <= 1 or parallel == NULL the output is identical to stbi_write_jpg.
+
    You can configure it with these global variables:
       int stbi_write_tga_with_rle;             // defaults to true; set to 0 to disable RLE
       int stbi_write_png_compression_level;    // defaults to 8; set to higher for more compression
@@ -191,6 +213,15 @@ STBIWDEF int stbi_write_tga_to_func(stbi_write_func *func, void *context, int w,
 STBIWDEF int stbi_write_hdr_to_func(stbi_write_func *func, void *context, int w, int h, int comp, const float *data);
 STBIWDEF int stbi_write_jpg_to_func(stbi_write_func *func, void *context, int x, int y, int comp, const void  *data, int quality);
 
+typedef void stbi_write_parallel_func(void *context, int count, void (*task)(void *task_arg, int index), void *task_arg);
+
+STBIWDEF int stbi_write_jpg_parallel_to_func(stbi_write_func *func, void *context, int x, int y, int comp, const void *data, int quality,
+                                             int bands, stbi_write_parallel_func *parallel, void *parallel_context);
+#ifndef STBI_WRITE_NO_STDIO
+STBIWDEF int stbi_write_jpg_parallel(char const *filename, int x, int y, int comp, const void *data, int quality,
+                                     int bands, stbi_write_parallel_func *parallel, void *parallel_context);
+#endif
+
 STBIWDEF void stbi_flip_vertically_on_write(int flip_boolean);
 
 #endif//INCLUDE_STB_IMAGE_WRITE_H
@@ -263,10 +294,18 @@ STBIWDEF void stbi_flip_vertically_on_write(int flag)
    stbi__flip_vertically_on_write = flag;
 }
 
+// output is collected in the context and handed to the callback in chunks of
+// this many bytes, instead of once per byte or pixel
+#ifndef STBIW_WRITE_BUFFER_SIZE
+#define STBIW_WRITE_BUFFER_SIZE 16384
+#endif
+
 typedef struct
 {
    stbi_write_func *func;
    void *context;
+   int buf_used;
+   unsigned char buffer[STBIW_WRITE_BUFFER_SIZE];
 } stbi__write_context;
 
 // initialize a callback-based context
@@ -274,6 +313,28 @@ static void stbi__start_write_callbacks(stbi__write_context *s, stbi_write_func
 {
    s->func    = c;
    s->context = context;
+   s->buf_used = 0;
+}
+
+static void stbiw__write_flush(stbi__write_context *s)
+{
+   if (s->buf_used) {
+      s->func(s->context, s->buffer, s->buf_used);
+      s->buf_used = 0;
+   }
+}
+
+static void stbiw__write(stbi__write_context *s, const void *data, int size)
+{
+   if (s->buf_used + size > STBIW_WRITE_BUFFER_SIZE) {
+      stbiw__write_flush(s);
+      if (size > STBIW_WRITE_BUFFER_SIZE) {
+         s->func(s->context, (void *) data, size);
+         return;
+      }
+   }
+   memcpy(s->buffer + s->buf_used, data, size);
+   s->buf_used += size;
 }
 
 #ifndef STBI_WRITE_NO_STDIO
@@ -335,6 +396,7 @@ static int stbi__start_write_file(stbi__write_context *s, const char *filename)
 
 static void stbi__end_write_file(stbi__write_context *s)
 {
+   stbiw__write_flush(s);
    fclose((FILE *)s->context);
 }
 
@@ -349,13 +411,13 @@ static void stbiw__writefv(stbi__write_context *s, const char *fmt, va_list v)
       switch (*fmt++) {
          case ' ': break;
          case '1': { unsigned char x = STBIW_UCHAR(va_arg(v, int));
-                     s->func(s->context,&x,1);
+                     stbiw__write(s, &x,1);
                      break; }
          case '2': { int x = va_arg(v,int);
                      unsigned char b[2];
                      b[0] = STBIW_UCHAR(x);
                      b[1] = STBIW_UCHAR(x>>8);
-                     s->func(s->context,b,2);
+                     stbiw__write(s, b,2);
                      break; }
          case '4': { stbiw_uint32 x = va_arg(v,int);
                      unsigned char b[4];
@@ -363,7 +425,7 @@ static void stbiw__writefv(stbi__write_context *s, const char *fmt, va_list v)
                      b[1]=STBIW_UCHAR(x>>8);
                      b[2]=STBIW_UCHAR(x>>16);
                      b[3]=STBIW_UCHAR(x>>24);
-                     s->func(s->context,b,4);
+                     stbiw__write(s, b,4);
                      break; }
          default:
             STBIW_ASSERT(0);
@@ -382,14 +444,18 @@ static void stbiw__writef(stbi__write_context *s, const char *fmt, ...)
 
 static void stbiw__putc(stbi__write_context *s, unsigned char c)
 {
-   s->func(s->context, &c, 1);
+   if (s->buf_used == STBIW_WRITE_BUFFER_SIZE)
+      stbiw__write_flush(s);
+   s->buffer[s->buf_used++] = c;
 }
 
 static void stbiw__write3(stbi__write_context *s, unsigned char a, unsigned char b, unsigned char c)
 {
-   unsigned char arr[3];
-   arr[0] = a; arr[1] = b; arr[2] = c;
-   s->func(s->context, arr, 3);
+   if (s->buf_used + 3 > STBIW_WRITE_BUFFER_SIZE)
+      stbiw__write_flush(s);
+   s->buffer[s->buf_used++] = a;
+   s->buffer[s->buf_used++] = b;
+   s->buffer[s->buf_used++] = c;
 }
 
 static void stbiw__write_pixel(stbi__write_context *s, int rgb_dir, int comp, int write_alpha, int expand_mono, unsigned char *d)
@@ -398,7 +464,7 @@ static void stbiw__write_pixel(stbi__write_context *s, int rgb_dir, int comp, in
    int k;
 
    if (write_alpha < 0)
-      s->func(s->context, &d[comp - 1], 1);
+      stbiw__write(s, &d[comp - 1], 1);
 
    switch (comp) {
       case 2: // 2 pixels = mono + alpha, alpha is written separately, so same as 1-channel case
@@ -406,7 +472,7 @@ static void stbiw__write_pixel(stbi__write_context *s, int rgb_dir, int comp, in
          if (expand_mono)
             stbiw__write3(s, d[0], d[0], d[0]); // monochrome bmp
          else
-            s->func(s->context, d, 1);  // monochrome TGA
+            stbiw__write(s, d, 1);  // monochrome TGA
          break;
       case 4:
          if (!write_alpha) {
@@ -422,7 +488,7 @@ static void stbiw__write_pixel(stbi__write_context *s, int rgb_dir, int comp, in
          break;
    }
    if (write_alpha > 0)
-      s->func(s->context, &d[comp - 1], 1);
+      stbiw__write(s, &d[comp - 1], 1);
 }
 
 static void stbiw__write_pixels(stbi__write_context *s, int rgb_dir, int vdir, int x, int y, int comp, void *data, int write_alpha, int scanline_pad, int expand_mono)
@@ -447,7 +513,7 @@ static void stbiw__write_pixels(stbi__write_context *s, int rgb_dir, int vdir, i
          unsigned char *d = (unsigned char *) data + (j*x+i)*comp;
          stbiw__write_pixel(s, rgb_dir, comp, write_alpha, expand_mono, d);
       }
-      s->func(s->context, &zero, scanline_pad);
+      stbiw__write(s, &zero, scanline_pad);
    }
 }
 
@@ -477,8 +543,11 @@ static int stbi_write_bmp_core(stbi__write_context *s, int x, int y, int comp, c
 STBIWDEF int stbi_write_bmp_to_func(stbi_write_func *func, void *context, int x, int y, int comp, const void *data)
 {
    stbi__write_context s;
+   int r;
    stbi__start_write_callbacks(&s, func, context);
-   return stbi_write_bmp_core(&s, x, y, comp, data);
+   r = stbi_write_bmp_core(&s, x, y, comp, data);
+   stbiw__write_flush(&s);
+   return r;
 }
 
 #ifndef STBI_WRITE_NO_STDIO
@@ -557,13 +626,13 @@ static int stbi_write_tga_core(stbi__write_context *s, int x, int y, int comp, v
 
             if (diff) {
                unsigned char header = STBIW_UCHAR(len - 1);
-               s->func(s->context, &header, 1);
+               stbiw__write(s, &header, 1);
                for (k = 0; k < len; ++k) {
                   stbiw__write_pixel(s, -1, comp, has_alpha, 0, begin + k * comp);
                }
             } else {
                unsigned char header = STBIW_UCHAR(len - 129);
-               s->func(s->context, &header, 1);
+               stbiw__write(s, &header, 1);
                stbiw__write_pixel(s, -1, comp, has_alpha, 0, begin);
             }
          }
@@ -575,8 +644,11 @@ static int stbi_write_tga_core(stbi__write_context *s, int x, int y, int comp, v
 STBIWDEF int stbi_write_tga_to_func(stbi_write_func *func, void *context, int x, int y, int comp, const void *data)
 {
    stbi__write_context s;
+   int r;
    stbi__start_write_callbacks(&s, func, context);
-   return stbi_write_tga_core(&s, x, y, comp, (void *) data);
+   r = stbi_write_tga_core(&s, x, y, comp, (void *) data);
+   stbiw__write_flush(&s);
+   return r;
 }
 
 #ifndef STBI_WRITE_NO_STDIO
@@ -619,16 +691,16 @@ static void stbiw__write_run_data(stbi__write_context *s, int length, unsigned c
 {
    unsigned char lengthbyte = STBIW_UCHAR(length+128);
    STBIW_ASSERT(length+128 <= 255);
-   s->func(s->context, &lengthbyte, 1);
-   s->func(s->context, &databyte, 1);
+   stbiw__write(s, &lengthbyte, 1);
+   stbiw__write(s, &databyte, 1);
 }
 
 static void stbiw__write_dump_data(stbi__write_context *s, int length, unsigned char *data)
 {
    unsigned char lengthbyte = STBIW_UCHAR(length);
    STBIW_ASSERT(length <= 128); // inconsistent with spec but consistent with official code
-   s->func(s->context, &lengthbyte, 1);
-   s->func(s->context, data, length);
+   stbiw__write(s, &lengthbyte, 1);
+   stbiw__write(s, data, length);
 }
 
 static void stbiw__write_hdr_scanline(stbi__write_context *s, int width, int ncomp, unsigned char *scratch, float *scanline)
@@ -655,7 +727,7 @@ static void stbiw__write_hdr_scanline(stbi__write_context *s, int width, int nco
                     break;
          }
          stbiw__linear_to_rgbe(rgbe, linear);
-         s->func(s->context, rgbe, 4);
+         stbiw__write(s, rgbe, 4);
       }
    } else {
       int c,r;
@@ -678,7 +750,7 @@ static void stbiw__write_hdr_scanline(stbi__write_context *s, int width, int nco
          scratch[x + width*3] = rgbe[3];
       }
 
-      s->func(s->context, scanlineheader, 4);
+      stbiw__write(s, scanlineheader, 4);
 
       /* RLE each component separately */
       for (c=0; c < 4; c++) {
@@ -730,14 +802,14 @@ static int stbi_write_hdr_core(stbi__write_context *s, int x, int y, int comp, f
       int i, len;
       char buffer[128];
       char header[] = "#?RADIANCE\n# Written by stb_image_write.h\nFORMAT=32-bit_rle_rgbe\n";
-      s->func(s->context, header, sizeof(header)-1);
+      stbiw__write(s, header, sizeof(header)-1);
 
 #ifdef __STDC_WANT_SECURE_LIB__
       len = sprintf_s(buffer, sizeof(buffer), "EXPOSURE=          1.0000000000000\n\n-Y %d +X %d\n", y, x);
 #else
       len = sprintf(buffer, "EXPOSURE=          1.0000000000000\n\n-Y %d +X %d\n", y, x);
 #endif
-      s->func(s->context, buffer, len);
+      stbiw__write(s, buffer, len);
 
       for(i=0; i < y; i++)
          stbiw__write_hdr_scanline(s, x, comp, scratch, data + comp*x*(stbi__flip_vertically_on_write ? y-1-i : i));
@@ -749,8 +821,11 @@ static int stbi_write_hdr_core(stbi__write_context *s, int x, int y, int comp, f
 STBIWDEF int stbi_write_hdr_to_func(stbi_write_func *func, void *context, int x, int y, int comp, const float *data)
 {
    stbi__write_context s;
+   int r;
    stbi__start_write_callbacks(&s, func, context);
-   return stbi_write_hdr_core(&s, x, y, comp, (float *) data);
+   r = stbi_write_hdr_core(&s, x, y, comp, (float *) data);
+   stbiw__write_flush(&s);
+   return r;
 }
 
 #ifndef STBI_WRITE_NO_STDIO
@@ -1271,7 +1346,7 @@ static void stbiw__jpg_calcBits(int val, unsigned short bits[2]) {
    bits[0] = val & ((1<<bits[1])-1);
 }
 
-static int stbiw__jpg_processDU(stbi__write_context *s, int *bitBuf, int *bitCnt, float *CDU, int du_stride, float *fdtbl, int DC, const unsigned short HTDC[256][2], const unsigned short HTAC[256][2]) {
+static int stbiw__jpg_processDU(stbi__write_context *s, int *bitBuf, int *bitCnt, float *CDU, int du_stride, const float *fdtbl, int DC, const unsigned short HTDC[256][2], const unsigned short HTAC[256][2]) {
    const unsigned short EOB[2] = { HTAC[0x00][0], HTAC[0x00][1] };
    const unsigned short M16zeroes[2] = { HTAC[0xF0][0], HTAC[0xF0][1] };
    int dataOff, i, j, n, diff, end0pos, x, y;
@@ -1341,7 +1416,150 @@ static int stbiw__jpg_processDU(stbi__write_context *s, int *bitBuf, int *bitCnt
    return DU[0];
 }
 
-static int stbi_write_jpg_core(stbi__write_context *s, int width, int height, int comp, const void* data, int quality) {
+// Everything the MCU loop needs, shared read-only by the bands of a parallel encode
+typedef struct
+{
+   const unsigned char *data;
+   int width, height, comp, subsample;
+   const float *fdtbl_Y, *fdtbl_UV;
+   const unsigned short (*YDC_HT)[2], (*UVDC_HT)[2], (*YAC_HT)[2], (*UVAC_HT)[2];
+} stbiw__jpg_encoder;
+
+// Encodes MCU rows [first_row, last_row) starting from zero DC predictors, then pads
+// the last byte with 1 bits. Called once for the whole image, or once per restart interval.
+static void stbiw__jpg_encode_rows(stbi__write_context *s, const stbiw__jpg_encoder *e, int first_row, int last_row)
+{
+   static const unsigned short fillBits[] = {0x7F, 7};
+   const unsigned short (*YDC_HT)[2] = e->YDC_HT, (*UVDC_HT)[2] = e->UVDC_HT;
+   const unsigned short (*YAC_HT)[2] = e->YAC_HT, (*UVAC_HT)[2] = e->UVAC_HT;
+   const float *fdtbl_Y = e->fdtbl_Y, *fdtbl_UV = e->fdtbl_UV;
+   int width = e->width, height = e->height, comp = e->comp;
+   int row, col;
+   int DCY=0, DCU=0, DCV=0;
+   int bitBuf=0, bitCnt=0;
+   // comp == 2 is grey+alpha (alpha is ignored)
+   int ofsG = comp > 2 ? 1 : 0, ofsB = comp > 2 ? 2 : 0;
+   const unsigned char *dataR = e->data;
+   const unsigned char *dataG = dataR + ofsG;
+   const unsigned char *dataB = dataR + ofsB;
+   int x, y, pos;
+   if(e->subsample) {
+      for(y = first_row*16; y < height && y < last_row*16; y += 16) {
+         for(x = 0; x < width; x += 16) {
+            float Y[256], U[256], V[256];
+            for(row = y, pos = 0; row < y+16; ++row) {
+               // row >= height => use last input row
+               int clamped_row = (row < height) ? row : height - 1;
+               int base_p = (stbi__flip_vertically_on_write ? (height-1-clamped_row) : clamped_row)*width*comp;
+               for(col = x; col < x+16; ++col, ++pos) {
+                  // if col >= width => use pixel from last input column
+                  int p = base_p + ((col < width) ? col : (width-1))*comp;
+                  float r = dataR[p], g = dataG[p], b = dataB[p];
+                  Y[pos]= +0.29900f*r + 0.58700f*g + 0.11400f*b - 128;
+                  U[pos]= -0.16874f*r - 0.33126f*g + 0.50000f*b;
+                  V[pos]= +0.50000f*r - 0.41869f*g - 0.08131f*b;
+               }
+            }
+            DCY = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, Y+0,   16, fdtbl_Y, DCY, YDC_HT, YAC_HT);
+            DCY = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, Y+8,   16, fdtbl_Y, DCY, YDC_HT, YAC_HT);
+            DCY = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, Y+128, 16, fdtbl_Y, DCY, YDC_HT, YAC_HT);
+            DCY = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, Y+136, 16, fdtbl_Y, DCY, YDC_HT, YAC_HT);
+
+            // subsample U,V
+            {
+               float subU[64], subV[64];
+               int yy, xx;
+               for(yy = 0, pos = 0; yy < 8; ++yy) {
+                  for(xx = 0; xx < 8; ++xx, ++pos) {
+                     int j = yy*32+xx*2;
+                     subU[pos] = (U[j+0] + U[j+1] + U[j+16] + U[j+17]) * 0.25f;
+                     subV[pos] = (V[j+0] + V[j+1] + V[j+16] + V[j+17]) * 0.25f;
+                  }
+               }
+               DCU = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, subU, 8, fdtbl_UV, DCU, UVDC_HT, UVAC_HT);
+               DCV = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, subV, 8, fdtbl_UV, DCV, UVDC_HT, UVAC_HT);
+            }
+         }
+      }
+   } else {
+      for(y = first_row*8; y < height && y < last_row*8; y += 8) {
+         for(x = 0; x < width; x += 8) {
+            float Y[64], U[64], V[64];
+            for(row = y, pos = 0; row < y+8; ++row) {
+               // row >= height => use last input row
+               int clamped_row = (row < height) ? row : height - 1;
+               int base_p = (stbi__flip_vertically_on_write ? (height-1-clamped_row) : clamped_row)*width*comp;
+               for(col = x; col < x+8; ++col, ++pos) {
+                  // if col >= width => use pixel from last input column
+                  int p = base_p + ((col < width) ? col : (width-1))*comp;
+                  float r = dataR[p], g = dataG[p], b = dataB[p];
+                  Y[pos]= +0.29900f*r + 0.58700f*g + 0.11400f*b - 128;
+                  U[pos]= -0.16874f*r - 0.33126f*g + 0.50000f*b;
+                  V[pos]= +0.50000f*r - 0.41869f*g - 0.08131f*b;
+               }
+            }
+
+            DCY = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, Y, 8, fdtbl_Y,  DCY, YDC_HT, YAC_HT);
+            DCU = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, U, 8, fdtbl_UV, DCU, UVDC_HT, UVAC_HT);
+            DCV = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, V, 8, fdtbl_UV, DCV, UVDC_HT, UVAC_HT);
+         }
+      }
+   }
+
+   // Do the bit alignment of the EOI or RSTn marker
+   stbiw__jpg_writeBits(s, &bitBuf, &bitCnt, fillBits);
+}
+
+// Growable memory buffer holding one band's entropy-coded segment
+typedef struct
+{
+   unsigned char *data;
+   int size, capacity;
+   int failed; // set when the buffer could not grow; later writes are dropped
+} stbiw__jpg_band;
+
+static void stbiw__jpg_band_write(void *context, void *data, int size)
+{
+   stbiw__jpg_band *b = (stbiw__jpg_band *) context;
+   if (b->failed)
+      return;
+   if (b->size + size > b->capacity) {
+      int capacity = b->capacity ? b->capacity : 4096;
+      unsigned char *grown;
+      while (capacity < b->size + size)
+         capacity *= 2;
+      grown = (unsigned char *) STBIW_REALLOC_SIZED(b->data, b->capacity, capacity);
+      if (!grown) {
+         b->failed = 1;
+         return;
+      }
+      b->data = grown;
+      b->capacity = capacity;
+   }
+   memcpy(b->data + b->size, data, size);
+   b->size += size;
+}
+
+typedef struct
+{
+   const stbiw__jpg_encoder *encoder;
+   stbiw__jpg_band *bands;
+   int rows_per_band, mcu_rows;
+} stbiw__jpg_band_job;
+
+static void stbiw__jpg_band_task(void *arg, int index)
+{
+   stbiw__jpg_band_job *job = (stbiw__jpg_band_job *) arg;
+   stbi__write_context s;
+   int first = index * job->rows_per_band;
+   int last = first + job->rows_per_band < job->mcu_rows ? first + job->rows_per_band : job->mcu_rows;
+   stbi__start_write_callbacks(&s, stbiw__jpg_band_write, &job->bands[index]);
+   stbiw__jpg_encode_rows(&s, job->encoder, first, last);
+   stbiw__write_flush(&s);
+}
+
+static int stbi_write_jpg_core_bands(stbi__write_context *s, int width, int height, int comp, const void* data, int quality,
+                                     int bands, stbi_write_parallel_func *parallel, void *parallel_context) {
    // Constants that don't pollute global namespace
    static const unsigned char std_dc_luminance_nrcodes[] = {0,0,1,5,1,1,1,1,1,1,0,0,0,0,0,0,0};
    static const unsigned char std_dc_luminance_values[] = {0,1,2,3,4,5,6,7,8,9,10,11};
@@ -1414,8 +1632,10 @@ static int stbi_write_jpg_core(stbi__write_context *s, int width, int height, in
                                  1.0f * 2.828427125f, 0.785694958f * 2.828427125f, 0.541196100f * 2.828427125f, 0.275899379f * 2.828427125f };
 
    int row, col, i, k, subsample;
+   int mcu_size, mcu_rows, mcus_per_row, rows_per_band = 0;
    float fdtbl_Y[64], fdtbl_UV[64];
    unsigned char YTable[64], UVTable[64];
+   stbiw__jpg_encoder encoder;
 
    if(!data || !width || !height || comp > 4 || comp < 1) {
       return 0;
@@ -1440,107 +1660,97 @@ static int stbi_write_jpg_core(stbi__write_context *s, int width, int height, in
       }
    }
 
+   // Bands of whole MCU rows; the restart interval (in MCUs) must fit in 16 bits
+   mcu_size = subsample ? 16 : 8;
+   mcu_rows = (height + mcu_size - 1) / mcu_size;
+   mcus_per_row = (width + mcu_size - 1) / mcu_size;
+   if (!parallel || bands > mcu_rows)
+      bands = parallel ? mcu_rows : 1;
+   if (bands > 1) {
+      rows_per_band = (mcu_rows + bands - 1) / bands;
+      if (rows_per_band * mcus_per_row > 65535)
+         rows_per_band = 65535 / mcus_per_row;
+      bands = rows_per_band > 0 ? (mcu_rows + rows_per_band - 1) / rows_per_band : 1;
+   }
+   if (bands <= 1)
+      rows_per_band = 0;
+
    // Write Headers
    {
       static const unsigned char head0[] = { 0xFF,0xD8,0xFF,0xE0,0,0x10,'J','F','I','F',0,1,1,0,0,1,0,1,0,0,0xFF,0xDB,0,0x84,0 };
       static const unsigned char head2[] = { 0xFF,0xDA,0,0xC,3,1,0,2,0x11,3,0x11,0,0x3F,0 };
       const unsigned char head1[] = { 0xFF,0xC0,0,0x11,8,(unsigned char)(height>>8),STBIW_UCHAR(height),(unsigned char)(width>>8),STBIW_UCHAR(width),
                                       3,1,(unsigned char)(subsample?0x22:0x11),0,2,0x11,1,3,0x11,1,0xFF,0xC4,0x01,0xA2,0 };
-      s->func(s->context, (void*)head0, sizeof(head0));
-      s->func(s->context, (void*)YTable, sizeof(YTable));
+      stbiw__write(s, (void*)head0, sizeof(head0));
+      stbiw__write(s, (void*)YTable, sizeof(YTable));
       stbiw__putc(s, 1);
-      s->func(s->context, UVTable, sizeof(UVTable));
-      s->func(s->context, (void*)head1, sizeof(head1));
-      s->func(s->context, (void*)(std_dc_luminance_nrcodes+1), sizeof(std_dc_luminance_nrcodes)-1);
-      s->func(s->context, (void*)std_dc_luminance_values, sizeof(std_dc_luminance_values));
+      stbiw__write(s, UVTable, sizeof(UVTable));
+      stbiw__write(s, (void*)head1, sizeof(head1));
+      stbiw__write(s, (void*)(std_dc_luminance_nrcodes+1), sizeof(std_dc_luminance_nrcodes)-1);
+      stbiw__write(s, (void*)std_dc_luminance_values, sizeof(std_dc_luminance_values));
       stbiw__putc(s, 0x10); // HTYACinfo
-      s->func(s->context, (void*)(std_ac_luminance_nrcodes+1), sizeof(std_ac_luminance_nrcodes)-1);
-      s->func(s->context, (void*)std_ac_luminance_values, sizeof(std_ac_luminance_values));
+      stbiw__write(s, (void*)(std_ac_luminance_nrcodes+1), sizeof(std_ac_luminance_nrcodes)-1);
+      stbiw__write(s, (void*)std_ac_luminance_values, sizeof(std_ac_luminance_values));
       stbiw__putc(s, 1); // HTUDCinfo
-      s->func(s->context, (void*)(std_dc_chrominance_nrcodes+1), sizeof(std_dc_chrominance_nrcodes)-1);
-      s->func(s->context, (void*)std_dc_chrominance_values, sizeof(std_dc_chrominance_values));
+      stbiw__write(s, (void*)(std_dc_chrominance_nrcodes+1), sizeof(std_dc_chrominance_nrcodes)-1);
+      stbiw__write(s, (void*)std_dc_chrominance_values, sizeof(std_dc_chrominance_values));
       stbiw__putc(s, 0x11); // HTUACinfo
-      s->func(s->context, (void*)(std_ac_chrominance_nrcodes+1), sizeof(std_ac_chrominance_nrcodes)-1);
-      s->func(s->context, (void*)std_ac_chrominance_values, sizeof(std_ac_chrominance_values));
-      s->func(s->context, (void*)head2, sizeof(head2));
+      stbiw__write(s, (void*)(std_ac_chrominance_nrcodes+1), sizeof(std_ac_chrominance_nrcodes)-1);
+      stbiw__write(s, (void*)std_ac_chrominance_values, sizeof(std_ac_chrominance_values));
+      if (rows_per_band) {
+         int interval = rows_per_band * mcus_per_row;
+         const unsigned char dri[] = { 0xFF,0xDD,0,4,(unsigned char)(interval>>8),STBIW_UCHAR(interval) };
+         stbiw__write(s, (void*)dri, sizeof(dri));
+      }
+      stbiw__write(s, (void*)head2, sizeof(head2));
    }
 
-   // Encode 8x8 macroblocks
-   {
-      static const unsigned short fillBits[] = {0x7F, 7};
-      int DCY=0, DCU=0, DCV=0;
-      int bitBuf=0, bitCnt=0;
-      // comp == 2 is grey+alpha (alpha is ignored)
-      int ofsG = comp > 2 ? 1 : 0, ofsB = comp > 2 ? 2 : 0;
-      const unsigned char *dataR = (const unsigned char *)data;
-      const unsigned char *dataG = dataR + ofsG;
-      const unsigned char *dataB = dataR + ofsB;
-      int x, y, pos;
-      if(subsample) {
-         for(y = 0; y < height; y += 16) {
-            for(x = 0; x < width; x += 16) {
-               float Y[256], U[256], V[256];
-               for(row = y, pos = 0; row < y+16; ++row) {
-                  // row >= height => use last input row
-                  int clamped_row = (row < height) ? row : height - 1;
-                  int base_p = (stbi__flip_vertically_on_write ? (height-1-clamped_row) : clamped_row)*width*comp;
-                  for(col = x; col < x+16; ++col, ++pos) {
-                     // if col >= width => use pixel from last input column
-                     int p = base_p + ((col < width) ? col : (width-1))*comp;
-                     float r = dataR[p], g = dataG[p], b = dataB[p];
-                     Y[pos]= +0.29900f*r + 0.58700f*g + 0.11400f*b - 128;
-                     U[pos]= -0.16874f*r - 0.33126f*g + 0.50000f*b;
-                     V[pos]= +0.50000f*r - 0.41869f*g - 0.08131f*b;
-                  }
-               }
-               DCY = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, Y+0,   16, fdtbl_Y, DCY, YDC_HT, YAC_HT);
-               DCY = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, Y+8,   16, fdtbl_Y, DCY, YDC_HT, YAC_HT);
-               DCY = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, Y+128, 16, fdtbl_Y, DCY, YDC_HT, YAC_HT);
-               DCY = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, Y+136, 16, fdtbl_Y, DCY, YDC_HT, YAC_HT);
-
-               // subsample U,V
-               {
-                  float subU[64], subV[64];
-                  int yy, xx;
-                  for(yy = 0, pos = 0; yy < 8; ++yy) {
-                     for(xx = 0; xx < 8; ++xx, ++pos) {
-                        int j = yy*32+xx*2;
-                        subU[pos] = (U[j+0] + U[j+1] + U[j+16] + U[j+17]) * 0.25f;
-                        subV[pos] = (V[j+0] + V[j+1] + V[j+16] + V[j+17]) * 0.25f;
-                     }
-                  }
-                  DCU = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, subU, 8, fdtbl_UV, DCU, UVDC_HT, UVAC_HT);
-                  DCV = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, subV, 8, fdtbl_UV, DCV, UVDC_HT, UVAC_HT);
-               }
-            }
-         }
-      } else {
-         for(y = 0; y < height; y += 8) {
-            for(x = 0; x < width; x += 8) {
-               float Y[64], U[64], V[64];
-               for(row = y, pos = 0; row < y+8; ++row) {
-                  // row >= height => use last input row
-                  int clamped_row = (row < height) ? row : height - 1;
-                  int base_p = (stbi__flip_vertically_on_write ? (height-1-clamped_row) : clamped_row)*width*comp;
-                  for(col = x; col < x+8; ++col, ++pos) {
-                     // if col >= width => use pixel from last input column
-                     int p = base_p + ((col < width) ? col : (width-1))*comp;
-                     float r = dataR[p], g = dataG[p], b = dataB[p];
-                     Y[pos]= +0.29900f*r + 0.58700f*g + 0.11400f*b - 128;
-                     U[pos]= -0.16874f*r - 0.33126f*g + 0.50000f*b;
-                     V[pos]= +0.50000f*r - 0.41869f*g - 0.08131f*b;
-                  }
-               }
+   encoder.data = (const unsigned char *) data;
+   encoder.width = width;
+   encoder.height = height;
+   encoder.comp = comp;
+   encoder.subsample = subsample;
+   encoder.fdtbl_Y = fdtbl_Y;
+   encoder.fdtbl_UV = fdtbl_UV;
+   encoder.YDC_HT = YDC_HT;
+   encoder.UVDC_HT = UVDC_HT;
+   encoder.YAC_HT = YAC_HT;
+   encoder.UVAC_HT = UVAC_HT;
+
+   if (rows_per_band) {
+      // Each band is coded on the caller's threads, then the segments are written in order
+      stbiw__jpg_band_job job;
+      job.encoder = &encoder;
+      job.rows_per_band = rows_per_band;
+      job.mcu_rows = mcu_rows;
+      job.bands = (stbiw__jpg_band *) STBIW_MALLOC(sizeof(stbiw__jpg_band) * bands);
+      if (!job.bands)
+         return 0;
+      memset(job.bands, 0, sizeof(stbiw__jpg_band) * bands);
+
+      parallel(parallel_context, bands, stbiw__jpg_band_task, &job);
+
+      for (i = 0; i < bands; ++i)
+         if (job.bands[i].failed)
+            break;
+      if (i < bands) {
+         for (i = 0; i < bands; ++i)
+            STBIW_FREE(job.bands[i].data);
+         STBIW_FREE(job.bands);
+         return 0;
+      }
 
-               DCY = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, Y, 8, fdtbl_Y,  DCY, YDC_HT, YAC_HT);
-               DCU = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, U, 8, fdtbl_UV, DCU, UVDC_HT, UVAC_HT);
-               DCV = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, V, 8, fdtbl_UV, DCV, UVDC_HT, UVAC_HT);
-            }
+      for (i = 0; i < bands; ++i) {
+         if (i > 0) {
+            stbiw__putc(s, 0xFF);
+            stbiw__putc(s, (unsigned char)(0xD0 + ((i - 1) & 7)));
          }
+         stbiw__write(s, job.bands[i].data, job.bands[i].size);
+         STBIW_FREE(job.bands[i].data);
       }
-
-      // Do the bit alignment of the EOI marker
-      stbiw__jpg_writeBits(s, &bitBuf, &bitCnt, fillBits);
+      STBIW_FREE(job.bands);
+   } else {
+      stbiw__jpg_encode_rows(s, &encoder, 0, mcu_rows);
    }
 
    // EOI
@@ -1550,11 +1760,29 @@ static int stbi_write_jpg_core(stbi__write_context *s, int width, int height, in
    return 1;
 }
 
+static int stbi_write_jpg_core(stbi__write_context *s, int width, int height, int comp, const void* data, int quality) {
+   return stbi_write_jpg_core_bands(s, width, height, comp, data, quality, 1, NULL, NULL);
+}
+
 STBIWDEF int stbi_write_jpg_to_func(stbi_write_func *func, void *context, int x, int y, int comp, const void *data, int quality)
 {
    stbi__write_context s;
+   int r;
    stbi__start_write_callbacks(&s, func, context);
-   return stbi_write_jpg_core(&s, x, y, comp, (void *) data, quality);
+   r = stbi_write_jpg_core(&s, x, y, comp, (void *) data, quality);
+   stbiw__write_flush(&s);
+   return r;
+}
+
+STBIWDEF int stbi_write_jpg_parallel_to_func(stbi_write_func *func, void *context, int x, int y, int comp, const void *data, int quality,
+                                             int bands, stbi_write_parallel_func *parallel, void *parallel_context)
+{
+   stbi__write_context s;
+   int r;
+   stbi__start_write_callbacks(&s, func, context);
+   r = stbi_write_jpg_core_bands(&s, x, y, comp, data, quality, bands, parallel, parallel_context);
+   stbiw__write_flush(&s);
+   return r;
 }
 
 
@@ -1569,6 +1797,18 @@ STBIWDEF int stbi_write_jpg(char const *filename, int x, int y, int comp, const
    } else
       return 0;
 }
+
+STBIWDEF int stbi_write_jpg_parallel(char const *filename, int x, int y, int comp, const void *data, int quality,
+                                     int bands, stbi_write_parallel_func *parallel, void *parallel_context)
+{
+   stbi__write_context s;
+   if (stbi__start_write_file(&s,filename)) {
+      int r = stbi_write_jpg_core_bands(&s, x, y, comp, data, quality, bands, parallel, parallel_context);
+      stbi__end_write_file(&s);
+      return r;
+   } else
+      return 0;
+}
 #endif
 
 #endif // STB_IMAGE_WRITE_IMPLEMENTATION